@@ -0,0 +1,21 @@
+#!/bin/bash
+# ./bench/bench_pipeline.sh
+# throughput of one connection with deep pipelines, thousands of requests
+# arrive in each read() and are consumed from the front of the input buffer
+#
+# usage: ./bench/bench_pipeline.sh [server options...]
+# run `make all bench` first
+
+BIN=./build/bin
+
+$BIN/server_greenis "$@" >/dev/null 2>&1 &
+pid=$!
+sleep 0.5
+for p in 1 16 256 1024 4096; do
+    $BIN/bench_loadgen -c 1 -p $p -d 3 get
+done
+for p in 1024 4096; do
+    $BIN/bench_loadgen -c 1 -p $p -d 3 set
+done
+kill $pid
+wait $pid 2>/dev/null || true
@@ -0,0 +1,21 @@
+#!/bin/bash
+# ./bench/bench_shards.sh
+# throughput of the shared-nothing mode from 1 to N shards (default: nproc)
+#
+# usage: ./bench/bench_shards.sh [max_shards] [loadgen options...]
+# run `make all bench` first
+
+BIN=./build/bin
+MAX=${1:-$(nproc)}
+shift
+ARGS=${@:--c 32 -p 16 -d 3}
+
+for ((n = 1; n <= MAX; n *= 2)); do
+    $BIN/server_greenis --shards $n >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    printf "shards=%-3d " $n
+    $BIN/bench_loadgen $ARGS set
+    kill $pid
+    wait $pid 2>/dev/null || true
+done
@@ -0,0 +1,160 @@
+/**
+ * @file ./bench/hash.cpp
+ * @brief the speed of str_hash() against the FNV loop it replaced, and its quality on key sets
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-13
+ * @copyright Copyright (c) 2025
+ *
+ * @details The quality part hashes key sets shaped like real ones (counters,
+ * prefixed ids, member names, random bytes) and checks what the hashtables
+ * rely on: no full 64-bit collisions, the low bits (the slot) and the top 7
+ * bits (the tag) evenly spread. It exits with 1 if a check fails.
+ *
+ * usage: bench_hash [nkeys]    (default: 1000000)
+ */
+
+/* stdlib */
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* C++ */
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/* proj */
+#include <HashTable.h>
+
+/* the hash as it was */
+static uint64_t fnv_hash(const uint8_t *data, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h + data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static double now_ns() {
+    using namespace std::chrono;
+    return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* ns per hash of `len` bytes */
+static double speed(uint64_t (*hash)(const uint8_t *, size_t), size_t len) {
+    std::vector<uint8_t> buf(len + 64);
+    for (size_t i = 0; i < buf.size(); i++) {
+        buf[i] = (uint8_t)(i * 131 + 7);
+    }
+    size_t rounds = (64u << 20) / (len + 8);
+    uint64_t sink = 0;
+    double t0 = now_ns();
+    for (size_t i = 0; i < rounds; i++) {
+        buf[i & 63] = (uint8_t)sink;    /* a dependency, so the calls are not folded */
+        sink += hash(buf.data() + (i & 63), len);
+    }
+    double ns = (now_ns() - t0) / (double)rounds;
+    if (sink == 42) {
+        printf(" ");
+    }
+    return ns;
+}
+
+/* chi-square of `nbins` buckets over `n` values, normalized: ~1 is uniform */
+static double chi2(const std::vector<uint64_t> &hashes, int shift, uint64_t mask) {
+    std::vector<uint64_t> bins(mask + 1);
+    for (uint64_t h : hashes) {
+        bins[(h >> shift) & mask]++;
+    }
+    double expect = (double)hashes.size() / (double)bins.size();
+    double sum = 0;
+    for (uint64_t c : bins) {
+        sum += ((double)c - expect) * ((double)c - expect) / expect;
+    }
+    return sum / (double)(bins.size() - 1);
+}
+
+static bool quality(const char *name, const std::vector<std::string> &keys,
+                    const char *hname, uint64_t (*hash)(const uint8_t *, size_t)) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(keys.size());
+    for (const std::string &k : keys) {
+        hashes.push_back(hash((const uint8_t *)k.data(), k.size()));
+    }
+    std::vector<uint64_t> sorted = hashes;
+    std::sort(sorted.begin(), sorted.end());
+    size_t dups = (size_t)(sorted.end() - std::unique(sorted.begin(), sorted.end()));
+
+    double slot = chi2(hashes, 0, (1u << 16) - 1);  /* the low bits: the slot */
+    double tag = chi2(hashes, 57, 127);             /* the top 7 bits: the tag */
+    double mid = chi2(hashes, 24, 255);             /* the shard */
+    /* the normalized chi-square of a uniform hash stays within ~4 sigma of 1 */
+    bool ok = dups == 0 && fabs(slot - 1) < 0.05 && fabs(tag - 1) < 0.5 && fabs(mid - 1) < 0.4;
+    printf("%-12s %-7s %9zu %6zu %8.3f %8.3f %8.3f   %s\n",
+           name, hname, keys.size(), dups, slot, tag, mid, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+/* only str_hash() has to pass, the old hash is shown for reference */
+static bool check(const char *name, const std::vector<std::string> &keys) {
+    quality(name, keys, "fnv", &fnv_hash);
+    return quality(name, keys, "wyhash", &str_hash);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000000;
+    hash_seed_init();
+
+    printf("%-8s %10s %10s   (ns/hash)\n", "bytes", "fnv", "wyhash");
+    const size_t lens[] = {4, 8, 16, 24, 32, 64, 256, 1024, 4096};
+    for (size_t len : lens) {
+        printf("%-8zu %10.2f %10.2f\n", len, speed(&fnv_hash, len), speed(&str_hash, len));
+    }
+
+    printf("\n%-12s %-7s %9s %6s %8s %8s %8s   (chi2/df, ~1 is uniform)\n",
+           "keys", "hash", "n", "dups", "slot", "tag", "shard");
+    bool ok = true;
+    char buf[64];
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n; i++) {
+        keys.emplace_back(buf, (size_t)snprintf(buf, sizeof(buf), "%zu", i));
+    }
+    ok = check("counter", keys) && ok;
+    keys.clear();
+    for (size_t i = 0; i < n; i++) {
+        keys.emplace_back(buf, (size_t)snprintf(buf, sizeof(buf), "user:%08zu", i));
+    }
+    ok = check("user:id", keys) && ok;
+    keys.clear();
+    for (size_t i = 0; i < n; i++) {
+        keys.emplace_back(buf, (size_t)snprintf(buf, sizeof(buf), "session:%zx:cart", i * 7919));
+    }
+    ok = check("session:hex", keys) && ok;
+    keys.clear();
+    for (size_t i = 0; i < n; i++) {
+        keys.emplace_back(buf, (size_t)snprintf(buf, sizeof(buf), "m%06zu", i));
+    }
+    ok = check("zset member", keys) && ok;
+    keys.clear();
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys.emplace_back((const char *)&x, 8);
+    }
+    ok = check("random 8B", keys) && ok;
+    keys.clear();
+    for (size_t i = 0; i < n; i++) {
+        std::string k(40, 'a');
+        memcpy(&k[16], &i, sizeof(i));  /* a long shared prefix and suffix */
+        keys.push_back(std::move(k));
+    }
+    ok = check("40B 1-field", keys) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/**
+ * @file ./bench/hmap.cpp
+ * @brief compare the open-addressing HMap with the chained table it replaced
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-12
+ * @copyright Copyright (c) 2025
+ *
+ * @details Both tables are driven the way the server drives them: intrusive
+ * nodes, FNV hash codes of the key bytes, an `eq` callback, and progressive
+ * rehashing. The keys are visited in a scattered order so the cache misses
+ * show up like they do on a large keyspace.
+ *
+ * usage: bench_hmap [nkeys...]     (default: 1000000 10000000)
+ *
+ * example: bench_hmap 1000000 10000000 100000000 (100M keys take ~6 GB)
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* C++ */
+#include <chrono>
+#include <vector>
+
+/* proj */
+#include <HashTable.h>
+#include <defs.h>
+
+/* the chained table as it was, with a load factor of 8 */
+namespace chained {
+
+struct HNode {
+    HNode *next = NULL;
+    uint64_t hcode = 0;
+};
+
+struct HTab {
+    HNode **tab = NULL;
+    size_t mask = 0;
+    size_t size = 0;
+};
+
+struct HMap {
+    HTab newer;
+    HTab older;
+    size_t migrate_pos = 0;
+};
+
+const size_t k_max_load_factor = 8;
+
+static void h_init(HTab *htab, size_t n) {
+    htab->tab = (HNode **)calloc(n, sizeof(HNode *));
+    htab->mask = n - 1;
+    htab->size = 0;
+}
+
+static void h_insert(HTab *htab, HNode *node) {
+    size_t pos = node->hcode & htab->mask;
+    node->next = htab->tab[pos];
+    htab->tab[pos] = node;
+    htab->size++;
+}
+
+static HNode **h_lookup(HTab *htab, HNode *key, bool (*eq)(HNode *, HNode *)) {
+    if (!htab->tab) {
+        return NULL;
+    }
+    HNode **from = &htab->tab[key->hcode & htab->mask];
+    for (HNode *cur; (cur = *from) != NULL; from = &cur->next) {
+        if (cur->hcode == key->hcode && eq(cur, key)) {
+            return from;
+        }
+    }
+    return NULL;
+}
+
+static HNode *h_detach(HTab *htab, HNode **from) {
+    HNode *node = *from;
+    *from = node->next;
+    htab->size--;
+    return node;
+}
+
+static void hm_help_rehashing(HMap *hmap) {
+    size_t nwork = 0;
+    while (nwork < K_REHASHING_WORK && hmap->older.size > 0) {
+        HNode **from = &hmap->older.tab[hmap->migrate_pos];
+        if (!*from) {
+            hmap->migrate_pos++;
+            continue;
+        }
+        h_insert(&hmap->newer, h_detach(&hmap->older, from));
+        nwork++;
+    }
+    if (hmap->older.size == 0 && hmap->older.tab) {
+        free(hmap->older.tab);
+        hmap->older = HTab{};
+    }
+}
+
+static HNode *hm_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
+    hm_help_rehashing(hmap);
+    HNode **from = h_lookup(&hmap->newer, key, eq);
+    if (!from) {
+        from = h_lookup(&hmap->older, key, eq);
+    }
+    return from ? *from : NULL;
+}
+
+static void hm_insert(HMap *hmap, HNode *node) {
+    if (!hmap->newer.tab) {
+        h_init(&hmap->newer, 4);
+    }
+    h_insert(&hmap->newer, node);
+    if (!hmap->older.tab && hmap->newer.size >= (hmap->newer.mask + 1) * k_max_load_factor) {
+        hmap->older = hmap->newer;
+        h_init(&hmap->newer, (hmap->newer.mask + 1) * 2);
+        hmap->migrate_pos = 0;
+    }
+    hm_help_rehashing(hmap);
+}
+
+static HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
+    hm_help_rehashing(hmap);
+    if (HNode **from = h_lookup(&hmap->newer, key, eq)) {
+        return h_detach(&hmap->newer, from);
+    }
+    if (HNode **from = h_lookup(&hmap->older, key, eq)) {
+        return h_detach(&hmap->older, from);
+    }
+    return NULL;
+}
+
+static void hm_clear(HMap *hmap) {
+    free(hmap->newer.tab);
+    free(hmap->older.tab);
+    *hmap = HMap{};
+}
+
+}   /* namespace chained */
+
+struct OpenNode {
+    HNode node;
+    uint64_t key = 0;
+};
+
+struct ChainedNode {
+    chained::HNode node;
+    uint64_t key = 0;
+};
+
+static bool open_eq(HNode *a, HNode *b) {
+    return container_of(a, OpenNode, node)->key == container_of(b, OpenNode, node)->key;
+}
+
+static bool chained_eq(chained::HNode *a, chained::HNode *b) {
+    return container_of(a, ChainedNode, node)->key == container_of(b, ChainedNode, node)->key;
+}
+
+static uint64_t key_hash(uint64_t key) {
+    return str_hash((const uint8_t *)&key, sizeof(key));
+}
+
+/* a scattered order over [0, n): the multiplier is a prime larger than n */
+static size_t scatter(size_t i, size_t n) {
+    return (size_t)((i * (unsigned __int128)2654435761u) % n);
+}
+
+static double now_ns() {
+    using namespace std::chrono;
+    return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    double insert, hit, miss, del;  /* ns per operation */
+};
+
+/* the same benchmark over both tables */
+template <class Map, class Node, class HN>
+static Result run(size_t n,
+                  void (*insert)(Map *, HN *),
+                  HN *(*lookup)(Map *, HN *, bool (*)(HN *, HN *)),
+                  HN *(*remove)(Map *, HN *, bool (*)(HN *, HN *)),
+                  void (*clear)(Map *),
+                  bool (*eq)(HN *, HN *)) {
+    std::vector<Node> nodes(n);
+    for (size_t i = 0; i < n; i++) {
+        nodes[i].key = i;
+        nodes[i].node.hcode = key_hash(i);
+    }
+
+    Map map;
+    Result res = {};
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        insert(&map, &nodes[scatter(i, n)].node);
+    }
+    res.insert = (now_ns() - t0) / (double)n;
+
+    Node key;
+    size_t found = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        key.key = scatter(i + 1, n);
+        key.node.hcode = key_hash(key.key);
+        found += lookup(&map, &key.node, eq) != NULL;
+    }
+    res.hit = (now_ns() - t0) / (double)n;
+    assert(found == n);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        key.key = n + i;
+        key.node.hcode = key_hash(key.key);
+        found += lookup(&map, &key.node, eq) != NULL;
+    }
+    res.miss = (now_ns() - t0) / (double)n;
+    assert(found == n);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        key.key = scatter(i + 7, n);
+        key.node.hcode = key_hash(key.key);
+        found -= remove(&map, &key.node, eq) != NULL;
+    }
+    res.del = (now_ns() - t0) / (double)n;
+    assert(found == 0);
+
+    clear(&map);
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back((size_t)strtoull(argv[i], NULL, 10));
+    }
+    if (sizes.empty()) {
+        sizes = {1000000, 10000000};
+    }
+
+    printf("%-10s %-8s %10s %10s %10s %10s   (ns/op)\n",
+           "keys", "table", "insert", "hit", "miss", "delete");
+    for (size_t n : sizes) {
+        Result c = run<chained::HMap, ChainedNode, chained::HNode>(n,
+            &chained::hm_insert, &chained::hm_lookup, &chained::hm_delete,
+            &chained::hm_clear, &chained_eq);
+        printf("%-10zu %-8s %10.1f %10.1f %10.1f %10.1f\n",
+               n, "chained", c.insert, c.hit, c.miss, c.del);
+        Result o = run<HMap, OpenNode, HNode>(n,
+            &hm_insert, &hm_lookup, &hm_delete, &hm_clear, &open_eq);
+        printf("%-10zu %-8s %10.1f %10.1f %10.1f %10.1f\n",
+               n, "open", o.insert, o.hit, o.miss, o.del);
+    }
+    return 0;
+}
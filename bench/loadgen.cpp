@@ -0,0 +1,236 @@
+/**
+ * @file ./bench/loadgen.cpp
+ * @brief a load generator that drives the server with pipelined requests
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-02
+ * @copyright Copyright (c) 2025
+ *
+ * @details Each active connection runs in its own thread and keeps `pipeline`
+ * requests in flight. Optional idle connections are opened before the run and
+ * never send anything, so the per-iteration cost of the event loop over idle
+ * sockets shows up as lost throughput and higher latency.
+ *
+ * usage: loadgen [-c active_conns] [-i idle_conns] [-p pipeline]
+ *                [-d seconds] [-k keyspace] [-v value_size] [-P port] [get|set]
+ *
+ * example: compare `loadgen -i 0` with `loadgen -i 20000` (raise `ulimit -n`
+ * on both sides first). Keep `-d` below the 5s idle timeout of the server.
+ */
+
+/* stdlib */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* system */
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+/* C++ */
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* proj */
+#include <defs.h>
+
+struct Options {
+    int active = 4;
+    int idle = 0;
+    int pipeline = 1;
+    int seconds = 3;
+    int keyspace = 10000;
+    int value_size = 5;
+    int port = PORT;
+    bool set = false;
+};
+
+static std::atomic<bool> g_stop{false};
+
+static int dial(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    return fd;
+}
+
+static void append_u32(std::string &out, uint32_t v) {
+    out.append((const char *)&v, 4);
+}
+
+/* serialize one request frame */
+static void append_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + (uint32_t)s.size();
+    }
+    append_u32(out, len);
+    append_u32(out, (uint32_t)cmd.size());
+    for (const std::string &s : cmd) {
+        append_u32(out, (uint32_t)s.size());
+        out += s;
+    }
+}
+
+static bool write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv <= 0) {
+            return false;
+        }
+        buf += rv;
+        n -= (size_t)rv;
+    }
+    return true;
+}
+
+/* read `n` complete response frames, return false on error */
+static bool read_frames(int fd, std::vector<uint8_t> &buf, int n) {
+    size_t have = buf.size();
+    size_t pos = 0;
+    buf.resize(have + 64 * 1024);
+    while (n > 0) {
+        if (have - pos >= 4) {
+            uint32_t len = 0;
+            memcpy(&len, &buf[pos], 4);
+            if (have - pos >= 4 + (size_t)len) {
+                pos += 4 + len;
+                n--;
+                continue;
+            }
+        }
+        if (buf.size() - have < 4096) {
+            buf.resize(buf.size() * 2);
+        }
+        ssize_t rv = read(fd, &buf[have], buf.size() - have);
+        if (rv <= 0) {
+            return false;
+        }
+        have += (size_t)rv;
+    }
+    buf.erase(buf.begin(), buf.begin() + pos);
+    buf.resize(have - pos);
+    return true;
+}
+
+struct Stats {
+    uint64_t ops = 0;
+    uint64_t batches = 0;
+    uint64_t lat_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+static void client(const Options &opt, int id, Stats *st) {
+    int fd = dial(opt.port);
+    if (fd < 0) {
+        fprintf(stderr, "connect() failed\n");
+        return;
+    }
+    std::vector<uint8_t> rbuf;
+    std::string wbuf;
+    uint64_t seq = (uint64_t)id * 7919;
+    std::string value(opt.value_size, 'v');
+    while (!g_stop.load(std::memory_order_relaxed)) {
+        wbuf.clear();
+        for (int i = 0; i < opt.pipeline; ++i) {
+            std::string key = "key:" + std::to_string(seq++ % opt.keyspace);
+            if (opt.set) {
+                append_req(wbuf, {"set", key, value});
+            } else {
+                append_req(wbuf, {"get", key});
+            }
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        if (!write_all(fd, wbuf.data(), wbuf.size()) || !read_frames(fd, rbuf, opt.pipeline)) {
+            fprintf(stderr, "connection lost\n");
+            break;
+        }
+        uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        st->ops += (uint64_t)opt.pipeline;
+        st->batches++;
+        st->lat_ns += ns;
+        st->max_ns = ns > st->max_ns ? ns : st->max_ns;
+    }
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    int c;
+    while ((c = getopt(argc, argv, "c:i:p:d:k:v:P:")) != -1) {
+        switch (c) {
+        case 'c': opt.active = atoi(optarg); break;
+        case 'i': opt.idle = atoi(optarg); break;
+        case 'p': opt.pipeline = atoi(optarg); break;
+        case 'd': opt.seconds = atoi(optarg); break;
+        case 'k': opt.keyspace = atoi(optarg); break;
+        case 'v': opt.value_size = atoi(optarg); break;
+        case 'P': opt.port = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c active] [-i idle] [-p pipeline] "
+                "[-d seconds] [-k keyspace] [-v value_size] [-P port] [get|set]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        opt.set = strcmp(argv[optind], "set") == 0;
+    }
+
+    /* the idle connections */
+    std::vector<int> idle_fds;
+    for (int i = 0; i < opt.idle; ++i) {
+        int fd = dial(opt.port);
+        if (fd < 0) {
+            fprintf(stderr, "only %d idle connections opened\n", i);
+            break;
+        }
+        idle_fds.push_back(fd);
+    }
+
+    std::vector<Stats> stats(opt.active);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.active; ++i) {
+        threads.emplace_back(client, std::cref(opt), i, &stats[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(opt.seconds));
+    g_stop = true;
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    for (int fd : idle_fds) {
+        close(fd);
+    }
+
+    Stats total;
+    for (const Stats &st : stats) {
+        total.ops += st.ops;
+        total.batches += st.batches;
+        total.lat_ns += st.lat_ns;
+        total.max_ns = st.max_ns > total.max_ns ? st.max_ns : total.max_ns;
+    }
+    printf("%s active=%d idle=%zu pipeline=%d: %.0f ops/s, batch latency avg %.1f us, max %.1f us\n",
+        opt.set ? "set" : "get", opt.active, idle_fds.size(), opt.pipeline,
+        (double)total.ops / opt.seconds,
+        total.batches ? (double)total.lat_ns / total.batches / 1e3 : 0.0,
+        (double)total.max_ns / 1e3);
+    return 0;
+}
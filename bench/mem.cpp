@@ -0,0 +1,114 @@
+/**
+ * @file ./bench/mem.cpp
+ * @brief the memory per key of small string keys, with the Entry as it was and as it is
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-15
+ * @copyright Copyright (c) 2025
+ *
+ * @details The keys are set the way the server sets them: the compact ones
+ * through do_set(), the old ones with a copy of the old layout in the same
+ * HMap. The bytes are the heap in use as malloc counts it, the hashtable
+ * arrays and the malloc overhead included. The values are "<i>", an int
+ * encoding, or "v<i>", embedded after the key.
+ *
+ * usage: bench_mem [nkeys]     (default: 10000000)
+ */
+
+/* stdlib */
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* C++ */
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* proj */
+#include <HashTable.h>
+#include <buffer.h>
+#include <global.h>
+#include <key_value.h>
+#include <zset.h>
+#include <defs.h>
+
+/* the Entry as it was: every key had room for both value types */
+struct OldEntry {
+    struct HNode node;
+    std::string key;
+    size_t heap_idx = -1;
+    ValueType type = T_INIT;
+    RcStr *str = NULL;
+    ZSet zset;
+};
+
+static size_t heap_in_use() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;     /* the arena, and the blocks mmap()ed on their own */
+}
+
+static std::string key_of(size_t i) {
+    char buf[32];
+    return std::string(buf, (size_t)snprintf(buf, sizeof(buf), "key:%zu", i));
+}
+
+static double old_bytes(size_t n) {
+    size_t base = heap_in_use();
+    HMap db;
+    for (size_t i = 0; i < n; i++) {
+        OldEntry *ent = new OldEntry();
+        ent->key = key_of(i);
+        ent->node.hcode = str_hash((uint8_t *)ent->key.data(), ent->key.size());
+        ent->type = T_STR;
+        ent->str = rcstr_new(ent->key.data() + 4, ent->key.size() - 4);
+        hm_insert(&db, &ent->node);
+    }
+    double bytes = (double)(heap_in_use() - base) / (double)n;
+
+    hm_foreach(&db, [](HNode *node, void *) {
+        OldEntry *ent = container_of(node, OldEntry, node);
+        rcstr_unref(ent->str);
+        delete ent;
+        return true;
+    }, NULL);
+    hm_clear(&db);
+    return bytes;
+}
+
+static double new_bytes(size_t n, bool embed) {
+    size_t base = heap_in_use();
+    std::vector<std::string_view> cmd(3);
+    Buffer out;
+    cmd[0] = "set";
+    for (size_t i = 0; i < n; i++) {
+        std::string key = key_of(i);
+        std::string val = (embed ? "v" : "") + key.substr(4);
+        cmd[1] = key;
+        cmd[2] = val;
+        do_set(cmd, out);
+        buf_consume(out, buf_size(out));
+    }
+    double bytes = (double)(heap_in_use() - base) / (double)n;
+
+    hm_foreach(&g_data.db, [](HNode *node, void *) {
+        entry_del(container_of(node, Entry, node));
+        return true;
+    }, NULL);
+    hm_clear(&g_data.db);
+    return bytes;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10000000;
+    hash_seed_init();
+
+    printf("%zu keys \"key:<i>\", sizeof: Entry %zu -> %zu\n",
+           n, sizeof(OldEntry), sizeof(Entry));
+    printf("%-16s %12s\n", "entry", "bytes/key");
+    printf("%-16s %12.1f\n", "old", old_bytes(n));
+    printf("%-16s %12.1f\n", "compact, int", new_bytes(n, false));
+    printf("%-16s %12.1f\n", "compact, embed", new_bytes(n, true));
+    return 0;
+}
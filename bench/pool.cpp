@@ -0,0 +1,206 @@
+/**
+ * @file ./bench/pool.cpp
+ * @brief tasks per second through the thread pool, with many submitters
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-24
+ * @copyright Copyright (c) 2025
+ *
+ * @details The work-stealing pool of thread_pool.h is compared with a pool of
+ * one queue behind one mutex and condvar, the way it used to be. Each run
+ * queues `tasks` tiny tasks, in 3 ways:
+ *  - queue: `producers` threads out of the pool (the shards) queue one task
+ *    at a time, thread_pool_queue().
+ *  - batch: the same, K_BATCH tasks at a time, thread_pool_submit().
+ *  - spawn: the tasks queue 2 more each, down a binary tree from one root,
+ *    the way a job splits on the pool (the mutex pool takes the lock each time).
+ * A run ends when every task is done, thread_pool_stop() ends the pool.
+ *
+ * usage: bench_pool [threads] [tasks]      (default: 4 1000000)
+ */
+
+/* stdlib */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* system */
+#include <pthread.h>
+#include <sched.h>
+
+/* C++ */
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+
+/* proj */
+#include <thread_pool.h>
+
+#define K_BATCH 64      /* tasks per thread_pool_submit() */
+#define K_SPIN 32       /* the work of a task, in loop rounds */
+
+static double now_sec() {
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* one deque behind one mutex, the old TheadPool */
+struct MutexPool {
+    std::vector<pthread_t> threads;
+    std::deque<Work> queue;
+    bool stopping = false;
+    pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+};
+
+static void *mutex_worker(void *arg) {
+    MutexPool *mp = (MutexPool *)arg;
+    while (true) {
+        pthread_mutex_lock(&mp->mu);
+        while (mp->queue.empty() && !mp->stopping) {
+            pthread_cond_wait(&mp->not_empty, &mp->mu);
+        }
+        if (mp->queue.empty()) {
+            pthread_mutex_unlock(&mp->mu);
+            return NULL;
+        }
+        Work w = mp->queue.front();
+        mp->queue.pop_front();
+        pthread_mutex_unlock(&mp->mu);
+        w.f(w.arg);
+    }
+}
+
+static void mutex_queue(MutexPool *mp, const Work *works, size_t n) {
+    pthread_mutex_lock(&mp->mu);
+    for (size_t i = 0; i < n; i++) {
+        mp->queue.push_back(works[i]);
+    }
+    pthread_cond_broadcast(&mp->not_empty);
+    pthread_mutex_unlock(&mp->mu);
+}
+
+/* the pool under test, either one */
+struct Bench {
+    bool mutex = false;
+    TheadPool tp;
+    MutexPool mp;
+    std::atomic<size_t> done{0};
+};
+
+static Bench g_bench;
+
+static void bench_queue(const Work *works, size_t n) {
+    if (g_bench.mutex) {
+        return mutex_queue(&g_bench.mp, works, n);
+    }
+    thread_pool_submit(&g_bench.tp, works, n, NULL);
+}
+
+static void cb_task(void *) {
+    for (int i = 0; i < K_SPIN; i++) {
+        __asm__ volatile("" ::: "memory");
+    }
+    g_bench.done.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* a node of the tree: the tasks [lo, hi) are itself and its 2 subtrees */
+static void cb_spawn(void *arg) {
+    uintptr_t range = (uintptr_t)arg;
+    size_t lo = range >> 32, hi = range & 0xffffffff;
+    size_t mid = lo + 1 + (hi - lo - 1) / 2;
+    Work kids[2];
+    size_t nkids = 0;
+    if (lo + 1 < mid) {
+        kids[nkids++] = Work{&cb_spawn, (void *)(uintptr_t)(((lo + 1) << 32) | mid)};
+    }
+    if (mid < hi) {
+        kids[nkids++] = Work{&cb_spawn, (void *)(uintptr_t)((mid << 32) | hi)};
+    }
+    bench_queue(kids, nkids);
+    cb_task(NULL);
+}
+
+static void produce(size_t ntasks, size_t batch) {
+    std::vector<Work> works(batch, Work{&cb_task, NULL});
+    for (size_t i = 0; i < ntasks; i += batch) {
+        bench_queue(works.data(), ntasks - i < batch ? ntasks - i : batch);
+    }
+}
+
+enum Mode { M_QUEUE, M_BATCH, M_SPAWN };
+
+/* returns millions of tasks per second */
+static double run(bool mutex, Mode mode, size_t threads, size_t producers, size_t tasks) {
+    g_bench.mutex = mutex;
+    g_bench.done = 0;
+    if (mutex) {
+        g_bench.mp.stopping = false;
+        g_bench.mp.threads.resize(threads);
+        for (pthread_t &tid : g_bench.mp.threads) {
+            pthread_create(&tid, NULL, &mutex_worker, &g_bench.mp);
+        }
+    } else {
+        thread_pool_init(&g_bench.tp, threads);
+    }
+
+    double t0 = now_sec();
+    if (mode == M_SPAWN) {
+        tasks &= 0xffffffff;
+        Work root = {&cb_spawn, (void *)(uintptr_t)tasks};
+        bench_queue(&root, 1);
+    } else {
+        std::vector<std::thread> ps;
+        for (size_t p = 0; p < producers; p++) {
+            size_t n = tasks / producers + (p < tasks % producers);
+            ps.emplace_back(&produce, n, mode == M_BATCH ? (size_t)K_BATCH : (size_t)1);
+        }
+        for (std::thread &t : ps) {
+            t.join();
+        }
+    }
+    while (g_bench.done.load(std::memory_order_acquire) < tasks) {
+        sched_yield();
+    }
+    double secs = now_sec() - t0;
+
+    if (mutex) {
+        pthread_mutex_lock(&g_bench.mp.mu);
+        g_bench.mp.stopping = true;
+        pthread_cond_broadcast(&g_bench.mp.not_empty);
+        pthread_mutex_unlock(&g_bench.mp.mu);
+        for (pthread_t tid : g_bench.mp.threads) {
+            pthread_join(tid, NULL);
+        }
+    } else {
+        thread_pool_stop(&g_bench.tp);
+    }
+    return (double)tasks / secs / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    size_t threads = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 4;
+    size_t tasks = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1000000;
+    if (threads == 0 || tasks == 0) {
+        fprintf(stderr, "usage: %s [threads] [tasks]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%zu workers, %zu tasks, %u cpus   (Mtasks/s)\n",
+           threads, tasks, std::thread::hardware_concurrency());
+    printf("%-6s %-10s %10s %10s\n", "mode", "producers", "mutex", "stealing");
+    const char *names[] = {"queue", "batch"};
+    for (Mode mode : {M_QUEUE, M_BATCH}) {
+        for (size_t producers : {1, 2, 4, 8}) {
+            double a = run(true, mode, threads, producers, tasks);
+            double b = run(false, mode, threads, producers, tasks);
+            printf("%-6s %-10zu %10.2f %10.2f\n", names[mode], producers, a, b);
+        }
+    }
+    double a = run(true, M_SPAWN, threads, 1, tasks);
+    double b = run(false, M_SPAWN, threads, 1, tasks);
+    printf("%-6s %-10s %10.2f %10.2f\n", "spawn", "-", a, b);
+    return 0;
+}
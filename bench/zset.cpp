@@ -0,0 +1,159 @@
+/**
+ * @file ./bench/zset.cpp
+ * @brief compare the AVL and the B+tree (score, name) index of a zset
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-17
+ * @copyright Copyright (c) 2025
+ *
+ * @details The zsets are driven the way the commands drive them: zadd is
+ * zset_insert(), zscore is zset_score(), and zquery is zset_seekge() then
+ * zset_offset() to an offset, or zset_next() over a range. The members
+ * "m<i>" get random scores, and are visited in a scattered order. A bulk zadd is zset_add() of all of them at
+ * once into an empty zset.
+ *
+ * usage: bench_zset [nmembers...]      (default: 1000000)
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* C++ */
+#include <chrono>
+#include <string>
+#include <vector>
+
+/* proj */
+#include <zset.h>
+#include <defs.h>
+
+#define K_RANGE 100     /* members per range read */
+
+static double now_ns() {
+    using namespace std::chrono;
+    return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* a scattered order over [0, n): the multiplier is a prime larger than n */
+static size_t scatter(size_t i, size_t n) {
+    return (size_t)((i * (unsigned __int128)2654435761u) % n);
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+struct Result {
+    double insert, bulk, score, offset, range, del;    /* ns per op, per member for range */
+};
+
+static Result run(size_t n, ZSetIndex index) {
+    std::vector<std::string> names(n);
+    std::vector<double> scores(n);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < n; i++) {
+        names[i] = "m" + std::to_string(i);
+        scores[i] = (double)(rng_next(&rng) % (n * 4));
+    }
+
+    ZSet zset;
+    zset.index = index;
+    Result res = {};
+    double t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t k = scatter(i, n);
+        zset_insert(&zset, names[k].data(), names[k].size(), scores[k]);
+    }
+    res.insert = (now_ns() - t0) / (double)n;
+
+    double sum = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t k = scatter(i + 1, n);
+        double score = 0;
+        zset_score(&zset, names[k].data(), names[k].size(), &score);
+        sum += score;
+    }
+    res.score = (now_ns() - t0) / (double)n;
+
+    /* the member at a random offset from a random score */
+    size_t nq = n / 4 + 1;
+    size_t found = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < nq; i++) {
+        double s = (double)(rng_next(&rng) % (n * 4));
+        ZIter it = zset_seekge(&zset, s, "", 0);
+        it = zset_offset(&zset, it, (int64_t)(rng_next(&rng) % (n / 2 + 1)));
+        found += it.valid;
+    }
+    res.offset = (now_ns() - t0) / (double)nq;
+
+    /* K_RANGE members in order from a random score */
+    size_t nr = n / K_RANGE + 1, read = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < nr; i++) {
+        double s = (double)(rng_next(&rng) % (n * 4));
+        ZIter it = zset_seekge(&zset, s, "", 0);
+        for (size_t j = 0; j < K_RANGE && it.valid; j++, read++) {
+            sum += it.score;
+            it = zset_next(&zset, it);
+        }
+    }
+    res.range = (now_ns() - t0) / (double)(read ? read : 1);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t k = scatter(i + 7, n);
+        zset_remove(&zset, names[k].data(), names[k].size());
+    }
+    res.del = (now_ns() - t0) / (double)n;
+    assert(zset_size(&zset) == 0);
+
+    zset_clear(&zset);
+
+    std::vector<ZPair> pairs(n);
+    for (size_t i = 0; i < n; i++) {
+        size_t k = scatter(i, n);
+        pairs[i] = ZPair{scores[k], names[k].data(), names[k].size()};
+    }
+    ZSet bulk;
+    bulk.index = index;
+    t0 = now_ns();
+    zset_add(&bulk, pairs.data(), n);
+    res.bulk = (now_ns() - t0) / (double)n;
+    zset_clear(&bulk);
+
+    if (sum == 0 && found == 0) {
+        printf("\n");   /* keep the reads */
+    }
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back((size_t)strtoull(argv[i], NULL, 10));
+    }
+    if (sizes.empty()) {
+        sizes = {1000000};
+    }
+    hash_seed_init();
+
+    printf("%-10s %-6s %10s %10s %10s %10s %10s %10s   (ns/op, range: ns/member)\n",
+           "members", "index", "zadd", "bulk", "zscore", "offset", "range", "zrem");
+    for (size_t n : sizes) {
+        Result a = run(n, Z_AVL);
+        printf("%-10zu %-6s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               n, "avl", a.insert, a.bulk, a.score, a.offset, a.range, a.del);
+        Result b = run(n, Z_BTREE);
+        printf("%-10zu %-6s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               n, "btree", b.insert, b.bulk, b.score, b.offset, b.range, b.del);
+    }
+    return 0;
+}
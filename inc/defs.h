@@ -14,16 +14,106 @@
 
     #define K_MAX_ARGS ((size_t) (200 * 1000))
 
-    #define K_MAX_MSG ((size_t) 4096)
+    #define K_MAX_MSG ((size_t) 32 << 20)      /* the default of --max-msg */
+
+    #define K_MAX_MSG_LIMIT ((size_t) 1 << 30)
+
+    #define K_STREAM_LEN ((uint32_t) 0xFFFFFFFF)  /* the length of a streamed frame or array */
+
+    #define K_STREAM_CHUNK ((size_t) 64 * 1024)   /* see stream.h */
+
+    #define K_REF_MIN ((size_t) 16 * 1024)   /* strings referenced in the output, not copied */
+
+    #define K_EMBED_MAX ((size_t) 64)   /* an Entry with its key and a short value, a cache line */
+
+    #define K_MAX_IOV ((size_t) 16)     /* iovecs per writev() */
+
+    #define K_READ_SIZE ((size_t) 16 * 1024)     /* the least room for a read() */
+
+    #define K_BODY_CHUNK ((size_t) 64 * 1024)   /* the room first made for a large body, then doubled */
+
+    #define K_BUF_KEEP ((size_t) 1 << 20)       /* larger storage is freed when a buffer empties */
 
     #define K_IDLE_TIMEOUT_MS ((uint64_t) 5 * 1000)
 
     #define K_MAX_WORKS ((size_t) 2000)
 
-    #define K_MAX_LOAD_FACTOR ((size_t) 8)
+    #define K_MAX_EVENTS ((size_t) 1024)
+
+    #define K_MAX_SHARDS ((uint32_t) 256)
+
+    #define K_MAX_REPLIES ((size_t) 1024)     /* queued replies per connection */
+
+    #define K_URING_ENTRIES ((unsigned) 4096)
+
+    #define K_URING_BUFS ((unsigned) 512)     /* power of 2 */
+
+    #define K_URING_BUF_SIZE ((size_t) 16 * 1024)
+
+    #define K_LOG_RING ((size_t) 4096)     /* queued log lines, power of 2 */
+
+    #define K_LOG_LINE ((size_t) 256)     /* longer lines are truncated */
+
+    #define K_LOG_BATCH ((size_t) 64 * 1024)
+
+    #define K_LOG_IDLE_US 1000    /* the writer polls the ring when it's idle */
+
+    #define K_MAX_LOAD_FACTOR 0.875    /* of the slots, the tombstones count */
+
+    #define K_MIN_LOAD_FACTOR 0.125    /* of the slots, a table under it shrinks */
+
+    #define K_MIN_SLOTS ((size_t) 32)   /* the least hashtable size, a multiple of the group */
+
+    #define K_SLAB_PAGE ((size_t) 64 * 1024)    /* aligned to its size, see slab.h */
+
+    #define K_SLAB_MAX ((size_t) 1024)  /* the largest size class, larger objects use malloc() */
 
     #define K_REHASHING_WORK ((size_t) 128)
 
+    #define K_REHASH_IDLE_US ((uint64_t) 1000)  /* background rehashing when the loop is idle */
+
+    #define K_REHASH_BUSY_US ((uint64_t) 100)   /* between 2 batches of events */
+
+    #define K_LAZY_FREE_NODE ((size_t) 256)    /* the cost of a node to free in bytes, see lazyfree.h */
+
+    #define K_LAZY_FREE_MIN ((size_t) 64 * 1024)    /* the default least cost freed lazily */
+
+    #define K_LAZY_FREE_STEP ((size_t) 256)     /* the nodes freed in a step */
+
+    #define K_LAZY_FREE_IDLE_US ((uint64_t) 1000)   /* lazy freeing when the loop is idle */
+
+    #define K_LAZY_FREE_BUSY_US ((uint64_t) 100)    /* between 2 batches of events */
+
+    #define K_SCAN_COUNT ((int64_t) 10)     /* the default COUNT of scan and zscan */
+
+    #define K_ZSET_LP_ENTRIES ((uint32_t) 128)    /* the most members of a packed zset */
+
+    #define K_ZSET_LP_ENTRIES_MAX ((uint32_t) 65536)  /* the most --zset-listpack-entries, it's scanned */
+
+    #define K_ZSET_LP_VALUE ((size_t) 64)   /* the longest name in a packed zset, <= 255 */
+
+    #define K_ZSET_BULK_MIN ((size_t) 64)   /* a zadd of more pairs may build the index anew */
+
+    #define K_ZSTORE_PARTS ((size_t) 64)   /* the partitions of a zunionstore by name hash, a power of 2 */
+
+    #define K_ZSTORE_BATCH ((size_t) 16)    /* the input nodes prefetched ahead of the copy */
+
+    #define K_ZSTORE_ASYNC_MIN ((size_t) 16 * 1024)    /* input members to run on the thread pool */
+
+    #define K_POOL_THREADS ((size_t) 4)    /* the default workers of the thread pool */
+
+    #define K_POOL_MAX_THREADS ((size_t) 256)
+
+    #define K_POOL_DEQUE ((size_t) 256)     /* the first capacity of a worker deque, a power of 2 */
+
+    #define K_POOL_INBOX_EVERY ((uint64_t) 61)  /* a worker looks at its inbox first every these works */
+
+    #define K_POOL_SPIN 64      /* the rounds a worker looks for work before it sleeps */
+
+    #define K_BTREE_FAN 32      /* keys per B+tree node, a multiple of 4, see btree.h */
+
+    #define K_BTREE_DEPTH 16    /* the most inner levels of a B+tree */
+
     #define container_of(ptr, T, member) \
         ((T *)( (char *)ptr - offsetof(T, member) ))
 
@@ -42,6 +132,7 @@
         TAG_INT = 3,    /* int64 */
         TAG_DBL = 4,    /* double */
         TAG_ARR = 5,    /* array */
+        TAG_END = 6,    /* the end of a streamed array */
     } QueryTag;
 
     /* value types */
@@ -51,4 +142,10 @@
         T_ZSET  = 2,    /* sorted set */
     } ValueType;
 
+    /* the (score, name) index of a zset */
+    typedef enum {
+        Z_AVL   = 0,
+        Z_BTREE = 1,
+    } ZSetIndex;
+
 #endif /* !DEFS_H */
@@ -1,10 +1,16 @@
 /**
  * @file ./inc/server/HashTable.h
- * @brief 
+ * @brief
  * @author Fendy (xingfen.star@gmail.com)
  * @version 1.0
  * @date 2025-03-17
  * @copyright Copyright (c) 2025
+ *
+ * @details An open-addressing table in the style of the Swiss tables. Each
+ * slot has a control byte: empty, deleted, or the 7-bit tag of the hash of its
+ * node. A probe loads a group of control bytes at once (16 with SSE2, 32 with
+ * AVX2) and compares all the tags in one instruction, so the nodes are only
+ * dereferenced on a tag match, about 1/128 of the misses.
  */
 
 #ifndef HASH_TABLE_H
@@ -12,19 +18,24 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include <list.h>
 
 
 /* hashtable node, should be embedded into the payload */
 struct HNode {
-    HNode *next = NULL;
     uint64_t hcode = 0;
 };
 
 /* a simple fixed-sized hashtable */
 struct HTab {
-    HNode **tab = NULL; /* array of slots */
-    size_t mask = 0;    /* power of 2 array size, 2^n - 1 */
-    size_t size = 0;    /* number of keys */
+    uint8_t *ctrl = NULL;   /* control bytes, in groups aligned to the cache lines */
+    HNode **slots = NULL;   /* array of slots */
+    size_t mask = 0;        /* power of 2 array size, 2^n - 1 */
+    size_t size = 0;        /* number of keys */
+    size_t used = 0;        /* keys and tombstones */
+    size_t limit = 0;       /* `used` that triggers the rehashing */
 };
 
 /* the real hashtable interface */
@@ -33,24 +44,151 @@ struct HMap {
     HTab newer;
     HTab older;
     size_t migrate_pos = 0;
+    uint32_t paused = 0;    /* no migration while it's iterated in steps */
+    DList rehash_node;      /* in the background list while migrating, see hm_rehash_background() */
+};
+
+/* the background rehashing of the calling thread, for the stats */
+struct RehashStats {
+    uint64_t runs = 0;      /* the calls that had work */
+    uint64_t usec = 0;      /* the time spent */
+    uint64_t groups = 0;    /* the groups migrated */
+};
+
+/*
+ * wyhash (Wang Yi, public domain): 64-bit, 16 or 48 bytes per step, the keys
+ * up to 16 bytes take no loop. It's keyed by a seed chosen at startup so the
+ * collisions can't be planned from outside.
+ */
+extern uint64_t g_hash_seed;    /* mixed with the secret already, see hash_seed_init() */
+
+/* pick a random seed, before any hashing and any thread */
+void hash_seed_init();
+/* a fixed seed, for tests and benchmarks */
+void hash_seed_set(uint64_t seed);
+
+static const uint64_t k_wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
 };
 
-/* FNV hash */
+inline void wy_mum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+inline uint64_t wy_r8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t wy_r4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
 inline uint64_t str_hash(const uint8_t *data, size_t len) {
-    uint32_t h = 0x811C9DC5;
-    for (size_t i = 0; i < len; i++) {
-        h = (h + data[i]) * 0x01000193;
+    const uint8_t *p = data;
+    uint64_t seed = g_hash_seed;
+    uint64_t a = 0, b = 0;
+    if (__builtin_expect(len <= 16, 1)) {
+        if (len >= 4) {     /* 2 overlapping reads from each end */
+            size_t mid = (len >> 3) << 2;
+            a = (wy_r4(p) << 32) | wy_r4(p + mid);
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {       /* 3 independent lanes */
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ k_wyp[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ k_wyp[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ k_wyp[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ k_wyp[1], wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
     }
-    return h;
+    a ^= k_wyp[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ k_wyp[0] ^ len, b ^ k_wyp[1]);
 }
 
 bool hnode_same(HNode *node, HNode *key);
 HNode *hm_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void   hm_insert(HMap *hmap, HNode *node);
 HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
+/* put `node` in the slot of `old`, for a node that moves, the hash code stays */
+void   hm_replace(HMap *hmap, HNode *old, HNode *node);
+/* room for `n` keys without growing, for a bulk insert */
+void   hm_reserve(HMap *hmap, size_t n);
 void   hm_clear(HMap *hmap);
 size_t hm_size(HMap *hmap);
 /* invoke the callback on each node until it returns false */
 void   hm_foreach(HMap *hmap, bool (*f)(HNode *, void *), void *arg);
+/*
+ * iterate in steps: visit the slots from `pos` and stop at the slot where the
+ * callback returned false. Returns the `pos` to continue from, or -1 when
+ * done. The map must be paused in between, see hm_pause_rehashing().
+ */
+size_t hm_foreach_from(HMap *hmap, size_t pos, bool (*f)(HNode *, void *), void *arg);
+/*
+ * scan with a cursor, 0 to start and 0 when done: each call visits the nodes
+ * hashed to one group of slots. Unlike hm_foreach_from() the map is free to
+ * rehash in between, a node present the whole time is still visited, maybe
+ * twice. The callback must not modify the map.
+ */
+size_t hm_scan(HMap *hmap, size_t cursor, void (*f)(HNode *, void *), void *arg);
+/*
+ * While paused, the nodes stay in their slots: the migration waits, and a
+ * new table is only started when `older` is free, it goes after the others
+ * in the order of hm_foreach_from(). Only if `newer` runs out of slots
+ * meanwhile, the migration is finished at once and the nodes move.
+ */
+void   hm_pause_rehashing(HMap *hmap);
+void   hm_resume_rehashing(HMap *hmap);
+
+/*
+ * A migrating map is listed for the thread that started it, which moves it
+ * on with hm_rehash_background() when the event loop has time. The map must
+ * be unlisted by that thread before another one frees it.
+ */
+bool   hm_rehash_background(uint64_t budget_us);   /* returns true if work is left */
+bool   hm_rehash_pending();
+void   hm_rehash_unlist(HMap *hmap);
+size_t hm_rehash_maps();        /* the number of maps migrating */
+const RehashStats &hm_rehash_stats();
+/*
+ * How the calling thread frees the arrays of an older table once it's
+ * migrated, free() by default. A shard hands them to lazy_free_mem().
+ */
+void   hm_set_dispose(void (*f)(void *ptr, size_t size));
+/* the progress of the migration, in slots of the older table */
+inline size_t hm_slots(HMap *hmap) {
+    return hmap->newer.ctrl ? hmap->newer.mask + 1 : 0;
+}
+inline size_t hm_older_slots(HMap *hmap) {
+    return hmap->older.ctrl ? hmap->older.mask + 1 : 0;
+}
 
 #endif /* HASH_TABLE_H */
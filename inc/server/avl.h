@@ -19,21 +19,29 @@ struct AVLNode {
     AVLNode *right = NULL;
     uint32_t height = 0;    /* subtree height */
     uint32_t cnt = 0;       /* subtree size */
+    double val = 0;         /* set by the user, summed by `sum` */
+    double sum = 0;         /* subtree sum of `val` */
 };
 
 inline void avl_init(AVLNode *node) {
     node->left = node->right = node->parent = NULL;
     node->height = 1;
     node->cnt = 1;
+    node->sum = node->val;
 }
 
 /* helpers */
 inline uint32_t avl_height(AVLNode *node) { return node ? node->height : 0; }
 inline uint32_t avl_cnt(AVLNode *node) { return node ? node->cnt : 0; }
+inline double avl_sum(AVLNode *node) { return node ? node->sum : 0; }
 
 /* API */
 AVLNode *avl_fix(AVLNode *node);
 AVLNode *avl_del(AVLNode *node);
 AVLNode *avl_offset(AVLNode *node, int64_t offset);
+AVLNode *avl_next(AVLNode *node);
+AVLNode *avl_prev(AVLNode *node);
+uint32_t avl_rank(AVLNode *node);
+AVLNode *avl_build(AVLNode **nodes, size_t n);
 
 #endif /* AVL_H */
\ No newline at end of file
@@ -0,0 +1,92 @@
+/**
+ * @file ./inc/server/btree.h
+ * @brief an order-statistic B+tree over the (score, name) order of a zset
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-17
+ * @copyright Copyright (c) 2025
+ *
+ * @details The leaves hold up to K_BTREE_FAN members, their scores packed in
+ * an array so a node is searched with a few vector compares, and the names
+ * are only read on a score tie. The leaves are linked, a walk in order reads
+ * them one after another. An inner node keeps the least key and the size of
+ * each subtree, and the sum of its scores, so a rank or the sum of a range is
+ * found in O(log n) like with AVLNode::cnt and AVLNode::sum.
+ *
+ * The least keys point to the members, so a member is always deleted from
+ * the tree before it's freed, see bt_delete().
+ */
+
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <defs.h>
+
+struct ZNode;
+
+struct BNode {
+    uint32_t n = 0;         /* the keys of a leaf, or the children */
+    uint32_t leaf = 0;
+};
+
+struct BLeaf {
+    BNode hdr;
+    BLeaf *prev = NULL;
+    BLeaf *next = NULL;
+    double scores[K_BTREE_FAN];
+    ZNode *items[K_BTREE_FAN];
+};
+
+struct BInner {
+    BNode hdr;
+    double scores[K_BTREE_FAN];     /* the least key of each child */
+    ZNode *mins[K_BTREE_FAN];
+    uint32_t cnt[K_BTREE_FAN];                  /* the size of each subtree */
+    double sum[K_BTREE_FAN];                    /* the sum of the scores of each */
+    BNode *child[K_BTREE_FAN];
+};
+
+struct BTree {
+    BNode *root = NULL;
+    uint32_t height = 0;    /* the inner levels */
+    uint32_t size = 0;
+};
+
+/* a position in the tree, the end if `leaf` is NULL */
+struct BPos {
+    BLeaf *leaf = NULL;
+    uint32_t pos = 0;
+};
+
+inline ZNode *bpos_item(BPos p) {
+    return p.leaf ? p.leaf->items[p.pos] : NULL;
+}
+
+void     bt_insert(BTree *tree, ZNode *node);
+void     bt_delete(BTree *tree, ZNode *node);
+/* the first member >= (score, name) */
+BPos     bt_seekge(BTree *tree, double score, const char *name, size_t len);
+/* the 0-based rank of a member in the tree */
+uint32_t bt_rank(BTree *tree, ZNode *node);
+/* the member of a rank, the end if out of range */
+BPos     bt_select(BTree *tree, int64_t rank);
+/* move by `offset` members, the near ones through the leaf links */
+BPos     bt_offset(BTree *tree, BPos p, int64_t offset);
+/* the number of the members with a score < `score` */
+uint32_t bt_prefix(BTree *tree, double score);
+/* the sum of the scores in [min, max], either end open with `_ex` */
+double   bt_sum(BTree *tree, double min, bool min_ex, double max, bool max_ex);
+/* an empty tree of members sorted by (score, name), in O(n) */
+void     bt_build(BTree *tree, ZNode **items, size_t n);
+/* free the tree nodes, and pass each member to `del` */
+void     bt_clear(BTree *tree, void (*del)(ZNode *));
+/*
+ * free up to `budget` tree nodes, the leftmost ones first, but not the
+ * members. The tree is only good for more of it. Returns the bytes freed.
+ */
+size_t   bt_clear_some(BTree *tree, size_t budget);
+
+#endif /* !BTREE_H */
@@ -16,12 +16,98 @@
 
 #endif /* __linux */
 
+#include <atomic>
+#include <deque>
 #include <vector>
 
-typedef std::vector<uint8_t> Buffer;
+/* system */
+#include <sys/uio.h>
+
+/* a refcounted immutable string, shared by the keyspace and the replies in flight */
+struct RcStr {
+    std::atomic<uint32_t> refs;
+    uint32_t len;
+    char data[0];   /* flexible array */
+};
+
+RcStr *rcstr_new(const char *data, size_t len);
+inline RcStr *rcstr_ref(RcStr *str) {
+    str->refs.fetch_add(1, std::memory_order_relaxed);
+    return str;
+}
+void rcstr_unref(RcStr *str);
+
+/* a string referenced in the output, it's placed before the inline byte at `at` */
+struct BufRef {
+    uint64_t at;    /* a stream position, see Buffer::pos */
+    RcStr *str;
+};
+
+/*
+ * A byte buffer consumed from the front and appended at the back.
+ * Consuming only moves `head`, the data is moved to the front of the
+ * storage when the space in the back runs out, so both are amortized O(1).
+ * The inline data is always contiguous: buf_data() / buf_size().
+ *
+ * An output buffer may also reference large strings instead of copying
+ * them (buf_append_ref()). Its content is then the inline bytes with the
+ * referenced strings in between, buf_total() bytes that are written with
+ * writev() (buf_iov()).
+ */
+struct Buffer {
+    std::vector<uint8_t> mem;   /* the storage, its size is the capacity */
+    size_t head = 0;            /* the data is mem[head, tail) */
+    size_t tail = 0;
+    /* the referenced strings, in order */
+    uint64_t pos = 0;           /* the number of inline bytes consumed so far */
+    std::deque<BufRef> refs;
+    size_t ref_bytes = 0;       /* the unconsumed bytes of `refs` */
+    size_t ref_done = 0;        /* the consumed bytes of refs.front() */
+
+    Buffer() = default;
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(Buffer &&other) noexcept;
+    Buffer(const Buffer &) = delete;    /* the refs are owned */
+    Buffer &operator=(const Buffer &) = delete;
+    ~Buffer();
+};
+
+inline uint8_t *buf_data(Buffer &buf) {
+    return buf.mem.data() + buf.head;
+}
+
+inline const uint8_t *buf_data(const Buffer &buf) {
+    return buf.mem.data() + buf.head;
+}
+
+/* the inline bytes */
+inline size_t buf_size(const Buffer &buf) {
+    return buf.tail - buf.head;
+}
+
+/* the inline bytes and the referenced strings */
+inline size_t buf_total(const Buffer &buf) {
+    return buf.tail - buf.head + buf.ref_bytes;
+}
 
 void buf_append(Buffer &buf, const uint8_t *data, size_t len);
+/* consume `n` bytes of the content, inline or referenced */
 void buf_consume(Buffer &buf, size_t n);
+/* make room for at least `n` bytes at the back, the caller fills it and calls buf_commit() */
+uint8_t *buf_reserve(Buffer &buf, size_t n);
+void buf_commit(Buffer &buf, size_t n);
+/* free the storage of an empty buffer if it grew over K_BUF_KEEP, e.g. for a large request */
+void buf_release(Buffer &buf);
+/* keep the first `size` inline bytes and the strings referenced before them */
+void buf_truncate(Buffer &buf, size_t size);
+/* the bytes after the first `off` inline bytes */
+size_t buf_total_from(const Buffer &buf, size_t off);
+/* append a reference to `str` */
+void buf_append_ref(Buffer &buf, RcStr *str);
+/* move the whole content of `src` to the back of `dst` */
+void buf_move(Buffer &dst, Buffer &src);
+/* describe the content for writev(), returns the number of iovecs used */
+size_t buf_iov(const Buffer &buf, struct iovec *iov, size_t max);
 
 /* help functions for the serialization */
 void buf_append_u8(Buffer &buf, uint8_t data);
@@ -32,6 +118,8 @@ void buf_append_dbl(Buffer &buf, double data);
 /* append serialized data types to the back */
 void out_nil(Buffer &out);
 void out_str(Buffer &out, const char *s, size_t size);
+/* a large string is referenced, not copied */
+void out_rcstr(Buffer &out, RcStr *str);
 void out_int(Buffer &out, int64_t val);
 void out_dbl(Buffer &out, double val);
 void out_err(Buffer &out, uint32_t code, const std::string &msg);
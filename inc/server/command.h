@@ -0,0 +1,68 @@
+/**
+ * @file ./inc/server/command.h
+ * @brief the command registry: name -> descriptor
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-08
+ * @copyright Copyright (c) 2025
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+/* stdlib */
+#include <stdint.h>
+
+/* C++ */
+#include <string_view>
+#include <vector>
+
+/* proj */
+#include <buffer.h>
+#include <stream.h>
+
+typedef void (*CmdHandler)(std::vector<std::string_view> &cmd, Buffer &out);
+
+/* command flags */
+enum {
+    CMD_READ    = 1 << 0,   /* reads the keyspace */
+    CMD_WRITE   = 1 << 1,   /* modifies the keyspace */
+    CMD_ALL     = 1 << 2,   /* runs on every shard, the array replies are merged */
+    CMD_CURSOR  = 1 << 3,   /* runs on the shard picked by the cursor in cmd[1] */
+    CMD_ASYNC   = 1 << 4,   /* may finish on the thread pool, see shard_defer() */
+    CMD_NUMKEYS = 1 << 5,   /* cmd[last_key + 1] is the number of the keys after it */
+};
+
+struct CmdDesc {
+    const char *name;
+    CmdHandler handler;
+    StreamOpen open;    /* instead of `handler` for the large replies, see stream.h */
+    int32_t arity;      /* the number of args with the name, -N means at least N */
+    uint32_t flags;
+    /* the key positions: cmd[first_key], cmd[first_key + step] ... cmd[last_key] */
+    int32_t first_key;  /* 0 if there is no key */
+    int32_t last_key;   /* negative: counted from the end, -1 is the last arg */
+    int32_t key_step;
+};
+
+/*
+ * All the commands, the position of a descriptor in it (cmd_index()) is
+ * stable and can index per-command data such as statistics.
+ */
+extern const CmdDesc g_cmds[];
+extern const size_t g_ncmds;
+
+/* find the descriptor by name, NULL if unknown */
+const CmdDesc *cmd_lookup(std::string_view name);
+
+inline size_t cmd_index(const CmdDesc *desc) {
+    return (size_t)(desc - g_cmds);
+}
+
+/* whether the number of args matches the arity */
+inline bool cmd_arity_ok(const CmdDesc *desc, size_t nargs) {
+    return desc->arity >= 0 ? nargs == (size_t)desc->arity
+                            : nargs >= (size_t)-desc->arity;
+}
+
+#endif /* !COMMAND_H */
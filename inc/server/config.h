@@ -0,0 +1,46 @@
+/**
+ * @file ./inc/server/config.h
+ * @brief server options parsed from the command line
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-03
+ * @copyright Copyright (c) 2025
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <defs.h>
+#include <log.h>
+
+/* I/O backends of the event loop */
+typedef enum {
+    IO_EPOLL = 0,   /* readiness notification */
+    IO_URING = 1,   /* completion based, falls back to epoll if unavailable */
+} IoBackend;
+
+/* who takes the steps of freeing a large value, see lazyfree.h */
+typedef enum {
+    LAZY_LOOP = 0,  /* the event loop of the shard, between its iterations */
+    LAZY_POOL = 1,  /* the thread pool */
+} LazyFreeMode;
+
+struct Config {
+    int port = PORT;
+    IoBackend io = IO_EPOLL;
+    uint32_t shards = 1;    /* event loop threads */
+    size_t threads = K_POOL_THREADS;    /* the workers of the thread pool */
+    LogLevel log_level = LL_INFO;   /* can be changed at runtime by `loglevel` */
+    size_t max_msg = K_MAX_MSG;     /* the largest request or unstreamed reply */
+    ZSetIndex zset_index = Z_AVL;   /* of the zsets created from now on */
+    uint32_t zset_lp_entries = K_ZSET_LP_ENTRIES;   /* a zset is packed up to these, see ZSet */
+    size_t zset_lp_value = K_ZSET_LP_VALUE;
+    LazyFreeMode lazy_free = LAZY_LOOP;
+    size_t lazy_free_min = K_LAZY_FREE_MIN;     /* the least lazy_free_cost() freed lazily */
+};
+
+extern Config g_config;
+
+/* returns 0 on success, -1 on bad options (the usage is printed) */
+int32_t config_parse(int argc, char *argv[]);
+
+#endif /* !CONFIG_H */
@@ -20,30 +20,67 @@
 #ifndef CONN_H
 #define CONN_H
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <deque>
 #include <vector>
 #include <buffer.h>
 #include <list.h>
+#include <defs.h>
+#include <stream.h>
+
+/* a reply waiting for other shards, see shard.h */
+struct Reply {
+    uint64_t seq = 0;
+    uint32_t pending = 0;       /* parts not arrived yet */
+    bool barrier = false;       /* a CMD_ASYNC command, the requests behind it wait */
+    std::vector<Buffer> parts;  /* reply frames, merged when complete */
+};
 
 struct Conn {
     int fd = -1;
+    uint64_t id = 0;        /* unique within the shard */
     /* application's intention, for the event loop */
     bool want_read = false;
     bool want_write = false;
     bool want_close = false;
+    /* events currently registered in the epoll set */
+    uint32_t events = 0;
+    /* io_uring: operations in flight, the memory outlives them */
+    uint8_t inflight = 0;
+    struct msghdr send_msg = {};    /* a send with referenced values */
+    struct iovec send_iov[K_MAX_IOV];
 
     /* buffered input and output */
     Buffer incoming;  /* data to be parsed by the application */
     Buffer outgoing;  /* responses generated by the application */
+    /* the arguments of the current request, they point into `incoming` */
+    std::vector<std::string_view> args;
+
+    /* replies queued behind the ones from other shards, in the order of the requests */
+    std::deque<Reply> replies;
+    uint64_t next_seq = 0;
+    /* a large reply being streamed, the requests behind it wait */
+    Stream *stream = NULL;
 
     /* timer */
     uint64_t last_active_ms = 0;
     DList idle_node;
 };
 
+Conn *conn_new(int connfd);
 int32_t handle_accept(int fd);
 bool try_one_request(Conn *conn);
+void handle_write_done(Conn *conn, ssize_t rv);
+void handle_requests(Conn *conn);
+void handle_read_done(Conn *conn, ssize_t rv);
 void handle_write(Conn *conn);
 void handle_read(Conn *conn);
+void conn_update_events(Conn *conn);
 void conn_destroy(Conn *conn);
+/* release the memory of a destroyed connection */
+void conn_free(Conn *conn);
 
 #endif /* !CONN_H */
@@ -0,0 +1,23 @@
+/**
+ * @file ./inc/server/event_loop.h
+ * @brief the event loops of the I/O backends
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-03
+ * @copyright Copyright (c) 2025
+ *
+ * @details Both backends drive the same connection logic in conn.cpp:
+ * the epoll loop calls handle_read()/handle_write() on ready sockets,
+ * the io_uring loop feeds completed reads and writes into
+ * handle_read_done()/handle_write_done().
+ */
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/* serve the listening socket with epoll, until shards_stop() */
+void epoll_loop(int listen_fd);
+
+/* serve the listening socket with io_uring, until shards_stop(). false if io_uring is unavailable */
+bool uring_loop(int listen_fd);
+
+#endif /* !EVENT_LOOP_H */
@@ -17,18 +17,28 @@
 #include <heap.h>
 #include <thread_pool.h>
 
+/* the state of a shard, each event loop thread owns one */
 typedef struct {
+    /* the keyspace shard */
     HMap db;
+    /* the id of this shard */
+    uint32_t shard = 0;
+    /* eventfd signaled on cross-shard messages */
+    int wake_fd = -1;
+    /* the epoll instance of the event loop */
+    int epfd = -1;
     /* a map of all client connections, keyed by fd */
     std::vector<Conn *> fd2conn;
+    uint64_t next_conn_id = 0;
     /* timers for idle connections */
     DList idle_list;
     /* timers for TTLs */
     std::vector<HeapItem> heap;
-    /* the thread pool */
-    TheadPool thread_pool;
 } GLOBAL_DATA;
 
-extern GLOBAL_DATA g_data;
+extern thread_local GLOBAL_DATA g_data;
 
-#endif /* GLOBAL_H */
\ No newline at end of file
+/* the thread pool, shared by the shards */
+extern TheadPool g_thread_pool;
+
+#endif /* GLOBAL_H */
@@ -11,38 +11,90 @@
 #define KEY_VALUE_H
 
 #include <string>
+#include <string_view>
 
 #include <HashTable.h>
 #include <buffer.h>
+#include <stream.h>
 #include <zset.h>
 #include <defs.h>
 
-/* KV pair for the top-level hashtable */
+/* the flags of an entry */
+enum : uint8_t {
+    E_TTL = 1 << 0,     /* it has room for a heap index, see entry_heap_idx() */
+};
+
+/* the encodings of a T_STR value, picked by do_set() */
+enum : uint8_t {
+    ENC_RAW   = 0,      /* `str`, a large value */
+    ENC_INT   = 1,      /* `ival`, the value is the decimal form of it */
+    ENC_EMBED = 2,      /* in the room after the key, see entry_embed() */
+};
+
+/*
+ * KV pair for the top-level hashtable, allocated in one block with its key:
+ * [Entry][heap_idx, only with E_TTL][key][room]. A key gets the room for the
+ * heap index with its first TTL, and it's moved to a larger block for it, so
+ * does a longer embedded value. The block comes from the slabs, its size is
+ * known from the fields.
+ */
 struct Entry {
     struct HNode node;  /* hashtable node */
-    std::string key;    /* key */
-    /* for TTL */
-    size_t heap_idx = -1;   /* array index to the heap item */
-    /* value */
-    ValueType type = T_INIT;
-    /* one of the following */
-    std::string str;
-    ZSet zset;
+    union {             /* by `type` and `enc` */
+        RcStr *str;     /* shared with the replies being sent */
+        int64_t ival;
+        ZSet *zset;
+    };
+    uint32_t klen;
+    uint8_t type;       /* ValueType */
+    uint8_t flags;
+    uint8_t enc;
+    uint8_t room;       /* the bytes after the key for an embedded value: [len:1][value] */
+    alignas(size_t) char data[0];
 };
 
+/* the array index to the heap item, -1 if no TTL, or NULL if it never had one */
+inline size_t *entry_heap_idx(Entry *ent) {
+    return (ent->flags & E_TTL) ? (size_t *)ent->data : NULL;
+}
+
+inline std::string_view entry_key(const Entry *ent) {
+    size_t skip = (ent->flags & E_TTL) ? sizeof(size_t) : 0;
+    return std::string_view(ent->data + skip, ent->klen);
+}
+
+/* an ENC_EMBED value */
+inline std::string_view entry_embed(const Entry *ent) {
+    const char *room = entry_key(ent).data() + ent->klen;
+    return std::string_view(room + 1, (uint8_t)room[0]);
+}
+
 bool entry_eq(HNode *node, HNode *key);
-void do_get(std::vector<std::string> &cmd, Buffer &out);
-void do_set(std::vector<std::string> &cmd, Buffer &out);
-void do_del(std::vector<std::string> &cmd, Buffer &out);
-void do_keys(std::vector<std::string> &cmd, Buffer &out);
-ZSet *expect_zset(std::string &s);
-void do_zadd(std::vector<std::string> &cmd, Buffer &out);
-void do_zrem(std::vector<std::string> &cmd, Buffer &out);
-void do_zscore(std::vector<std::string> &cmd, Buffer &out);
-void do_zquery(std::vector<std::string> &cmd, Buffer &out);
-void do_expire(std::vector<std::string> &cmd, Buffer &out);
-void do_ttl(std::vector<std::string> &cmd, Buffer &out);
+void do_get(std::vector<std::string_view> &cmd, Buffer &out);
+void do_set(std::vector<std::string_view> &cmd, Buffer &out);
+void do_del(std::vector<std::string_view> &cmd, Buffer &out);
+void do_incrby(std::vector<std::string_view> &cmd, Buffer &out);
+void do_decrby(std::vector<std::string_view> &cmd, Buffer &out);
+Stream *open_keys(std::vector<std::string_view> &cmd, Buffer &out);
+void do_scan(std::vector<std::string_view> &cmd, Buffer &out);
+ZSet *expect_zset(std::string_view s);
+void do_zadd(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zrem(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zscore(std::vector<std::string_view> &cmd, Buffer &out);
+Stream *open_zquery(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zscan(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zrank(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zrevrank(std::vector<std::string_view> &cmd, Buffer &out);
+Stream *open_zrangebyscore(std::vector<std::string_view> &cmd, Buffer &out);
+Stream *open_zrevrange(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zcount(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zsum(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zquantile(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zunionstore(std::vector<std::string_view> &cmd, Buffer &out);
+void do_zinterstore(std::vector<std::string_view> &cmd, Buffer &out);
+void do_expire(std::vector<std::string_view> &cmd, Buffer &out);
+void do_ttl(std::vector<std::string_view> &cmd, Buffer &out);
 void entry_del(Entry *ent);
-void entry_set_ttl(Entry *ent, int64_t ttl_ms);
+Entry *entry_set_ttl(Entry *ent, int64_t ttl_ms);
 
 #endif /* !KEY_VALUE_H */
@@ -0,0 +1,60 @@
+/**
+ * @file ./inc/server/lazyfree.h
+ * @brief the large values are freed in bounded steps, off the request path
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-23
+ * @copyright Copyright (c) 2025
+ *
+ * @details A value to free is costed by its bytes and its nodes, a node being
+ * a cache miss and a call into the allocator: lazy_free_cost(). One under
+ * g_config.lazy_free_min is freed at once. Otherwise it's queued by its shard
+ * and freed K_LAZY_FREE_STEP nodes at a time. With LAZY_LOOP the event loop
+ * takes the steps between its iterations, within a time budget, the way it
+ * moves the rehashing on (process_background()), and the slab objects are
+ * freed by the thread that owns them. With LAZY_POOL each step is a job of
+ * the thread pool that queues the next one, so a worker is never held long.
+ *
+ * The functions are called by the shards only.
+ */
+
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+/* stdlib */
+#include <stddef.h>
+#include <stdint.h>
+
+/* C++ */
+#include <atomic>
+
+/* proj */
+#include <buffer.h>
+#include <zset.h>
+
+struct LazyStats {
+    std::atomic<uint64_t> queued{0};    /* the values not freed yet */
+    std::atomic<uint64_t> items{0};     /* the values freed lazily so far */
+    std::atomic<uint64_t> bytes{0};     /* and their bytes */
+};
+
+inline size_t lazy_free_cost(size_t bytes, size_t nodes) {
+    return bytes + nodes * K_LAZY_FREE_NODE;
+}
+
+/* delete a zset from `new` */
+void lazy_free_zset(ZSet *zset);
+/* drop a reference to a string */
+void lazy_free_str(RcStr *str);
+/* free() a block of `size` bytes */
+void lazy_free_mem(void *ptr, size_t size);
+
+/* take LAZY_LOOP steps for about `budget_us`, returns true if work is left */
+bool lazy_free_background(uint64_t budget_us);
+bool lazy_free_pending();
+/* of the current shard */
+const LazyStats &lazy_free_stats();
+/* the bytes freed per second, over the last second or so */
+uint64_t lazy_free_rate();
+
+#endif /* !LAZYFREE_H */
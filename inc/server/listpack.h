@@ -0,0 +1,64 @@
+/**
+ * @file ./inc/server/listpack.h
+ * @brief the compact form of a small zset: its members packed in one block
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-18
+ * @copyright Copyright (c) 2025
+ *
+ * @details The members are sorted by (score, name), each one is
+ * [score:8][len:1][name][len:1]: the leading length steps forward, the
+ * trailing one backward. A position is the byte offset of a member, and
+ * `used` is the end. The lookups are linear scans, so it's only for a few
+ * members with short names, see ZSet::lp.
+ */
+
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define K_LP_OVERHEAD ((uint32_t) 10)   /* the bytes of a member besides the name */
+
+struct ZListpack {
+    uint32_t n = 0;         /* members */
+    uint32_t used = 0;      /* bytes of `data` */
+    uint32_t cap = 0;
+    char data[0];
+};
+
+inline double lp_score(const ZListpack *lp, uint32_t pos) {
+    double score;
+    memcpy(&score, lp->data + pos, sizeof(score));
+    return score;
+}
+
+inline size_t lp_len(const ZListpack *lp, uint32_t pos) {
+    return (uint8_t)lp->data[pos + 8];
+}
+
+inline const char *lp_name(const ZListpack *lp, uint32_t pos) {
+    return lp->data + pos + 9;
+}
+
+inline uint32_t lp_next(const ZListpack *lp, uint32_t pos) {
+    return pos + K_LP_OVERHEAD + (uint32_t)lp_len(lp, pos);
+}
+
+/* `pos` is not the first one */
+inline uint32_t lp_prev(const ZListpack *lp, uint32_t pos) {
+    return pos - K_LP_OVERHEAD - (uint8_t)lp->data[pos - 1];
+}
+
+/* the position of a name, `used` if not found */
+uint32_t   lp_find(const ZListpack *lp, const char *name, size_t len);
+/* the first member >= (score, name), `used` if none */
+uint32_t   lp_seekge(const ZListpack *lp, double score, const char *name, size_t len);
+/* add a member that's not in it yet, `lp` may be NULL or moved, len <= 255 */
+ZListpack *lp_insert(ZListpack *lp, double score, const char *name, size_t len);
+void       lp_delete(ZListpack *lp, uint32_t pos);
+void       lp_free(ZListpack *lp);
+
+#endif /* !LISTPACK_H */
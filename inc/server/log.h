@@ -0,0 +1,63 @@
+/**
+ * @file ./inc/server/log.h
+ * @brief leveled logging through a lock-free ring and a background writer
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-09
+ * @copyright Copyright (c) 2025
+ *
+ * @details The event loops never block on the terminal: a log call formats
+ * the line into a slot of a bounded MPMC ring and the writer thread drains it
+ * to stderr in batches. When the ring is full the line is dropped and counted.
+ * A call below the current level costs one relaxed load, its arguments are
+ * not evaluated.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+/* stdlib */
+#include <stdint.h>
+
+/* C++ */
+#include <atomic>
+
+typedef enum {
+    LL_DEBUG = 0,
+    LL_INFO  = 1,
+    LL_WARN  = 2,
+    LL_ERROR = 3,
+} LogLevel;
+
+extern std::atomic<int> g_log_level;
+
+inline bool log_enabled(LogLevel level) {
+    return (int)level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+#define LOG_AT(level, ...) \
+    do { \
+        if (log_enabled(level)) { \
+            log_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(...)  LOG_AT(LL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)   LOG_AT(LL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)   LOG_AT(LL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...)  LOG_AT(LL_ERROR, __VA_ARGS__)
+
+/* start the writer thread, the lines are written synchronously before it */
+void log_init(LogLevel level);
+/* queue a line, use the LOG_* macros instead */
+void log_write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+/* wait until the queued lines are written */
+void log_flush();
+
+/* "debug", "info", "warn", "error"; returns -1 for an unknown name */
+int32_t log_level_parse(const char *name, size_t len);
+const char *log_level_name(LogLevel level);
+/* the number of lines dropped because the ring was full */
+uint64_t log_dropped();
+
+#endif /* !LOG_H */
@@ -13,21 +13,24 @@
 #include <stdint.h>
 
 #include <vector>
+#include <string_view>
 
 #include <buffer.h>
+#include <stream.h>
 
 /**
- * @brief Parse the request data into a list of strings.
+ * @brief Parse the request data into a list of string views.
  *
  * This function takes a byte array representing the request data, parses it according to the specified format,
  * and extracts a list of strings. It performs strict checks to ensure data integrity and safety limits.
+ * Nothing is copied: the views point into `data`, which must outlive them.
  *
  * @param data Pointer to the request data byte array.
  * @param size Size of the request data in bytes.
- * @param out Reference to a vector where the parsed strings will be stored.
+ * @param out Reference to a vector where the parsed views will be stored, it's cleared first so it can be reused.
  * @return int32_t Returns 0 on success, -1 on failure (e.g., invalid format, safety limit exceeded, or trailing garbage).
  */
-int32_t parse_req(const uint8_t *data, size_t size, std::vector<std::string> &out);
+int32_t parse_req(const uint8_t *data, size_t size, std::vector<std::string_view> &out);
 
 /**
  * @brief Execute the command specified in the request and generate a response.
@@ -38,7 +41,16 @@ int32_t parse_req(const uint8_t *data, size_t size, std::vector<std::string> &ou
  * @param cmd Reference to a vector containing the parsed command strings.
  * @param out Reference to a Response object where the result of the command execution will be stored.
  */
-void do_request(std::vector<std::string> &cmd, Buffer &out);
+void do_request(std::vector<std::string_view> &cmd, Buffer &out);
+
+/*
+ * Write a whole frame for the request, unless the reply is a large stream:
+ * then the start of a streamed frame is written and the stream is returned,
+ * see stream.h.
+ */
+Stream *do_request_stream(std::vector<std::string_view> &cmd, Buffer &out);
+/* append the next chunk of a streamed frame, returns false when it's ended */
+bool response_stream_next(Stream *st, Buffer &out);
 
 void response_begin(Buffer &out, size_t *header);
 size_t response_size(Buffer &out, size_t header);
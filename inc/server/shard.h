@@ -0,0 +1,115 @@
+/**
+ * @file ./inc/server/shard.h
+ * @brief the shared-nothing multi-core mode: one event loop and keyspace shard per thread
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-05
+ * @copyright Copyright (c) 2025
+ *
+ * @details Every shard accepts connections on its own SO_REUSEPORT socket and
+ * owns the keys hashing to it. A request for a key of another shard is
+ * forwarded to the owner through its inbox. Its reply takes a slot in
+ * Conn::replies, and so does every reply behind it, so a pipeline is
+ * dispatched at once while the replies are still written in order.
+ *
+ * A CMD_ASYNC command may hand its work to the thread pool, see shard_defer().
+ * Its reply takes a slot the same way, and it's posted back to the inbox of
+ * the shard that executed it, which writes the reply there. A command may
+ * also wait for a deferred one without blocking the loop, see shard_park().
+ */
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include <buffer.h>
+#include <conn.h>
+#include <command.h>
+
+/*
+ * the work of a deferred command: `run` is called on the thread pool, then
+ * `finish` on the shard that executed the command, it writes the reply
+ */
+struct ShardJob {
+    void (*run)(void *arg) = NULL;
+    void (*finish)(void *arg, Buffer &out) = NULL;
+    void *arg = NULL;
+};
+
+/* a forwarded request, sent back to the origin with the reply */
+struct ShardMsg {
+    uint32_t from = 0;      /* the origin shard */
+    int fd = -1;            /* the origin connection */
+    uint64_t conn_id = 0;
+    uint64_t seq = 0;       /* the slot in Conn::replies */
+    uint32_t part = 0;      /* the part of a fan-out */
+    bool done = false;      /* `data` holds the reply frame */
+    Buffer data;            /* the request body, then the reply frame */
+    uint32_t at = 0;        /* the shard that deferred `job` */
+    ShardJob job;           /* a deferred command, until it's finished */
+};
+
+struct Shard {
+    int wake_fd = -1;       /* eventfd, signaled when the inbox becomes non-empty */
+    pthread_mutex_t mu;
+    std::vector<ShardMsg *> inbox;
+};
+
+/* create the shards, must be called before any shard runs */
+void shards_init(uint32_t n);
+/* start the shards 1..n-1 on their own threads */
+void shards_start();
+/* serve the shard `id` on the calling thread, until shards_stop() */
+void shard_serve(uint32_t id);
+/* make every shard leave its loop, safe in a signal handler */
+void shards_stop();
+/* whether shards_stop() was called */
+bool shards_stopping();
+/* wait for the shards started by shards_start() to stop */
+void shards_join();
+
+/*
+ * the number of shards. A scan cursor carries its shard: cursor * nshards +
+ * shard, see do_scan()
+ */
+uint32_t shards_count();
+/* whether the command is executed by the current shard, without a reply slot */
+bool shard_is_local(const std::vector<std::string_view> &cmd);
+/*
+ * whether the keys of a command are all owned by one shard, see CmdDesc.
+ * The args must match the arity.
+ */
+bool shard_keys_together(const CmdDesc *desc, const std::vector<std::string_view> &cmd);
+/*
+ * called by a CMD_ASYNC command instead of writing its reply: `run` goes to
+ * the thread pool once the command returns. The requests of the connection
+ * behind it wait until `finish` has written the reply.
+ */
+void shard_defer(void (*run)(void *), void (*finish)(void *, Buffer &), void *arg);
+/*
+ * called by a command that can't run yet instead of writing its reply: the
+ * request is executed again once a deferred command has finished. The
+ * requests of its connection behind it wait.
+ */
+void shard_park();
+/*
+ * +1 when a deferred command holds a key of this shard, -1 when it lets it go.
+ * While any key is held, the writes take a reply slot, so they can be parked.
+ */
+void shard_hold(int delta);
+/* take a reply slot for the command, and forward it if it's owned by other shards */
+void shard_queue(Conn *conn, std::vector<std::string_view> &cmd,
+                 const uint8_t *req, size_t len);
+/* move the completed replies in front into Conn::outgoing */
+void shard_flush(Conn *conn);
+/*
+ * handle the messages in the inbox. The connections with a completed reply in
+ * front are returned, the caller flushes them with handle_requests().
+ */
+void shard_process_inbox(std::vector<Conn *> &resumed);
+
+#endif /* !SHARD_H */
@@ -0,0 +1,61 @@
+/**
+ * @file ./inc/server/slab.h
+ * @brief size-class slab allocators for the small objects: Entry, ZNode, Conn
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-16
+ * @copyright Copyright (c) 2025
+ *
+ * @details Each thread has its own slabs, one per size class, made of pages
+ * of K_SLAB_PAGE bytes aligned to their size, so the page of an object is
+ * found by masking its address. A page has a free list of its objects and
+ * goes back to malloc() once it's empty, unless it's the last one of its
+ * class. An object freed by another thread (the thread pool freeing a large
+ * zset) is pushed to a lock-free list of the owner, which takes it back on
+ * its next allocation or in slab_reclaim(). The sizes above the largest
+ * class are passed to malloc(), so the size is given to slab_free() too.
+ *
+ * A thread of the pool that builds a value for a shard allocates from an
+ * arena instead, see slab_arena_use(): the shard takes its pages over with
+ * slab_adopt(), so the objects are owned by the thread that frees them.
+ * The pool threads own no pages then, and they exit cleanly, see
+ * slab_thread_exit().
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the occupancy of a size class of the calling thread */
+struct SlabStats {
+    uint32_t size = 0;      /* object size */
+    uint64_t pages = 0;
+    uint64_t used = 0;      /* objects handed out */
+    uint64_t cap = 0;       /* objects that fit in the pages */
+};
+
+void *slab_alloc(size_t size);
+/* `size` is the one it was allocated with, from any thread */
+void  slab_free(void *ptr, size_t size);
+/* take back the objects freed by other threads */
+void  slab_reclaim();
+/* the classes of the calling thread that have pages, returns the number of them */
+size_t slab_stats(SlabStats *out, size_t max);
+
+/* the classes of a thread, not tied to one */
+struct SlabArena;
+
+SlabArena *slab_arena_new();
+/* slab_alloc() of the calling thread takes from `arena` until it's set back to NULL */
+void  slab_arena_use(SlabArena *arena);
+/* the pages of `arena` become the calling thread's, the arena is deleted */
+void  slab_adopt(SlabArena *arena);
+/*
+ * for a thread that ends: its empty classes are freed. The ones with objects
+ * still out are left behind, their pages aren't given back.
+ */
+void  slab_thread_exit();
+
+#endif /* !SLAB_H */
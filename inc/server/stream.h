@@ -0,0 +1,49 @@
+/**
+ * @file ./inc/server/stream.h
+ * @brief replies generated in parts and streamed as the output drains
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-11
+ * @copyright Copyright (c) 2025
+ *
+ * @details A command that may produce a large array (`keys`, `zquery`) opens a
+ * Stream instead of writing the whole reply. If the first K_STREAM_CHUNK bytes
+ * complete it, the reply is an ordinary frame. Otherwise it's sent as a
+ * streamed frame and the connection asks for the next part only when its
+ * output has drained, so a reply never sits in memory as a whole:
+ *
+ *   [K_STREAM_LEN][n:4][TAG_ARR][K_STREAM_LEN][elements...] [n:4][elements...]
+ *   ... [n:4][elements... TAG_END] [0:4]
+ *
+ * The replies built for other shards are not streamed, see stream_drain().
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+/* stdlib */
+#include <stdint.h>
+
+/* C++ */
+#include <string_view>
+#include <vector>
+
+/* proj */
+#include <buffer.h>
+
+struct Stream {
+    /* append the next elements, about `budget` bytes; returns false when done */
+    bool (*next)(Stream *st, Buffer &out, size_t budget, uint32_t *n);
+    void (*del)(Stream *st);
+};
+
+/*
+ * start a command that may stream its reply. It returns NULL if it wrote a
+ * complete reply by itself, such as an error.
+ */
+typedef Stream *(*StreamOpen)(std::vector<std::string_view> &cmd, Buffer &out);
+
+/* run the stream to the end as one array, the stream is deleted */
+void stream_drain(Stream *st, Buffer &out);
+
+#endif /* !STREAM_H */
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <atomic>
 #include <vector>
-#include <deque>
+
+#include <defs.h>
 
 
 struct Work {
@@ -11,12 +14,68 @@ struct Work {
     void *arg = NULL;
 };
 
+// works to wait for together, or to be told about when they are all done
+struct WorkGroup {
+    std::atomic<size_t> left{0};
+    void (*done)(void *) = NULL;
+    void *done_arg = NULL;
+    bool finished = false;      // under mu
+    pthread_mutex_t mu;
+    pthread_cond_t all_done;
+};
+
+struct PoolTask {
+    Work work;
+    WorkGroup *group = NULL;
+};
+
+struct PoolArray;
+struct TheadPool;
+
+// a worker: its Chase-Lev deque, and an inbox for the other threads
+struct PoolWorker {
+    TheadPool *tp = NULL;
+    size_t id = 0;
+    pthread_t tid;
+    // the deque: pushed and taken at the bottom by the worker, stolen at the top
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<PoolArray *> array{NULL};
+    std::vector<PoolArray *> retired;   // outgrown, a thief may still read them
+    uint64_t ticks = 0;
+    std::vector<PoolTask> drained;      // swapped with an inbox, to keep the capacity
+    // the works queued by the threads out of the pool
+    alignas(64) pthread_mutex_t inbox_mu;
+    std::vector<PoolTask> inbox;
+    std::atomic<size_t> inbox_size{0};
+};
+
 struct TheadPool {
-    std::vector<pthread_t> threads;
-    std::deque<Work> queue;
+    std::vector<PoolWorker *> workers;
+    std::atomic<bool> stopping{false};
+    // the idle workers sleep on `wake` until `epoch` moves
+    alignas(64) std::atomic<uint64_t> epoch{0};
+    std::atomic<uint32_t> sleepers{0};
     pthread_mutex_t mu;
-    pthread_cond_t not_empty;
+    pthread_cond_t wake;
 };
 
 void thread_pool_init(TheadPool *tp, size_t num_threads);
 void thread_pool_queue(TheadPool *tp, void (*f)(void *), void *arg);
+// queue n works at once: a worker pushes them to its own deque, another
+// thread to the inbox of one worker under one lock. With a group, the group
+// is for these works only, see work_group_init().
+void thread_pool_submit(TheadPool *tp, const Work *works, size_t n, WorkGroup *group);
+// run f(arg, i) for every i in [0, n) on the pool and on the calling thread,
+// it returns when all are done. The caller takes items too, so it may be a
+// worker itself, and a busy pool only makes it slower.
+void thread_pool_for(TheadPool *tp, size_t n, void (*f)(void *, size_t), void *arg);
+// run the works queued so far, then join the workers. Nothing is queued after it.
+void thread_pool_stop(TheadPool *tp);
+
+// Without `done` the group is waited for by work_group_wait(). With it,
+// done(arg) is called instead by the thread that finishes the last work, and
+// it may free the group.
+void work_group_init(WorkGroup *group, void (*done)(void *) = NULL, void *arg = NULL);
+// a worker runs other works meanwhile, so the pool can't deadlock on it
+void work_group_wait(TheadPool *tp, WorkGroup *group);
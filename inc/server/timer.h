@@ -14,5 +14,7 @@
 uint64_t get_monotonic_msec();
 uint32_t next_timer_ms();
 void process_timers();
+/* the background work, longer if the last wait had no events */
+void process_background(bool idle);
 
 #endif /* !TIMER_H */
\ No newline at end of file
@@ -11,11 +11,24 @@
 #define ZSET_H
 
 #include <avl.h>
+#include <btree.h>
 #include <HashTable.h>
+#include <listpack.h>
+#include <defs.h>
 
+/*
+ * A zset starts packed in `lp`, and it's converted to the indexes once it
+ * has more members, or a longer name, than g_config allows, for good.
+ */
 struct ZSet {
-    AVLNode *root = NULL;   /* index by (score, name) */
+    ZListpack *lp = NULL;   /* the packed form, NULL if empty */
+    bool packed = true;
+    AVLNode *root = NULL;   /* index by (score, name), Z_AVL */
+    BTree btree;            /* index by (score, name), Z_BTREE */
     HMap hmap;              /* index by name */
+    uint8_t index = Z_AVL;  /* ZSetIndex, chosen when it's created */
+    bool dropped = false;   /* out of the db while held, the last job frees it */
+    uint32_t holds = 0;     /* the jobs reading it off the shard, it's not changed meanwhile */
 };
 
 struct ZNode {
@@ -27,10 +40,61 @@ struct ZNode {
 };
 
 bool   zset_insert(ZSet *zset, const char *name, size_t len, double score);
+
+struct ZPair {
+    double score;
+    const char *name;
+    size_t len;
+};
+
+/* returns the number of new members */
+size_t zset_add(ZSet *zset, const ZPair *pairs, size_t n);
+/* fill an empty zset from pairs sorted by (score, name), of distinct names, in O(n) */
+void   zset_build(ZSet *zset, const ZPair *pairs, size_t n);
+/* returns false if it's not a member */
+bool   zset_score(ZSet *zset, const char *name, size_t len, double *score);
+bool   zset_remove(ZSet *zset, const char *name, size_t len);
+size_t zset_size(ZSet *zset);
+int64_t zset_rank(ZSet *zset, const char *name, size_t len);
+/* the number of the members with a score < `score`, or <= with `incl` */
+int64_t zset_prefix(ZSet *zset, double score, bool incl);
+/*
+ * the sum of the scores in [min, max], either end open with `_ex`. Only the
+ * members in the range are added, in O(log n) from the subtree sums.
+ */
+double zset_sum(ZSet *zset, double min, bool min_ex, double max, bool max_ex);
+void   zset_clear(ZSet *zset);
+/*
+ * delete a zset from `new` in steps of about `budget` nodes, `*pos` is 0 at
+ * first. It returns false when it's done, the bytes freed are added to `*bytes`.
+ */
+bool   zset_dispose_some(ZSet *zset, size_t *pos, size_t budget, size_t *bytes);
+/* the bytes of the zset besides its nodes, and the number of the nodes */
+void   zset_cost(ZSet *zset, size_t *bytes, size_t *nodes);
+
+/* the nodes of the unpacked form */
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len);
 void   zset_delete(ZSet *zset, ZNode *node);
-ZNode *zset_seekge(ZSet *zset, double score, const char *name, size_t len);
-void   zset_clear(ZSet *zset);
-ZNode *znode_offset(ZNode *node, int64_t offset);
+
+/* a position in the (score, name) order of either form */
+struct ZIter {
+    bool valid = false;     /* false at the end */
+    double score = 0;       /* the member, until the zset is changed */
+    const char *name = NULL;
+    size_t len = 0;
+    ZNode *node = NULL;     /* Z_AVL */
+    BPos bpos;              /* Z_BTREE */
+    uint32_t pos = 0;       /* packed */
+};
+
+ZIter  zset_begin(ZSet *zset);
+ZIter  zset_select(ZSet *zset, int64_t rank);
+ZIter  zset_seekge(ZSet *zset, double score, const char *name, size_t len);
+ZIter  zset_seekle(ZSet *zset, double score, const char *name, size_t len);
+/* a step in order, O(1) amortized over a walk */
+ZIter  zset_next(ZSet *zset, ZIter it);
+ZIter  zset_prev(ZSet *zset, ZIter it);
+/* offset into the succeeding or preceding node */
+ZIter  zset_offset(ZSet *zset, ZIter it, int64_t offset);
 
 #endif /* ZSET_H */
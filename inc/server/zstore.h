@@ -0,0 +1,69 @@
+/**
+ * @file ./inc/server/zstore.h
+ * @brief zunionstore and zinterstore: many zsets aggregated into a new one
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-22
+ * @copyright Copyright (c) 2025
+ *
+ * @details The inputs are copied out by zstore_add(), weighted, into
+ * K_ZSTORE_PARTS partitions by the hash of the name, so a name lands in the
+ * same partition from every input. zstore_run() aggregates the partitions in
+ * parallel, each one in a hash table of its own, sorts them in parallel,
+ * merges the sorted runs by pairs and bulk-builds the result. For the large
+ * ones, all of it runs on the thread pool while the loop goes on: the shard
+ * keeps the inputs as they are until it's finished, and nothing else of the
+ * shard is touched.
+ */
+
+#ifndef ZSTORE_H
+#define ZSTORE_H
+
+/* stdlib */
+#include <stdint.h>
+
+/* C++ */
+#include <string>
+#include <vector>
+
+/* proj */
+#include <thread_pool.h>
+#include <zset.h>
+#include <defs.h>
+
+enum ZAggregate : uint8_t {
+    Z_AGG_SUM = 0,
+    Z_AGG_MIN = 1,
+    Z_AGG_MAX = 2,
+};
+
+/* a weighted member of an input, its name is at `off` in ZStorePart::names */
+struct ZStoreItem {
+    uint64_t hcode;
+    double score;
+    uint32_t off;
+    uint32_t len;
+};
+
+struct ZStorePart {
+    std::vector<ZStoreItem> items;  /* the members of all the inputs */
+    std::string names;
+    std::vector<ZPair> out;         /* aggregated and sorted, into the `names` of any part */
+};
+
+struct ZStore {
+    bool inter = false;     /* zinterstore: only the names in every input */
+    uint8_t agg = Z_AGG_SUM;
+    bool empty = false;     /* zinterstore with an empty input */
+    uint32_t ninputs = 0;
+    size_t nitems = 0;
+    ZStorePart parts[K_ZSTORE_PARTS];
+    ZSet *dst = NULL;       /* the result of zstore_run(), owned by the caller */
+};
+
+/* copy the members of an input, the zset can change after it */
+void zstore_add(ZStore *zs, ZSet *zset, double weight);
+/* build `dst`, on the threads of `tp` too unless it's NULL */
+void zstore_run(ZStore *zs, TheadPool *tp);
+
+#endif /* !ZSTORE_H */
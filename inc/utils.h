@@ -17,6 +17,7 @@
 
     /* C++ */
     #include <string>
+    #include <string_view>
 
     #endif /* __linux__ */
 
@@ -24,8 +25,12 @@
 
     void fd_set_nb(int fd);
     bool read_u32(const uint8_t *&cur, const uint8_t *end, uint32_t &out);
-    bool read_str(const uint8_t *&cur, const uint8_t *end, size_t n, std::string &out);
-    bool str2dbl(const std::string &s, double &out);
-    bool str2int(const std::string &s, int64_t &out);
+    bool read_str(const uint8_t *&cur, const uint8_t *end, size_t n, std::string_view &out);
+    bool str2dbl(std::string_view s, double &out);
+    bool str2int(std::string_view s, int64_t &out);
+    /* the decimal form, up to 20 bytes, returns the length */
+    size_t int2str(int64_t val, char *buf);
+    /* glob-style: `*`, `?`, `[a-z]`, `[^a]`, a backslash escapes */
+    bool glob_match(std::string_view pat, std::string_view str);
 
 #endif /* !UTILS_H */
@@ -56,17 +56,18 @@ int32_t write_all(int fd, const char *buf, size_t n) {
 }
 
 int32_t send_req(int fd, const std::vector<std::string> &cmd) {
-    uint32_t len = 4;
+    size_t len = 4;
     for (const std::string &s : cmd) {
         len += 4 + s.size();
     }
-    if (len > K_MAX_MSG) {
+    if (len > K_MAX_MSG_LIMIT) {
         return -1;
     }
 
-    char wbuf[4 + K_MAX_MSG];
-    memcpy(&wbuf[0], &len, 4); /* assume little endian */
-    uint32_t n = (uint32_t) cmd.size();
+    std::vector<char> wbuf(4 + len);
+    uint32_t n = (uint32_t)len;
+    memcpy(&wbuf[0], &n, 4); /* assume little endian */
+    n = (uint32_t) cmd.size();
     memcpy(&wbuf[4], &n, 4);
     size_t cur = 8;
     for (const std::string &s : cmd) {
@@ -75,14 +76,36 @@ int32_t send_req(int fd, const std::vector<std::string> &cmd) {
         memcpy(&wbuf[cur + 4], s.data(), s.size());
         cur += 4 + s.size();
     }
-    return write_all(fd, wbuf, 4 + len);
+    return write_all(fd, wbuf.data(), wbuf.size());
+}
+
+/* append the chunks of a streamed frame to `body`, up to the empty one */
+static int32_t read_chunks(int fd, std::vector<char> &body) {
+    while (true) {
+        uint32_t len = 0;
+        if (read_full(fd, (char *)&len, 4)) {
+            return -1;
+        }
+        if (len == 0) {
+            return 0;   /* the end of the frame */
+        }
+        if (body.size() + len > K_MAX_MSG_LIMIT) {
+            msgf("too long, fd=%d\n", fd);
+            return -1;
+        }
+        size_t cur = body.size();
+        body.resize(cur + len);
+        if (read_full(fd, &body[cur], len)) {
+            return -1;
+        }
+    }
 }
 
 int32_t read_res(int fd) {
     /* 4 bytes header */
-    char rbuf[4 + K_MAX_MSG + 1];
+    uint32_t len = 0;
     errno = 0;
-    int32_t err = read_full(fd, rbuf, 4);
+    int32_t err = read_full(fd, (char *)&len, 4);   /* assume little endian */
     if (err) {
         if (errno == 0) {
             msgf("EOF, fd=%d\n", fd);
@@ -92,37 +115,73 @@ int32_t read_res(int fd) {
         return err;
     }
 
-    uint32_t len = 0;
-    memcpy(&len, rbuf, 4); /* assume little endian */
-    if (len > K_MAX_MSG) {
+    /* reply body */
+    std::vector<char> body;
+    if (len == K_STREAM_LEN) {
+        err = read_chunks(fd, body);
+    } else if (len > K_MAX_MSG_LIMIT) {
         msgf("too long, fd=%d\n", fd);
         return -1;
+    } else {
+        body.resize(len);
+        err = read_full(fd, body.data(), len);
     }
-
-    /* reply body */
-    err = read_full(fd, &rbuf[4], len);
     if (err) {
         msgf("read() error, fd=%d\n", fd);
         return err;
     }
 
     /* print the result */
-    int32_t rv = print_response((uint8_t *)&rbuf[4], len);
-    if (rv > 0 && (uint32_t)rv != len) {
+    int32_t rv = print_response((uint8_t *)body.data(), body.size());
+    if (rv > 0 && (size_t)rv != body.size()) {
         msgf("bad response, fd=%d\n", fd);
         rv = -1;
     }
     return rv;
 }
 
+static int32_t parse_response(const uint8_t *data, size_t size, bool print);
+
+/* an array of unknown length ends with TAG_END, it's counted before printing */
+static int32_t parse_stream_arr(const uint8_t *data, size_t size, bool print) {
+    uint32_t len = 0;
+    size_t arr_bytes = 1 + 4;
+    while (arr_bytes < size && data[arr_bytes] != TAG_END) {
+        int32_t rv = parse_response(&data[arr_bytes], size - arr_bytes, false);
+        if (rv < 0) {
+            return rv;
+        }
+        arr_bytes += (size_t)rv;
+        len++;
+    }
+    if (arr_bytes >= size) {
+        msg("bad response");
+        return -1;
+    }
+    if (print) {
+        printf("(arr) len=%u\n", len);
+        for (size_t cur = 1 + 4; cur < arr_bytes; ) {
+            cur += (size_t)parse_response(&data[cur], arr_bytes - cur, true);
+        }
+        printf("(arr) end\n");
+    }
+    return (int32_t)(arr_bytes + 1);
+}
+
 int32_t print_response(const uint8_t *data, size_t size) {
+    return parse_response(data, size, true);
+}
+
+static int32_t parse_response(const uint8_t *data, size_t size, bool print) {
     if (size < 1) {
         msg("bad response");
         return -1;
     }
     switch (data[0]) {
     case TAG_NIL:
-        printf("(nil)\n");
+        if (print) {
+            printf("(nil)\n");
+        }
         return 1;
     case TAG_ERR:
         if (size < 1 + 8) {
@@ -138,7 +197,9 @@ int32_t print_response(const uint8_t *data, size_t size) {
                 msg("bad response");
                 return -1;
             }
-            printf("(err) %d %.*s\n", code, len, &data[1 + 8]);
+            if (print) {
+                printf("(err) %d %.*s\n", code, len, &data[1 + 8]);
+            }
             return 1 + 8 + len;
         }
     case TAG_STR:
@@ -153,7 +214,9 @@ int32_t print_response(const uint8_t *data, size_t size) {
                 msg("bad response");
                 return -1;
             }
-            printf("(str) %.*s\n", len, &data[1 + 4]);
+            if (print) {
+                printf("(str) %.*s\n", len, &data[1 + 4]);
+            }
             return 1 + 4 + len;
         }
     case TAG_INT:
@@ -164,7 +227,9 @@ int32_t print_response(const uint8_t *data, size_t size) {
         {
             int64_t val = 0;
             memcpy(&val, &data[1], 8);
-            printf("(int) %lld\n", val);
+            if (print) {
+                printf("(int) %lld\n", val);
+            }
             return 1 + 8;
         }
     case TAG_DBL:
@@ -175,7 +240,9 @@ int32_t print_response(const uint8_t *data, size_t size) {
         {
             double val = 0;
             memcpy(&val, &data[1], 8);
-            printf("(dbl) %g\n", val);
+            if (print) {
+                printf("(dbl) %g\n", val);
+            }
             return 1 + 8;
         }
     case TAG_ARR:
@@ -186,16 +253,23 @@ int32_t print_response(const uint8_t *data, size_t size) {
         {
             uint32_t len = 0;
             memcpy(&len, &data[1], 4);
-            printf("(arr) len=%u\n", len);
+            if (len == K_STREAM_LEN) {
+                return parse_stream_arr(data, size, print);
+            }
+            if (print) {
+                printf("(arr) len=%u\n", len);
+            }
             size_t arr_bytes = 1 + 4;
             for (uint32_t i = 0; i < len; ++i) {
-                int32_t rv = print_response(&data[arr_bytes], size - arr_bytes);
+                int32_t rv = parse_response(&data[arr_bytes], size - arr_bytes, print);
                 if (rv < 0) {
                     return rv;
                 }
                 arr_bytes += (size_t)rv;
             }
-            printf("(arr) end\n");
+            if (print) {
+                printf("(arr) end\n");
+            }
             return (int32_t)arr_bytes;
         }
     default:
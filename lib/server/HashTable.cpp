@@ -1,6 +1,6 @@
 /**
  * @file ./lib/server/HashTable.cpp
- * @brief 
+ * @brief
  * @author Fendy (xingfen.star@gmail.com)
  * @version 1.0
  * @date 2025-03-17
@@ -8,126 +8,394 @@
  */
 
 #include <assert.h>
-#include <stdlib.h>     /* calloc(), free() */
+#include <stdlib.h>     /* malloc(), free() */
+#include <string.h>     /* memset() */
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <utility>     /* std::swap() */
 #include <HashTable.h>
 #include <defs.h>
 
+/*
+ * control bytes: a full slot has the 7-bit tag, the other states have the
+ * high bit set so a group is tested for them with one movemask.
+ */
+enum : uint8_t {
+    CTRL_EMPTY   = 0x80,
+    CTRL_DELETED = 0xFE,    /* a tombstone, the probes go on past it */
+};
+
+/* a group of control bytes, probed at once */
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define K_GROUP 32
+typedef __m256i Group;
+
+static inline Group g_load(const uint8_t *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+static inline uint32_t g_match(Group g, uint8_t v) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, _mm256_set1_epi8((char)v)));
+}
+static inline uint32_t g_match_free(Group g) {     /* empty or deleted */
+    return (uint32_t)_mm256_movemask_epi8(g);
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define K_GROUP 16
+typedef __m128i Group;
+
+static inline Group g_load(const uint8_t *p) {
+    return _mm_loadu_si128((const __m128i *)p);
+}
+static inline uint32_t g_match(Group g, uint8_t v) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)v)));
+}
+static inline uint32_t g_match_free(Group g) {
+    return (uint32_t)_mm_movemask_epi8(g);
+}
+
+#else   /* portable */
+
+#define K_GROUP 16
+typedef const uint8_t *Group;
+
+static inline Group g_load(const uint8_t *p) {
+    return p;
+}
+static inline uint32_t g_match(Group g, uint8_t v) {
+    uint32_t m = 0;
+    for (uint32_t i = 0; i < K_GROUP; i++) {
+        m |= (uint32_t)(g[i] == v) << i;
+    }
+    return m;
+}
+static inline uint32_t g_match_free(Group g) {
+    uint32_t m = 0;
+    for (uint32_t i = 0; i < K_GROUP; i++) {
+        m |= (uint32_t)(g[i] >> 7) << i;
+    }
+    return m;
+}
+
+#endif
+
+static_assert(K_MIN_SLOTS % K_GROUP == 0, "the least table is made of groups");
+
+static inline uint32_t g_match_full(Group g) {
+    return ~g_match_free(g) & (uint32_t)((1ull << K_GROUP) - 1);
+}
+
+/* the tag is taken from the high bits, the position from the low bits */
+static inline uint8_t h_tag(uint64_t hcode) {
+    return (uint8_t)(hcode >> 57);
+}
+
+uint64_t g_hash_seed = 0;
+
+void hash_seed_set(uint64_t seed) {
+    g_hash_seed = seed ^ wy_mix(seed ^ k_wyp[0], k_wyp[1]);
+}
+
+void hash_seed_init() {
+    uint64_t seed = 0;
+    if (getrandom(&seed, sizeof(seed), 0) != (ssize_t)sizeof(seed)) {
+        /* no entropy yet, still not predictable from outside */
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)getpid();
+    }
+    hash_seed_set(seed);
+}
+
 bool hnode_same(HNode *node, HNode *key) {
     return node == key;
 }
 
 /* n must be a power of 2 */
 void h_init(HTab *htab, size_t n) {
-    assert(n > 0 && ((n - 1) & n) == 0);
-    htab->tab = (HNode **)calloc(n, sizeof(HNode *));
+    assert(n >= K_GROUP && ((n - 1) & n) == 0);
+    /* the groups are aligned, a load never spans 2 cache lines */
+    htab->ctrl = (uint8_t *)aligned_alloc(64, n < 64 ? 64 : n);
+    memset(htab->ctrl, CTRL_EMPTY, n);
+    htab->slots = (HNode **)malloc(n * sizeof(HNode *));
     htab->mask = n - 1;
     htab->size = 0;
+    htab->used = 0;
+    htab->limit = (size_t)((double)n * K_MAX_LOAD_FACTOR);
+}
+
+static void h_free(HTab *htab) {
+    free(htab->ctrl);
+    free(htab->slots);
+    *htab = HTab{};
+}
+
+static void h_free_mem(void *ptr, size_t) {
+    free(ptr);
+}
+
+static thread_local void (*t_dispose)(void *, size_t) = &h_free_mem;
+
+void hm_set_dispose(void (*f)(void *ptr, size_t size)) {
+    t_dispose = f;
+}
+
+/* the older table of a finished migration, the larger it gets the later it's freed */
+static void h_dispose(HTab *htab) {
+    size_t n = htab->mask + 1;
+    t_dispose(htab->ctrl, n < 64 ? 64 : n);
+    t_dispose(htab->slots, n * sizeof(HNode *));
+    *htab = HTab{};
+}
+
+/* the first slot of the home group, the probes go on with a triangular sequence of groups */
+static inline size_t h_home(HTab *htab, uint64_t hcode) {
+    return hcode & htab->mask & ~(size_t)(K_GROUP - 1);
 }
 
 /* hashtable insertion */
 void h_insert(HTab *htab, HNode *node) {
-    size_t pos = node->hcode & htab->mask;
-    HNode *next = htab->tab[pos];
-    node->next = next;
-    htab->tab[pos] = node;
+    /* the first free slot of the probe sequence */
+    size_t pos = h_home(htab, node->hcode);
+    for (size_t step = K_GROUP; ; step += K_GROUP) {
+        uint32_t m = g_match_free(g_load(htab->ctrl + pos));
+        if (m) {
+            pos += (size_t)__builtin_ctz(m);
+            break;
+        }
+        pos = (pos + step) & htab->mask;
+    }
+
+    htab->used += htab->ctrl[pos] == CTRL_EMPTY;
+    htab->ctrl[pos] = h_tag(node->hcode);
+    htab->slots[pos] = node;
     htab->size++;
 }
 
 /*
  * hashtable look up subroutine.
- * Pay attention to the return value. It returns the address of
- * the parent pointer that owns the target node,
- * which can be used to delete the target node.
+ * It returns the position of the target node, which can be used to delete
+ * it, or -1. The nodes are only compared on a tag match.
  */
-HNode **h_lookup(HTab *htab, HNode *key, bool (*eq)(HNode *, HNode *)) {
-    if (!htab->tab) {
-        return NULL;
+size_t h_lookup(HTab *htab, HNode *key, bool (*eq)(HNode *, HNode *)) {
+    if (!htab->ctrl) {
+        return (size_t)-1;
     }
 
-    size_t pos = key->hcode & htab->mask;
-    HNode **from = &htab->tab[pos];     /* incoming pointer to the target */
-    for (HNode *cur; (cur = *from) != NULL; from = &cur->next) {
-        if (cur->hcode == key->hcode && eq(cur, key)) {
-            return from;                /* may be a node, may be a slot */
+    uint8_t tag = h_tag(key->hcode);
+    size_t pos = h_home(htab, key->hcode);
+    for (size_t step = K_GROUP; step <= htab->mask + K_GROUP; step += K_GROUP) {
+        Group g = g_load(htab->ctrl + pos);
+        for (uint32_t m = g_match(g, tag); m; m &= m - 1) {
+            size_t idx = pos + (size_t)__builtin_ctz(m);
+            HNode *cur = htab->slots[idx];
+            if (cur->hcode == key->hcode && eq(cur, key)) {
+                return idx;
+            }
+        }
+        if (g_match(g, CTRL_EMPTY)) {
+            return (size_t)-1;  /* the probe sequence ends at an empty slot */
         }
+        pos = (pos + step) & htab->mask;
     }
-    return NULL;
+    return (size_t)-1;
 }
 
-/* remove a node from the chain */
-HNode *h_detach(HTab *htab, HNode **from) {
-    HNode *node = *from;    /* the target node */
-    *from = node->next;     /* update the incoming pointer to the target */
+/* remove a node from its slot */
+HNode *h_detach(HTab *htab, size_t pos) {
+    HNode *node = htab->slots[pos];
+    /* the slot can be empty again if no probe has passed the group: it has an empty slot */
+    size_t group = pos & ~(size_t)(K_GROUP - 1);
+    bool never_full = g_match(g_load(htab->ctrl + group), CTRL_EMPTY) != 0;
+    htab->ctrl[pos] = never_full ? CTRL_EMPTY : CTRL_DELETED;
+    htab->used -= never_full;
     htab->size--;
     return node;
 }
 
+static void hm_check_shrinking(HMap *hmap);
+
+/* the migrating maps of this thread */
+static thread_local DList t_rehashing;
+static thread_local size_t t_rehash_maps = 0;
+static thread_local RehashStats t_rehash_stats;
+
+static DList *rehash_list() {
+    if (!t_rehashing.next) {
+        dlist_init(&t_rehashing);
+    }
+    return &t_rehashing;
+}
+
+void hm_rehash_unlist(HMap *hmap) {
+    if (hmap->rehash_node.next) {
+        dlist_detach(&hmap->rehash_node);
+        hmap->rehash_node = DList{};
+        t_rehash_maps--;
+    }
+}
+
 void hm_help_rehashing(HMap *hmap) {
+    if (hmap->paused || !hmap->older.ctrl) {
+        return;     /* the slots must stay where they are, or nothing to do */
+    }
+    HTab *older = &hmap->older;
     size_t nwork = 0;
-    while (nwork < K_REHASHING_WORK && hmap->older.size > 0) {
-        /* find a non-empty slot */
-        HNode **from = &hmap->older.tab[hmap->migrate_pos];
-        if (!*from) {
-            hmap->migrate_pos++;
-            continue;   /* empty slot */
+    while (nwork < K_REHASHING_WORK && older->size > 0) {
+        /* move the nodes of a group to the newer table */
+        assert(hmap->migrate_pos <= older->mask);
+        uint32_t m = g_match_full(g_load(older->ctrl + hmap->migrate_pos));
+        for (; m; m &= m - 1) {
+            size_t pos = hmap->migrate_pos + (size_t)__builtin_ctz(m);
+            h_insert(&hmap->newer, older->slots[pos]);
+            /* a tombstone, the older table is still probed */
+            older->ctrl[pos] = CTRL_DELETED;
+            older->size--;
+            nwork++;
         }
-        /* move the first list item to the newer table */
-        h_insert(&hmap->newer, h_detach(&hmap->older, from));
+        hmap->migrate_pos += K_GROUP;
         nwork++;
     }
     /* discard the old table if done */
-    if (hmap->older.size == 0 && hmap->older.tab) {
-        free(hmap->older.tab);
-        hmap->older = HTab{};
+    if (older->size == 0) {
+        h_dispose(older);
+        hm_rehash_unlist(hmap);
+        hm_check_shrinking(hmap);   /* the deletes may have waited for it */
+    }
+}
+
+/* migrate the rest at once, only if the progressive migration fell behind */
+static void hm_finish_rehashing(HMap *hmap) {
+    uint32_t paused = hmap->paused;
+    hmap->paused = 0;
+    while (hmap->older.ctrl) {
+        hm_help_rehashing(hmap);
     }
+    hmap->paused = paused;
 }
 
-void hm_trigger_rehashing(HMap *hmap) {
-    assert(hmap->older.tab == NULL);
+/* start migrating into a table of `n` slots */
+void hm_trigger_rehashing(HMap *hmap, size_t n) {
+    assert(hmap->older.ctrl == NULL);
     /* (newer, older) <- (new_table, newer) */
     hmap->older = hmap->newer;
-    h_init(&hmap->newer, (hmap->newer.mask + 1) * 2);
+    h_init(&hmap->newer, n);
     hmap->migrate_pos = 0;
+    /* until it's done, the idle time of the event loop helps */
+    assert(!hmap->rehash_node.next);
+    dlist_insert_before(rehash_list(), &hmap->rehash_node);
+    t_rehash_maps++;
+}
+
+/* the size to grow into, or the same size to clear the tombstones */
+static size_t hm_grown_size(HTab *htab) {
+    size_t n = htab->mask + 1;
+    return htab->size >= htab->limit / 2 ? n * 2 : n;
+}
+
+/*
+ * Shrink below K_MIN_LOAD_FACTOR, into a table loaded to about a half: it's
+ * far from both thresholds, so a map around one of them doesn't flap.
+ */
+static void hm_check_shrinking(HMap *hmap) {
+    HTab *newer = &hmap->newer;
+    if (hmap->older.ctrl || hmap->paused || newer->mask + 1 <= K_MIN_SLOTS) {
+        return;     /* busy, or small already */
+    }
+    if ((double)newer->size >= (double)(newer->mask + 1) * K_MIN_LOAD_FACTOR) {
+        return;
+    }
+    size_t n = K_MIN_SLOTS;
+    while (n < newer->size * 2) {
+        n *= 2;
+    }
+    hm_trigger_rehashing(hmap, n);
 }
 
 HNode *hm_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
     hm_help_rehashing(hmap);
-    HNode **from = h_lookup(&hmap->newer, key, eq);
-    if (!from) {
-        from = h_lookup(&hmap->older, key, eq);
+    size_t pos = h_lookup(&hmap->newer, key, eq);
+    if (pos != (size_t)-1) {
+        return hmap->newer.slots[pos];
     }
-    return from ? *from : NULL;
+    pos = h_lookup(&hmap->older, key, eq);
+    return pos != (size_t)-1 ? hmap->older.slots[pos] : NULL;
 }
 
 void hm_insert(HMap *hmap, HNode *node) {
-    if (!hmap->newer.tab) {
-        h_init(&hmap->newer, 4);    /* initialize it if empty */
+    if (!hmap->newer.ctrl) {
+        h_init(&hmap->newer, K_MIN_SLOTS);  /* initialize it if empty */
     }
-    h_insert(&hmap->newer, node);   /* always insert to the newer table */
 
-    if (!hmap->older.tab) {         /* check whether we need to rehash */
-        size_t shreshold = (hmap->newer.mask + 1) * K_MAX_LOAD_FACTOR;
-        if (hmap->newer.size >= shreshold) {
-            hm_trigger_rehashing(hmap);
-        }
+    HTab *newer = &hmap->newer;
+    if (newer->used >= newer->limit) {  /* check whether we need to rehash */
+        if (!hmap->older.ctrl) {
+            hm_trigger_rehashing(hmap, hm_grown_size(newer));
+        } else if (!hmap->paused || newer->used >= newer->mask) {
+            /* the slots are running out */
+            hm_finish_rehashing(hmap);
+            hm_trigger_rehashing(hmap, hm_grown_size(newer));
+        }   /* else: paused, it goes over the limit for a while */
     }
+    h_insert(&hmap->newer, node);   /* always insert to the newer table */
+
     hm_help_rehashing(hmap);        /* migrate some keys */
 }
 
 HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
     hm_help_rehashing(hmap);
-    if (HNode **from = h_lookup(&hmap->newer, key, eq)) {
-        return h_detach(&hmap->newer, from);
+    HNode *node = NULL;
+    size_t pos = h_lookup(&hmap->newer, key, eq);
+    if (pos != (size_t)-1) {
+        node = h_detach(&hmap->newer, pos);
+        hm_check_shrinking(hmap);
+    } else if ((pos = h_lookup(&hmap->older, key, eq)) != (size_t)-1) {
+        node = h_detach(&hmap->older, pos);
+    }
+    return node;
+}
+
+void hm_replace(HMap *hmap, HNode *old, HNode *node) {
+    assert(old->hcode == node->hcode);
+    HTab *tabs[2] = {&hmap->newer, &hmap->older};
+    for (HTab *htab : tabs) {
+        size_t pos = h_lookup(htab, old, &hnode_same);
+        if (pos != (size_t)-1) {
+            htab->slots[pos] = node;
+            return;
+        }
+    }
+    assert(!"the node is not in the map");
+}
+
+/* room for `n` keys without growing, the keys there now move over progressively */
+void hm_reserve(HMap *hmap, size_t n) {
+    size_t slots = K_MIN_SLOTS;
+    while ((double)slots * K_MAX_LOAD_FACTOR < (double)n) {
+        slots *= 2;
+    }
+    if (!hmap->newer.ctrl) {
+        h_init(&hmap->newer, slots);
+        return;
     }
-    if (HNode **from = h_lookup(&hmap->older, key, eq)) {
-        return h_detach(&hmap->older, from);
+    if (hmap->paused || hmap->newer.mask + 1 >= slots) {
+        return;
     }
-    return NULL;
+    hm_finish_rehashing(hmap);  /* one migration at a time */
+    hm_trigger_rehashing(hmap, slots);
 }
 
 void hm_clear(HMap *hmap) {
-    free(hmap->newer.tab);
-    free(hmap->older.tab);
+    hm_rehash_unlist(hmap);
+    h_free(&hmap->newer);
+    h_free(&hmap->older);
     *hmap = HMap{};
 }
 
@@ -136,9 +404,9 @@ size_t hm_size(HMap *hmap) {
 }
 
 bool h_foreach(HTab *htab, bool (*f)(HNode *, void *), void *arg) {
-    for (size_t i = 0; htab->mask != 0 && i <= htab->mask; i++) {
-        for (HNode *node = htab->tab[i]; node != NULL; node = node->next) {
-            if (!f(node, arg)) {
+    for (size_t i = 0; htab->ctrl && i <= htab->mask; i += K_GROUP) {
+        for (uint32_t m = g_match_full(g_load(htab->ctrl + i)); m; m &= m - 1) {
+            if (!f(htab->slots[i + (size_t)__builtin_ctz(m)], arg)) {
                 return false;
             }
         }
@@ -147,5 +415,147 @@ bool h_foreach(HTab *htab, bool (*f)(HNode *, void *), void *arg) {
 }
 
 void hm_foreach(HMap *hmap, bool (*f)(HNode *, void *), void *arg) {
-    h_foreach(&hmap->newer, f, arg) && h_foreach(&hmap->older, f, arg);
+    h_foreach(&hmap->older, f, arg) && h_foreach(&hmap->newer, f, arg);
+}
+
+size_t hm_foreach_from(HMap *hmap, size_t pos, bool (*f)(HNode *, void *), void *arg) {
+    /* the slots of `older`, then the ones of `newer`: a new table goes last */
+    HTab *tabs[2] = {&hmap->older, &hmap->newer};
+    size_t base = 0;
+    for (HTab *htab : tabs) {
+        size_t nslots = htab->ctrl ? htab->mask + 1 : 0;
+        for (; pos < base + nslots; pos++) {
+            if (htab->ctrl[pos - base] & 0x80) {
+                continue;   /* empty or deleted */
+            }
+            if (!f(htab->slots[pos - base], arg)) {
+                return pos + 1;
+            }
+        }
+        base += nslots;
+    }
+    return (size_t)-1;
+}
+
+/* the nodes of the home group `g`: on its probe sequence, up to a group that was never full */
+static void h_scan_group(HTab *htab, size_t g, void (*f)(HNode *, void *), void *arg) {
+    size_t home = g * K_GROUP;
+    size_t pos = home;
+    for (size_t step = K_GROUP; step <= htab->mask + K_GROUP; step += K_GROUP) {
+        Group grp = g_load(htab->ctrl + pos);
+        for (uint32_t m = g_match_full(grp); m; m &= m - 1) {
+            HNode *node = htab->slots[pos + (size_t)__builtin_ctz(m)];
+            if (h_home(htab, node->hcode) == home) {
+                f(node, arg);
+            }
+        }
+        if (g_match(grp, CTRL_EMPTY)) {
+            break;
+        }
+        pos = (pos + step) & htab->mask;
+    }
+}
+
+static inline uint64_t rev64(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(v);
+}
+
+/* increment the bits under `mask` from the high end */
+static inline size_t rev_next(size_t v, size_t mask) {
+    v |= ~mask;
+    return (size_t)rev64(rev64(v) + 1);
+}
+
+/*
+ * The cursor is a group index of the smaller table. The groups of the larger
+ * one that share its low bits are visited with it, so a migration between 2
+ * calls doesn't hide a node, and since the cursor goes up from the high bits,
+ * a group visited before a resize covers the groups it becomes after it.
+ */
+size_t hm_scan(HMap *hmap, size_t cursor, void (*f)(HNode *, void *), void *arg) {
+    /* the newer table is the smaller one while shrinking */
+    HTab *small = &hmap->newer;
+    HTab *large = &hmap->older;
+    if (!small->ctrl) {
+        return 0;
+    }
+    if (!large->ctrl) {
+        size_t m0 = small->mask / K_GROUP;
+        h_scan_group(small, cursor & m0, f, arg);
+        return rev_next(cursor, m0);
+    }
+    if (large->mask < small->mask) {
+        std::swap(small, large);    /* growing: the newer table is the larger one */
+    }
+    size_t m0 = small->mask / K_GROUP;
+    size_t m1 = large->mask / K_GROUP;
+    h_scan_group(small, cursor & m0, f, arg);
+    do {
+        h_scan_group(large, cursor & m1, f, arg);
+        cursor = rev_next(cursor, m1);
+    } while (cursor & (m0 ^ m1));   /* the expansions of the small group */
+    return cursor;
+}
+
+void hm_pause_rehashing(HMap *hmap) {
+    hmap->paused++;
+}
+
+void hm_resume_rehashing(HMap *hmap) {
+    assert(hmap->paused > 0);
+    hmap->paused--;
+}
+
+static uint64_t now_usec() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+bool hm_rehash_background(uint64_t budget_us) {
+    DList *list = rehash_list();
+    if (dlist_empty(list)) {
+        return false;
+    }
+    uint64_t start = now_usec();
+    uint64_t now = start;
+    size_t groups = 0;
+    /* the oldest first, a finished map unlists itself */
+    for (DList *node = list->next; node != list && now - start < budget_us; ) {
+        DList *next = node->next;
+        HMap *hmap = container_of(node, HMap, rehash_node);
+        while (!hmap->paused && hmap->older.ctrl && now - start < budget_us) {
+            size_t pos = hmap->migrate_pos;
+            hm_help_rehashing(hmap);
+            groups += (hmap->migrate_pos - pos) / K_GROUP;
+            now = now_usec();
+        }
+        node = next;
+    }
+    t_rehash_stats.runs++;
+    t_rehash_stats.usec += now - start;
+    t_rehash_stats.groups += groups;
+    return hm_rehash_pending();
+}
+
+bool hm_rehash_pending() {
+    /* the paused ones wait for their iterations */
+    DList *list = rehash_list();
+    for (DList *node = list->next; node != list; node = node->next) {
+        if (!container_of(node, HMap, rehash_node)->paused) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t hm_rehash_maps() {
+    return t_rehash_maps;
+}
+
+const RehashStats &hm_rehash_stats() {
+    return t_rehash_stats;
 }
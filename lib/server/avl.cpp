@@ -13,10 +13,11 @@ uint32_t max(uint32_t lhs, uint32_t rhs) {
     return lhs < rhs ? rhs : lhs;
 }
 
-/* maintain the height and cnt field */
+/* maintain the height, cnt and sum field */
 void avl_update(AVLNode *node) {
     node->height = 1 + max(avl_height(node->left), avl_height(node->right));
     node->cnt = 1 + avl_cnt(node->left) + avl_cnt(node->right);
+    node->sum = node->val + avl_sum(node->left) + avl_sum(node->right);
 }
 
 AVLNode *rot_left(AVLNode *node) {
@@ -136,7 +137,9 @@ AVLNode *avl_del(AVLNode *node) {
     /* detach the successor */
     AVLNode *root = avl_del_easy(victim);
     /* swap with the successor */
+    double val = victim->val;
     *victim = *node;    /* left, right, parent */
+    victim->val = val;
     if (victim->left) {
         victim->left->parent = victim;
     }
@@ -150,6 +153,10 @@ AVLNode *avl_del(AVLNode *node) {
         from = parent->left == node ? &parent->left : &parent->right;
     }
     *from = victim;
+    /* the sums up from it still count the deleted node */
+    for (AVLNode *cur = victim; cur; cur = cur->parent) {
+        avl_update(cur);
+    }
     return root;
 }
 
@@ -182,4 +189,56 @@ AVLNode *avl_offset(AVLNode *node, int64_t offset) {
         }
     }
     return node;
-}
\ No newline at end of file
+}
+/* the in-order successor, amortized O(1) over a walk */
+AVLNode *avl_next(AVLNode *node) {
+    if (node->right) {
+        for (node = node->right; node->left; node = node->left) {}
+        return node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/* the in-order predecessor */
+AVLNode *avl_prev(AVLNode *node) {
+    if (node->left) {
+        for (node = node->left; node->right; node = node->right) {}
+        return node;
+    }
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/* the number of nodes before it in the whole tree, O(log N) */
+uint32_t avl_rank(AVLNode *node) {
+    uint32_t rank = avl_cnt(node->left);
+    for (; node->parent; node = node->parent) {
+        if (node->parent->right == node) {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+    }
+    return rank;
+}
+
+static AVLNode *avl_build_range(AVLNode **nodes, size_t lo, size_t hi, AVLNode *parent) {
+    if (lo >= hi) {
+        return NULL;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    AVLNode *node = nodes[mid];
+    node->parent = parent;
+    node->left = avl_build_range(nodes, lo, mid, node);
+    node->right = avl_build_range(nodes, mid + 1, hi, node);
+    avl_update(node);
+    return node;
+}
+
+/* a balanced tree of nodes in order, their `val` set, in O(N); returns the root */
+AVLNode *avl_build(AVLNode **nodes, size_t n) {
+    return avl_build_range(nodes, 0, n, NULL);
+}
@@ -0,0 +1,639 @@
+/**
+ * @file ./lib/server/btree.cpp
+ * @brief an order-statistic B+tree over the (score, name) order of a zset
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-17
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <string.h>
+
+/* C++ */
+#include <new>      /* placement new */
+#include <vector>
+
+/* proj */
+#include <btree.h>
+#include <slab.h>
+#include <zset.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/* a node under it is merged with, or takes keys from, a sibling */
+#define K_BTREE_MIN (K_BTREE_FAN / 4)
+
+static_assert(K_BTREE_FAN % 4 == 0 && K_BTREE_MIN >= 2, "the scores are compared 4 at a time");
+
+/* the number of scores < s, the array is sorted */
+static inline uint32_t count_less(const double *scores, uint32_t n, double s) {
+    uint32_t cnt = 0;
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    __m256d key = _mm256_set1_pd(s);
+    for (; i + 4 <= n; i += 4) {
+        __m256d lt = _mm256_cmp_pd(_mm256_loadu_pd(scores + i), key, _CMP_LT_OQ);
+        cnt += (uint32_t)__builtin_popcount((uint32_t)_mm256_movemask_pd(lt));
+    }
+#endif
+    for (; i < n; i++) {
+        cnt += scores[i] < s;
+    }
+    return cnt;
+}
+
+/* the name of `item` < name, on a score tie */
+static inline bool name_less(const ZNode *item, const char *name, size_t len) {
+    int rv = memcmp(item->name, name, item->len < len ? item->len : len);
+    return rv != 0 ? rv < 0 : item->len < len;
+}
+
+/* the first key >= (s, name) */
+static uint32_t lower_bound(const double *scores, ZNode *const *items, uint32_t n,
+                            double s, const char *name, size_t len) {
+    uint32_t i = count_less(scores, n, s);
+    while (i < n && scores[i] == s && name_less(items[i], name, len)) {
+        i++;
+    }
+    return i;
+}
+
+/* the child that may hold (s, name): the last one with its least key <= it */
+static uint32_t child_index(BInner *in, double s, const char *name, size_t len) {
+    uint32_t i = lower_bound(in->scores, in->mins, in->hdr.n, s, name, len);
+    if (i < in->hdr.n && in->scores[i] == s && in->mins[i]->len == len
+        && memcmp(in->mins[i]->name, name, len) == 0) {
+        return i;   /* the least key of the child */
+    }
+    return i > 0 ? i - 1 : 0;
+}
+
+static BLeaf *leaf_new() {
+    BLeaf *leaf = new (slab_alloc(sizeof(BLeaf))) BLeaf();
+    leaf->hdr.leaf = 1;
+    return leaf;
+}
+
+static BInner *inner_new() {
+    return new (slab_alloc(sizeof(BInner))) BInner();
+}
+
+static void node_free(BNode *node) {
+    slab_free(node, node->leaf ? sizeof(BLeaf) : sizeof(BInner));
+}
+
+static uint32_t node_count(BNode *node) {
+    if (node->leaf) {
+        return node->n;
+    }
+    BInner *in = (BInner *)node;
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        cnt += in->cnt[i];
+    }
+    return cnt;
+}
+
+/* the sum of the scores of a subtree */
+static double node_sum(BNode *node) {
+    const double *vals = node->leaf ? ((BLeaf *)node)->scores : ((BInner *)node)->sum;
+    double sum = 0;
+    for (uint32_t i = 0; i < node->n; i++) {
+        sum += vals[i];
+    }
+    return sum;
+}
+
+/* the least key of a subtree */
+static void node_min(BNode *node, double *score, ZNode **item) {
+    if (node->leaf) {
+        *score = ((BLeaf *)node)->scores[0];
+        *item = ((BLeaf *)node)->items[0];
+    } else {
+        *score = ((BInner *)node)->scores[0];
+        *item = ((BInner *)node)->mins[0];
+    }
+}
+
+/* set the least key and the size of the child `i` from the child */
+static void inner_sync(BInner *in, uint32_t i) {
+    node_min(in->child[i], &in->scores[i], &in->mins[i]);
+    in->cnt[i] = node_count(in->child[i]);
+    in->sum[i] = node_sum(in->child[i]);
+}
+
+/* move `n` entries at `from` of `src` to `to` of `dst`, they may overlap */
+static void leaf_move(BLeaf *dst, uint32_t to, BLeaf *src, uint32_t from, uint32_t n) {
+    memmove(&dst->scores[to], &src->scores[from], n * sizeof(double));
+    memmove(&dst->items[to], &src->items[from], n * sizeof(ZNode *));
+}
+
+static void inner_move(BInner *dst, uint32_t to, BInner *src, uint32_t from, uint32_t n) {
+    memmove(&dst->scores[to], &src->scores[from], n * sizeof(double));
+    memmove(&dst->mins[to], &src->mins[from], n * sizeof(ZNode *));
+    memmove(&dst->cnt[to], &src->cnt[from], n * sizeof(uint32_t));
+    memmove(&dst->sum[to], &src->sum[from], n * sizeof(double));
+    memmove(&dst->child[to], &src->child[from], n * sizeof(BNode *));
+}
+
+/* move the upper half of a full node to a new right sibling */
+static BNode *node_split(BNode *node) {
+    uint32_t half = K_BTREE_FAN / 2;
+    if (node->leaf) {
+        BLeaf *leaf = (BLeaf *)node;
+        BLeaf *right = leaf_new();
+        leaf_move(right, 0, leaf, half, K_BTREE_FAN - half);
+        right->next = leaf->next;
+        right->prev = leaf;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        }
+        leaf->next = right;
+        right->hdr.n = K_BTREE_FAN - half;
+        leaf->hdr.n = half;
+        return &right->hdr;
+    }
+    BInner *in = (BInner *)node;
+    BInner *right = inner_new();
+    inner_move(right, 0, in, half, K_BTREE_FAN - half);
+    right->hdr.n = K_BTREE_FAN - half;
+    in->hdr.n = half;
+    return &right->hdr;
+}
+
+/* insert a child at `i`, there is room */
+static void inner_insert(BInner *in, uint32_t i, BNode *child) {
+    inner_move(in, i + 1, in, i, in->hdr.n - i);
+    in->child[i] = child;
+    in->hdr.n++;
+    inner_sync(in, i);
+}
+
+static void inner_remove(BInner *in, uint32_t i) {
+    inner_move(in, i, in, i + 1, in->hdr.n - i - 1);
+    in->hdr.n--;
+}
+
+/* the path from the root to a leaf */
+struct BPath {
+    BInner *nodes[K_BTREE_DEPTH];
+    uint32_t idx[K_BTREE_DEPTH];
+    uint32_t depth = 0;
+};
+
+/* the least key of nodes[d] has changed, and so may have the ones above it */
+static void path_fix_min(BPath *path, uint32_t d) {
+    for (; d > 0; d--) {
+        BInner *parent = path->nodes[d - 1];
+        uint32_t i = path->idx[d - 1];
+        node_min(&path->nodes[d]->hdr, &parent->scores[i], &parent->mins[i]);
+        if (i != 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * the sum of nodes[d], or of the leaf below them, has changed: recompute the
+ * sums up the path, they are not adjusted by the score so they never drift
+ */
+static void path_fix_sum(BPath *path, uint32_t d, BNode *child) {
+    for (; d > 0; d--) {
+        BInner *parent = path->nodes[d - 1];
+        parent->sum[path->idx[d - 1]] = node_sum(child);
+        child = &parent->hdr;
+    }
+}
+
+void bt_insert(BTree *tree, ZNode *node) {
+    double s = node->score;
+    if (!tree->root) {
+        tree->root = &leaf_new()->hdr;
+    }
+
+    /* descend, the sizes on the path grow by 1 */
+    BPath path;
+    BNode *cur = tree->root;
+    while (!cur->leaf) {
+        BInner *in = (BInner *)cur;
+        uint32_t i = child_index(in, s, node->name, node->len);
+        in->cnt[i]++;
+        if (i == 0 && (s < in->scores[0]
+                       || (s == in->scores[0] && name_less(node, in->mins[0]->name, in->mins[0]->len)))) {
+            in->scores[0] = s;      /* the new least key of the subtree */
+            in->mins[0] = node;
+        }
+        assert(path.depth < K_BTREE_DEPTH);
+        path.nodes[path.depth] = in;
+        path.idx[path.depth++] = i;
+        cur = in->child[i];
+    }
+
+    /* a full leaf is split first, the new key goes to one of the halves */
+    BLeaf *leaf = (BLeaf *)cur;
+    uint32_t pos = lower_bound(leaf->scores, leaf->items, leaf->hdr.n, s, node->name, node->len);
+    BNode *right = NULL;
+    if (leaf->hdr.n == K_BTREE_FAN) {
+        right = node_split(&leaf->hdr);
+        if (pos > leaf->hdr.n) {
+            pos -= leaf->hdr.n;
+            leaf = (BLeaf *)right;
+        }
+    }
+    leaf_move(leaf, pos + 1, leaf, pos, leaf->hdr.n - pos);
+    leaf->scores[pos] = s;
+    leaf->items[pos] = node;
+    leaf->hdr.n++;
+    tree->size++;
+
+    /* add the new right siblings to the parents, up to a parent with room */
+    BNode *left = cur;
+    uint32_t d = path.depth;
+    for (; right && d > 0; d--) {
+        BInner *parent = path.nodes[d - 1];
+        uint32_t i = path.idx[d - 1];
+        inner_sync(parent, i);
+        BNode *sibling = NULL;
+        if (parent->hdr.n == K_BTREE_FAN) {
+            sibling = node_split(&parent->hdr);
+            if (i + 1 > parent->hdr.n) {
+                inner_insert((BInner *)sibling, i + 1 - parent->hdr.n, right);
+            } else {
+                inner_insert(parent, i + 1, right);
+            }
+        } else {
+            inner_insert(parent, i + 1, right);
+        }
+        left = &parent->hdr;
+        right = sibling;
+    }
+    if (right) {    /* the root was split */
+        BInner *root = inner_new();
+        root->child[0] = left;
+        root->child[1] = right;
+        root->hdr.n = 2;
+        inner_sync(root, 0);
+        inner_sync(root, 1);
+        tree->root = &root->hdr;
+        tree->height++;
+    } else {
+        path_fix_sum(&path, d, left);   /* above the splits */
+    }
+}
+
+/* even out 2 adjacent children, or merge them, returns false if merged */
+static bool rebalance_pair(BInner *parent, uint32_t i) {
+    BNode *a = parent->child[i];
+    BNode *b = parent->child[i + 1];
+    uint32_t total = a->n + b->n;
+    if (a->leaf) {
+        BLeaf *la = (BLeaf *)a, *lb = (BLeaf *)b;
+        if (total <= K_BTREE_FAN) {     /* merge b into a */
+            leaf_move(la, a->n, lb, 0, b->n);
+            la->next = lb->next;
+            if (lb->next) {
+                lb->next->prev = la;
+            }
+        } else if (a->n < b->n) {       /* take from the front of b */
+            uint32_t k = (b->n - a->n) / 2;
+            leaf_move(la, a->n, lb, 0, k);
+            leaf_move(lb, 0, lb, k, b->n - k);
+            a->n += k;
+            b->n -= k;
+        } else {                        /* take from the back of a */
+            uint32_t k = (a->n - b->n) / 2;
+            leaf_move(lb, k, lb, 0, b->n);
+            leaf_move(lb, 0, la, a->n - k, k);
+            a->n -= k;
+            b->n += k;
+        }
+    } else {
+        BInner *ia = (BInner *)a, *ib = (BInner *)b;
+        if (total <= K_BTREE_FAN) {
+            inner_move(ia, a->n, ib, 0, b->n);
+        } else if (a->n < b->n) {
+            uint32_t k = (b->n - a->n) / 2;
+            inner_move(ia, a->n, ib, 0, k);
+            inner_move(ib, 0, ib, k, b->n - k);
+            a->n += k;
+            b->n -= k;
+        } else {
+            uint32_t k = (a->n - b->n) / 2;
+            inner_move(ib, k, ib, 0, b->n);
+            inner_move(ib, 0, ia, a->n - k, k);
+            a->n -= k;
+            b->n += k;
+        }
+    }
+    if (total <= K_BTREE_FAN) {
+        a->n = total;
+        node_free(b);
+        inner_remove(parent, i + 1);
+        inner_sync(parent, i);
+        return false;
+    }
+    inner_sync(parent, i);
+    inner_sync(parent, i + 1);
+    return true;
+}
+
+void bt_delete(BTree *tree, ZNode *node) {
+    double s = node->score;
+    BPath path;
+    BNode *cur = tree->root;
+    while (!cur->leaf) {
+        BInner *in = (BInner *)cur;
+        uint32_t i = child_index(in, s, node->name, node->len);
+        in->cnt[i]--;
+        path.nodes[path.depth] = in;
+        path.idx[path.depth++] = i;
+        cur = in->child[i];
+    }
+    BLeaf *leaf = (BLeaf *)cur;
+    uint32_t pos = lower_bound(leaf->scores, leaf->items, leaf->hdr.n, s, node->name, node->len);
+    assert(pos < leaf->hdr.n && leaf->items[pos] == node);
+    leaf_move(leaf, pos, leaf, pos + 1, leaf->hdr.n - pos - 1);
+    leaf->hdr.n--;
+    tree->size--;
+    path_fix_sum(&path, path.depth, cur);
+
+    if (leaf->hdr.n == 0 && path.depth == 0) {
+        node_free(cur);     /* the last one */
+        tree->root = NULL;
+        return;
+    }
+    if (pos == 0 && leaf->hdr.n > 0 && path.depth > 0) {
+        /* no key may point to the member any more */
+        BInner *parent = path.nodes[path.depth - 1];
+        node_min(cur, &parent->scores[path.idx[path.depth - 1]],
+                 &parent->mins[path.idx[path.depth - 1]]);
+        if (path.idx[path.depth - 1] == 0) {
+            path_fix_min(&path, path.depth - 1);
+        }
+    }
+
+    /* an underfull node takes from, or merges with, a sibling, up the path */
+    for (uint32_t d = path.depth; d > 0 && cur->n < K_BTREE_MIN; d--) {
+        BInner *parent = path.nodes[d - 1];
+        uint32_t i = path.idx[d - 1];
+        uint32_t left = i > 0 ? i - 1 : i;      /* the pair (left, left + 1) */
+        rebalance_pair(parent, left);
+        if (left == 0) {
+            path_fix_min(&path, d - 1);         /* the least key may come from the right one */
+        }
+        cur = &parent->hdr;
+    }
+    /* a root of 1 child is dropped */
+    while (!tree->root->leaf && tree->root->n == 1) {
+        BNode *child = ((BInner *)tree->root)->child[0];
+        node_free(tree->root);
+        tree->root = child;
+        tree->height--;
+    }
+}
+
+BPos bt_seekge(BTree *tree, double score, const char *name, size_t len) {
+    BNode *cur = tree->root;
+    if (!cur) {
+        return BPos{};
+    }
+    while (!cur->leaf) {
+        BInner *in = (BInner *)cur;
+        cur = in->child[child_index(in, score, name, len)];
+    }
+    BLeaf *leaf = (BLeaf *)cur;
+    uint32_t pos = lower_bound(leaf->scores, leaf->items, leaf->hdr.n, score, name, len);
+    if (pos == leaf->hdr.n) {   /* the first one of the next leaf */
+        return leaf->next ? BPos{leaf->next, 0} : BPos{};
+    }
+    return BPos{leaf, pos};
+}
+
+uint32_t bt_rank(BTree *tree, ZNode *node) {
+    uint32_t rank = 0;
+    BNode *cur = tree->root;
+    while (!cur->leaf) {
+        BInner *in = (BInner *)cur;
+        uint32_t i = child_index(in, node->score, node->name, node->len);
+        for (uint32_t j = 0; j < i; j++) {
+            rank += in->cnt[j];
+        }
+        cur = in->child[i];
+    }
+    BLeaf *leaf = (BLeaf *)cur;
+    return rank + lower_bound(leaf->scores, leaf->items, leaf->hdr.n,
+                              node->score, node->name, node->len);
+}
+
+BPos bt_select(BTree *tree, int64_t rank) {
+    if (rank < 0 || rank >= (int64_t)tree->size) {
+        return BPos{};
+    }
+    uint32_t r = (uint32_t)rank;
+    BNode *cur = tree->root;
+    while (!cur->leaf) {
+        BInner *in = (BInner *)cur;
+        uint32_t i = 0;
+        while (r >= in->cnt[i]) {
+            r -= in->cnt[i++];
+        }
+        cur = in->child[i];
+    }
+    return BPos{(BLeaf *)cur, r};
+}
+
+uint32_t bt_prefix(BTree *tree, double score) {
+    uint32_t cnt = 0;
+    BNode *cur = tree->root;
+    if (!cur) {
+        return 0;
+    }
+    while (!cur->leaf) {
+        /* the children before the last one starting below `score` are all below it */
+        BInner *in = (BInner *)cur;
+        uint32_t i = count_less(in->scores, cur->n, score);
+        i = i > 0 ? i - 1 : 0;
+        for (uint32_t j = 0; j < i; j++) {
+            cnt += in->cnt[j];
+        }
+        cur = in->child[i];
+    }
+    return cnt + count_less(((BLeaf *)cur)->scores, cur->n, score);
+}
+
+struct BRange {
+    double min, max;
+    bool min_ex, max_ex;
+};
+
+static bool brange_above_min(const BRange &r, double s) {
+    return r.min_ex ? s > r.min : s >= r.min;
+}
+
+static bool brange_below_max(const BRange &r, double s) {
+    return r.max_ex ? s < r.max : s <= r.max;
+}
+
+/*
+ * The subtrees inside the range are added whole, and only the ones across
+ * a bound are entered, at most 2 per level.
+ */
+static double node_sum(BNode *cur, const BRange &r) {
+    double sum = 0;
+    if (cur->leaf) {
+        BLeaf *leaf = (BLeaf *)cur;
+        for (uint32_t j = 0; j < cur->n; j++) {
+            double s = leaf->scores[j];
+            if (brange_above_min(r, s) && brange_below_max(r, s)) {
+                sum += s;
+            }
+        }
+        return sum;
+    }
+    BInner *in = (BInner *)cur;
+    for (uint32_t i = 0; i < cur->n; i++) {
+        /* the scores of the child i are in [scores[i], scores[i + 1]] */
+        if (!brange_below_max(r, in->scores[i])) {
+            break;
+        }
+        bool last = i + 1 == cur->n;
+        if (!last && !brange_above_min(r, in->scores[i + 1])) {
+            continue;
+        }
+        if (brange_above_min(r, in->scores[i]) && !last && brange_below_max(r, in->scores[i + 1])) {
+            sum += in->sum[i];
+        } else {
+            sum += node_sum(in->child[i], r);
+        }
+    }
+    return sum;
+}
+
+double bt_sum(BTree *tree, double min, bool min_ex, double max, bool max_ex) {
+    return tree->root ? node_sum(tree->root, BRange{min, max, min_ex, max_ex}) : 0;
+}
+
+BPos bt_offset(BTree *tree, BPos p, int64_t offset) {
+    if (!p.leaf) {
+        return p;
+    }
+    int64_t pos = (int64_t)p.pos + offset;
+    /* within a few leaves: follow the links */
+    for (uint32_t hops = 0; hops < 2; hops++) {
+        if (pos >= 0 && pos < (int64_t)p.leaf->hdr.n) {
+            return BPos{p.leaf, (uint32_t)pos};
+        }
+        if (pos < 0) {
+            p.leaf = p.leaf->prev;
+            if (!p.leaf) {
+                return BPos{};
+            }
+            pos += p.leaf->hdr.n;
+        } else {
+            pos -= p.leaf->hdr.n;
+            p.leaf = p.leaf->next;
+            if (!p.leaf) {
+                return BPos{};
+            }
+        }
+    }
+    if (pos >= 0 && pos < (int64_t)p.leaf->hdr.n) {
+        return BPos{p.leaf, (uint32_t)pos};
+    }
+    /* far away: by the rank of the first member of the leaf */
+    return bt_select(tree, (int64_t)bt_rank(tree, p.leaf->items[0]) + pos);
+}
+
+/*
+ * the members are spread evenly over the fewest leaves, and so are the
+ * nodes of each level over their parents: all at least half full
+ */
+void bt_build(BTree *tree, ZNode **items, size_t n) {
+    assert(!tree->root);
+    if (n == 0) {
+        return;
+    }
+    size_t nleaves = (n + K_BTREE_FAN - 1) / K_BTREE_FAN;
+    std::vector<BNode *> level(nleaves);
+    BLeaf *prev = NULL;
+    for (size_t i = 0, k = 0; i < nleaves; i++) {
+        BLeaf *leaf = leaf_new();
+        leaf->hdr.n = (uint32_t)(n / nleaves + (i < n % nleaves));
+        for (uint32_t j = 0; j < leaf->hdr.n; j++, k++) {
+            leaf->scores[j] = items[k]->score;
+            leaf->items[j] = items[k];
+        }
+        leaf->prev = prev;
+        if (prev) {
+            prev->next = leaf;
+        }
+        prev = leaf;
+        level[i] = &leaf->hdr;
+    }
+    while (level.size() > 1) {
+        size_t nparents = (level.size() + K_BTREE_FAN - 1) / K_BTREE_FAN;
+        std::vector<BNode *> parents(nparents);
+        for (size_t i = 0, k = 0; i < nparents; i++) {
+            BInner *in = inner_new();
+            in->hdr.n = (uint32_t)(level.size() / nparents + (i < level.size() % nparents));
+            for (uint32_t j = 0; j < in->hdr.n; j++, k++) {
+                in->child[j] = level[k];
+                inner_sync(in, j);
+            }
+            parents[i] = &in->hdr;
+        }
+        level.swap(parents);
+        tree->height++;
+    }
+    tree->root = level[0];
+    tree->size = (uint32_t)n;
+}
+
+static void node_clear(BNode *node, void (*del)(ZNode *)) {
+    if (node->leaf) {
+        BLeaf *leaf = (BLeaf *)node;
+        for (uint32_t i = 0; del && i < node->n; i++) {
+            del(leaf->items[i]);
+        }
+    } else {
+        BInner *in = (BInner *)node;
+        for (uint32_t i = 0; i < node->n; i++) {
+            node_clear(in->child[i], del);
+        }
+    }
+    node_free(node);
+}
+
+size_t bt_clear_some(BTree *tree, size_t budget) {
+    size_t bytes = 0;
+    for (; tree->root && budget > 0; budget--) {
+        /* down the leftmost path, to a leaf or to an inner node emptied already */
+        BInner *parent = NULL;
+        BNode *node = tree->root;
+        while (!node->leaf && node->n > 0) {
+            parent = (BInner *)node;
+            node = parent->child[0];
+        }
+        bytes += node->leaf ? sizeof(BLeaf) : sizeof(BInner);
+        node_free(node);
+        if (!parent) {
+            tree->root = NULL;
+            break;
+        }
+        /* only the children matter now */
+        parent->hdr.n--;
+        memmove(&parent->child[0], &parent->child[1], parent->hdr.n * sizeof(parent->child[0]));
+    }
+    return bytes;
+}
+
+void bt_clear(BTree *tree, void (*del)(ZNode *)) {
+    if (tree->root) {
+        node_clear(tree->root, del);
+    }
+    *tree = BTree{};
+}
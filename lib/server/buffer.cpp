@@ -7,24 +7,224 @@
  * @copyright Copyright (c) 2025
  */
 
+/* stdlib */
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* C++ */
+#include <new>
+#include <utility>
+
+/* proj */
 #include <buffer.h>
 #include <defs.h>
 
+RcStr *rcstr_new(const char *data, size_t len) {
+    RcStr *str = (RcStr *)malloc(sizeof(RcStr) + len);
+    assert(str);
+    new (&str->refs) std::atomic<uint32_t>(1);
+    str->len = (uint32_t)len;
+    memcpy(str->data, data, len);
+    return str;
+}
+
+void rcstr_unref(RcStr *str) {
+    /* NOTE: a reply may hold the last reference on another shard */
+    if (str->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free(str);
+    }
+}
+
+Buffer::Buffer(Buffer &&other) noexcept {
+    *this = std::move(other);
+}
+
+Buffer &Buffer::operator=(Buffer &&other) noexcept {
+    std::swap(mem, other.mem);
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(pos, other.pos);
+    std::swap(refs, other.refs);
+    std::swap(ref_bytes, other.ref_bytes);
+    std::swap(ref_done, other.ref_done);
+    return *this;
+}
+
+Buffer::~Buffer() {
+    for (BufRef &ref : refs) {
+        rcstr_unref(ref.str);
+    }
+}
+
+uint8_t *buf_reserve(Buffer &buf, size_t n) {
+    size_t cap = buf.mem.size();
+    if (cap - buf.tail >= n) {
+        return buf.mem.data() + buf.tail;   /* the common case */
+    }
+
+    /* move the data to the front, it's not larger than the consumed space,
+       or the storage is to be reallocated anyway */
+    size_t size = buf_size(buf);
+    if (buf.head > 0) {
+        memmove(buf.mem.data(), buf.mem.data() + buf.head, size);
+        buf.head = 0;
+        buf.tail = size;
+    }
+    if (cap - size < n) {
+        /* grow geometrically */
+        size_t new_cap = cap * 2 > size + n ? cap * 2 : size + n;
+        buf.mem.resize(new_cap);
+    }
+    return buf.mem.data() + buf.tail;
+}
+
+void buf_commit(Buffer &buf, size_t n) {
+    assert(buf.tail + n <= buf.mem.size());
+    buf.tail += n;
+}
+
+void buf_release(Buffer &buf) {
+    if (buf_total(buf) == 0 && buf.mem.size() > K_BUF_KEEP) {
+        std::vector<uint8_t>().swap(buf.mem);
+        buf.head = buf.tail = 0;
+    }
+}
+
 /* Append data to the outgoing buffer */
 void
 buf_append(Buffer &buf, const uint8_t *data, size_t len) {
-    buf.insert(buf.end(), data, data + len);
+    memcpy(buf_reserve(buf, len), data, len);
+    buf.tail += len;
 }
 
 /* Consume data from the incoming buffer */
 void buf_consume(Buffer &buf, size_t n) {
-    buf.erase(buf.begin(), buf.begin() + n);
+    assert(n <= buf_total(buf));
+    if (buf.refs.empty()) {
+        /* the common case: inline bytes only */
+        buf.head += n;
+        buf.pos += n;
+        n = 0;
+    }
+    while (n > 0) {
+        if (!buf.refs.empty() && buf.refs.front().at == buf.pos) {
+            /* a referenced string is in front */
+            BufRef &ref = buf.refs.front();
+            size_t k = ref.str->len - buf.ref_done;
+            k = k < n ? k : n;
+            buf.ref_done += k;
+            buf.ref_bytes -= k;
+            n -= k;
+            if (buf.ref_done == ref.str->len) {
+                rcstr_unref(ref.str);
+                buf.refs.pop_front();
+                buf.ref_done = 0;
+            }
+            continue;
+        }
+        /* the inline bytes up to the next reference */
+        size_t k = buf_size(buf);
+        if (!buf.refs.empty() && buf.refs.front().at - buf.pos < k) {
+            k = (size_t)(buf.refs.front().at - buf.pos);
+        }
+        k = k < n ? k : n;
+        buf.head += k;
+        buf.pos += k;
+        n -= k;
+    }
+    if (buf.head == buf.tail) {
+        buf.head = buf.tail = 0;    /* empty, restart from the front */
+    }
+}
+
+void buf_truncate(Buffer &buf, size_t size) {
+    assert(size <= buf_size(buf));
+    buf.tail = buf.head + size;
+    /* NOTE: a string referenced right at the new end is dropped too */
+    while (!buf.refs.empty() && buf.refs.back().at >= buf.pos + size
+           && (buf.refs.size() > 1 || buf.ref_done == 0)) {
+        buf.ref_bytes -= buf.refs.back().str->len;
+        rcstr_unref(buf.refs.back().str);
+        buf.refs.pop_back();
+    }
+}
+
+size_t buf_total_from(const Buffer &buf, size_t off) {
+    assert(off <= buf_size(buf));
+    size_t n = buf_size(buf) - off;
+    for (auto it = buf.refs.rbegin(); it != buf.refs.rend() && it->at >= buf.pos + off; ++it) {
+        n += it->str->len;
+    }
+    return n;
+}
+
+void buf_append_ref(Buffer &buf, RcStr *str) {
+    buf.refs.push_back(BufRef{buf.pos + buf_size(buf), rcstr_ref(str)});
+    buf.ref_bytes += str->len;
+}
+
+void buf_move(Buffer &dst, Buffer &src) {
+    if (src.refs.empty()) {
+        buf_append(dst, buf_data(src), buf_size(src));     /* the common case */
+        buf_consume(src, buf_size(src));
+        return;
+    }
+    while (buf_total(src) > 0) {
+        if (src.refs.front().at == src.pos) {
+            /* move the reference, a partially consumed one is copied */
+            BufRef &ref = src.refs.front();
+            if (src.ref_done == 0) {
+                buf_append_ref(dst, ref.str);
+            } else {
+                buf_append(dst, (const uint8_t *)ref.str->data + src.ref_done,
+                           ref.str->len - src.ref_done);
+            }
+            buf_consume(src, ref.str->len - src.ref_done);
+            continue;
+        }
+        size_t k = buf_size(src);
+        if (!src.refs.empty() && src.refs.front().at - src.pos < k) {
+            k = (size_t)(src.refs.front().at - src.pos);
+        }
+        buf_append(dst, buf_data(src), k);
+        buf_consume(src, k);
+    }
+}
+
+size_t buf_iov(const Buffer &buf, struct iovec *iov, size_t max) {
+    size_t n = 0;
+    const uint8_t *data = buf_data(buf);
+    uint64_t pos = buf.pos;     /* the stream position of `data` */
+    size_t left = buf_size(buf);
+    size_t done = buf.ref_done;
+    for (const BufRef &ref : buf.refs) {
+        if (n == max) {
+            return n;
+        }
+        if (ref.at > pos) {
+            /* the inline bytes before the reference */
+            size_t k = (size_t)(ref.at - pos);
+            iov[n++] = {(void *)data, k};
+            data += k;
+            pos += k;
+            left -= k;
+            if (n == max) {
+                return n;
+            }
+        }
+        iov[n++] = {(void *)(ref.str->data + done), ref.str->len - done};
+        done = 0;
+    }
+    if (left > 0 && n < max) {
+        iov[n++] = {(void *)data, left};
+    }
+    return n;
 }
 
 /* help functions for the serialization */
 void buf_append_u8(Buffer &buf, uint8_t data) {
-    buf.push_back(data);
+    buf_append(buf, &data, 1);
 }
 
 void buf_append_u32(Buffer &buf, uint32_t data) {
@@ -50,6 +250,15 @@ void out_str(Buffer &out, const char *s, size_t size) {
     buf_append(out, (const uint8_t *)s, size);
 }
 
+void out_rcstr(Buffer &out, RcStr *str) {
+    if (str->len < K_REF_MIN) {
+        return out_str(out, str->data, str->len);   /* copying is cheaper */
+    }
+    buf_append_u8(out, TAG_STR);
+    buf_append_u32(out, str->len);
+    buf_append_ref(out, str);
+}
+
 void out_int(Buffer &out, int64_t val) {
     buf_append_u8(out, TAG_INT);
     buf_append_i64(out, val);
@@ -73,12 +282,12 @@ void out_arr(Buffer &out, uint32_t n) {
 }
 
 size_t out_begin_arr(Buffer &out) {
-    out.push_back(TAG_ARR);
+    buf_append_u8(out, TAG_ARR);
     buf_append_u32(out, 0);     /* filled by out_end_arr() */
-    return out.size() - 4;      /* the `ctx` arg */
+    return buf_size(out) - 4;   /* the `ctx` arg, relative to the data */
 }
 
 void out_end_arr(Buffer &out, size_t ctx, uint32_t n) {
-    assert(out[ctx - 1] == TAG_ARR);
-    memcpy(&out[ctx], &n, 4);
+    assert(buf_data(out)[ctx - 1] == TAG_ARR);
+    memcpy(buf_data(out) + ctx, &n, 4);
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+/**
+ * @file ./lib/server/command.cpp
+ * @brief the command table and the dispatch by name
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-08
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <stdio.h>
+#include <string.h>
+
+/* proj */
+#include <command.h>
+#include <key_value.h>
+#include <log.h>
+#include <global.h>
+#include <HashTable.h>
+#include <slab.h>
+#include <lazyfree.h>
+
+/* loglevel [debug|info|warn|error] */
+static void do_loglevel(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (cmd.size() > 2) {
+        return out_err(out, ERR_BAD_ARG, "wrong number of arguments.");
+    }
+    if (cmd.size() == 2) {
+        int32_t level = log_level_parse(cmd[1].data(), cmd[1].size());
+        if (level < 0) {
+            return out_err(out, ERR_BAD_ARG, "expect debug|info|warn|error");
+        }
+        g_log_level.store(level, std::memory_order_relaxed);
+    }
+    const char *name = log_level_name((LogLevel)g_log_level.load(std::memory_order_relaxed));
+    return out_str(out, name, strlen(name));
+}
+
+static void stat_int(Buffer &out, uint32_t *n, const char *name, uint64_t val) {
+    out_str(out, name, strlen(name));
+    out_int(out, (int64_t)val);
+    *n += 2;
+}
+
+/* stats: (name, value) pairs of each shard, starting with `shard` */
+static void do_stats(std::vector<std::string_view> &, Buffer &out) {
+    size_t ctx = out_begin_arr(out);
+    uint32_t n = 0;
+    HMap *db = &g_data.db;
+    const RehashStats &rs = hm_rehash_stats();
+    stat_int(out, &n, "shard", g_data.shard);
+    stat_int(out, &n, "keys", hm_size(db));
+    stat_int(out, &n, "db_slots", hm_slots(db));
+    /* a migration in progress: the slots of the older table, and how far it is */
+    stat_int(out, &n, "db_older_slots", hm_older_slots(db));
+    stat_int(out, &n, "db_migrate_pos", hm_older_slots(db) ? db->migrate_pos : 0);
+    stat_int(out, &n, "rehash_maps", hm_rehash_maps());
+    stat_int(out, &n, "rehash_runs", rs.runs);
+    stat_int(out, &n, "rehash_usec", rs.usec);
+    stat_int(out, &n, "rehash_groups", rs.groups);
+    /* the large values deleted: the ones left, the ones freed and how fast */
+    const LazyStats &ls = lazy_free_stats();
+    stat_int(out, &n, "lazy_free_queue", ls.queued.load(std::memory_order_relaxed));
+    stat_int(out, &n, "lazy_free_items", ls.items.load(std::memory_order_relaxed));
+    stat_int(out, &n, "lazy_free_bytes", ls.bytes.load(std::memory_order_relaxed));
+    stat_int(out, &n, "lazy_free_bytes_per_sec", lazy_free_rate());
+    /* the occupancy of each size class: used / cap objects, in pages */
+    SlabStats slabs[64];
+    size_t nslabs = slab_stats(slabs, sizeof(slabs) / sizeof(slabs[0]));
+    for (size_t i = 0; i < nslabs; i++) {
+        const char *fields[3] = {"pages", "used", "cap"};
+        uint64_t vals[3] = {slabs[i].pages, slabs[i].used, slabs[i].cap};
+        for (size_t j = 0; j < 3; j++) {
+            char name[32];
+            snprintf(name, sizeof(name), "slab_%u_%s", slabs[i].size, fields[j]);
+            stat_int(out, &n, name, vals[j]);
+        }
+    }
+    out_end_arr(out, ctx, n);
+}
+
+/* the index of each command in g_cmds[], picked by cmd_lookup() */
+enum {
+    C_GET, C_SET, C_DEL, C_PEXPIRE, C_PTTL, C_KEYS,
+    C_ZADD, C_ZREM, C_ZSCORE, C_ZQUERY, C_LOGLEVEL, C_STATS,
+    C_SCAN, C_ZSCAN, C_INCR, C_INCRBY, C_DECRBY,
+    C_ZRANK, C_ZREVRANK, C_ZRANGEBYSCORE, C_ZREVRANGE,
+    C_ZCOUNT, C_ZSUM, C_ZQUANTILE, C_ZUNIONSTORE, C_ZINTERSTORE,
+    C_COUNT
+};
+
+/* NOTE: keep in sync with the enum above and the switch in cmd_lookup() */
+const CmdDesc g_cmds[] = {
+    /* name     handler     open        arity flags                 keys */
+    {"get",     do_get,     NULL,       2,  CMD_READ,               1, 1, 1},
+    {"set",     do_set,     NULL,       3,  CMD_WRITE,              1, 1, 1},
+    {"del",     do_del,     NULL,       2,  CMD_WRITE,              1, 1, 1},
+    {"pexpire", do_expire,  NULL,       3,  CMD_WRITE,              1, 1, 1},
+    {"pttl",    do_ttl,     NULL,       2,  CMD_READ,               1, 1, 1},
+    {"keys",    NULL,       open_keys,  1,  CMD_READ | CMD_ALL,     0, 0, 0},
+    {"zadd",    do_zadd,    NULL,       -4, CMD_WRITE,              1, 1, 1},
+    {"zrem",    do_zrem,    NULL,       3,  CMD_WRITE,              1, 1, 1},
+    {"zscore",  do_zscore,  NULL,       3,  CMD_READ,               1, 1, 1},
+    {"zquery",  NULL,       open_zquery, 6, CMD_READ,               1, 1, 1},
+    {"loglevel", do_loglevel, NULL,     -1, 0,                      0, 0, 0},
+    {"stats",   do_stats,   NULL,       1,  CMD_ALL,                0, 0, 0},
+    {"scan",    do_scan,    NULL,       -2, CMD_READ | CMD_CURSOR,  0, 0, 0},
+    {"zscan",   do_zscan,   NULL,       -3, CMD_READ,               1, 1, 1},
+    {"incr",    do_incrby,  NULL,       2,  CMD_WRITE,              1, 1, 1},
+    {"incrby",  do_incrby,  NULL,       3,  CMD_WRITE,              1, 1, 1},
+    {"decrby",  do_decrby,  NULL,       3,  CMD_WRITE,              1, 1, 1},
+    {"zrank",   do_zrank,   NULL,       3,  CMD_READ,               1, 1, 1},
+    {"zrevrank", do_zrevrank, NULL,    3,  CMD_READ,               1, 1, 1},
+    {"zrangebyscore", NULL, open_zrangebyscore, -4, CMD_READ,       1, 1, 1},
+    {"zrevrange", NULL,     open_zrevrange, 4, CMD_READ,            1, 1, 1},
+    {"zcount",  do_zcount,  NULL,       4,  CMD_READ,               1, 1, 1},
+    {"zsum",    do_zsum,    NULL,       4,  CMD_READ,               1, 1, 1},
+    {"zquantile", do_zquantile, NULL,   -3, CMD_READ,               1, 1, 1},
+    /* dst numkeys key...: the inputs must be on the shard of dst */
+    {"zunionstore", do_zunionstore, NULL, -4, CMD_WRITE | CMD_ASYNC | CMD_NUMKEYS, 1, 1, 1},
+    {"zinterstore", do_zinterstore, NULL, -4, CMD_WRITE | CMD_ASYNC | CMD_NUMKEYS, 1, 1, 1},
+};
+
+const size_t g_ncmds = sizeof(g_cmds) / sizeof(g_cmds[0]);
+static_assert(sizeof(g_cmds) / sizeof(g_cmds[0]) == C_COUNT, "a command is missing in g_cmds[] or the enum");
+
+
+/* the candidate is picked by the length and the first byte, one memcmp() confirms it */
+const CmdDesc *cmd_lookup(std::string_view name) {
+    int idx = -1;
+    switch (name.size()) {
+    case 3:
+        switch (name[0]) {
+        case 'g': idx = C_GET; break;
+        case 's': idx = C_SET; break;
+        case 'd': idx = C_DEL; break;
+        }
+        break;
+    case 4:
+        switch (name[0]) {
+        case 'p': idx = C_PTTL; break;
+        case 'k': idx = C_KEYS; break;
+        case 's': idx = C_SCAN; break;
+        case 'i': idx = C_INCR; break;
+        case 'z':
+            switch (name[1]) {
+            case 'a': idx = C_ZADD; break;
+            case 'r': idx = C_ZREM; break;
+            case 's': idx = C_ZSUM; break;
+            }
+            break;
+        }
+        break;
+    case 5:
+        switch (name[0]) {
+        case 's': idx = C_STATS; break;
+        case 'z': idx = name[1] == 's' ? C_ZSCAN : C_ZRANK; break;
+        }
+        break;
+    case 6:
+        switch (name[0]) {
+        case 'z':
+            switch (name[1]) {
+            case 's': idx = C_ZSCORE; break;
+            case 'q': idx = C_ZQUERY; break;
+            case 'c': idx = C_ZCOUNT; break;
+            }
+            break;
+        case 'i': idx = C_INCRBY; break;
+        case 'd': idx = C_DECRBY; break;
+        }
+        break;
+    case 7:
+        if (name[0] == 'p') {
+            idx = C_PEXPIRE;
+        }
+        break;
+    case 8:
+        switch (name[0]) {
+        case 'l': idx = C_LOGLEVEL; break;
+        case 'z': idx = C_ZREVRANK; break;
+        }
+        break;
+    case 9:
+        if (name[0] == 'z') {
+            idx = name[1] == 'q' ? C_ZQUANTILE : C_ZREVRANGE;
+        }
+        break;
+    case 11:
+        if (name[0] == 'z') {
+            idx = name[1] == 'u' ? C_ZUNIONSTORE : C_ZINTERSTORE;
+        }
+        break;
+    case 13:
+        if (name[0] == 'z') {
+            idx = C_ZRANGEBYSCORE;
+        }
+        break;
+    }
+
+    if (idx < 0 || memcmp(g_cmds[idx].name, name.data(), name.size()) != 0) {
+        return NULL;
+    }
+    return &g_cmds[idx];
+}
@@ -0,0 +1,168 @@
+/**
+ * @file ./lib/server/config.cpp
+ * @brief server options parsed from the command line
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-03
+ * @copyright Copyright (c) 2025
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <config.h>
+#include <err_pack.h>
+
+Config g_config;
+
+static void usage(const char *prog) {
+    msgf("usage: %s [--port N] [--io epoll|uring] [--shards N] [--threads N]\n"
+         "          [--log-level debug|info|warn|error] [--max-msg BYTES]\n"
+         "          [--zset-index avl|btree] [--zset-listpack-entries N]\n"
+         "          [--zset-listpack-value BYTES] [--lazy-free loop|pool]\n"
+         "          [--lazy-free-min COST]\n", prog);
+}
+
+/* a whole decimal number in [0, max], no sign or spaces */
+static bool parse_uint(const char *s, uint64_t max, uint64_t *out) {
+    if (!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+    char *end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (*end != '\0' || errno == ERANGE || n > max) {
+        return false;
+    }
+    *out = (uint64_t)n;
+    return true;
+}
+
+int32_t config_parse(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        {"port",    required_argument,  NULL,   'p'},
+        {"io",      required_argument,  NULL,   'i'},
+        {"shards",  required_argument,  NULL,   's'},
+        {"threads", required_argument,  NULL,   't'},
+        {"log-level", required_argument, NULL,  'l'},
+        {"max-msg", required_argument,  NULL,   'm'},
+        {"zset-index", required_argument, NULL, 'z'},
+        {"zset-listpack-entries", required_argument, NULL, 'E'},
+        {"zset-listpack-value", required_argument, NULL, 'V'},
+        {"lazy-free", required_argument, NULL,  'f'},
+        {"lazy-free-min", required_argument, NULL, 'F'},
+        {NULL,      0,                  NULL,   0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "p:i:s:t:l:m:z:E:V:f:F:", opts, NULL)) != -1) {
+        switch (c) {
+        case 'p':
+            g_config.port = atoi(optarg);
+            if (g_config.port <= 0 || g_config.port > 65535) {
+                msgf("bad port: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'i':
+            if (strcmp(optarg, "epoll") == 0) {
+                g_config.io = IO_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                g_config.io = IO_URING;
+            } else {
+                msgf("bad I/O backend: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 's':
+            g_config.shards = (uint32_t)atoi(optarg);
+            if (g_config.shards < 1 || g_config.shards > K_MAX_SHARDS) {
+                msgf("bad number of shards: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            g_config.threads = (size_t)strtoull(optarg, NULL, 10);
+            if (g_config.threads < 1 || g_config.threads > K_POOL_MAX_THREADS) {
+                msgf("bad number of threads: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'l': {
+            int32_t level = log_level_parse(optarg, strlen(optarg));
+            if (level < 0) {
+                msgf("bad log level: %s\n", optarg);
+                return -1;
+            }
+            g_config.log_level = (LogLevel)level;
+            break;
+        }
+        case 'm':
+            g_config.max_msg = (size_t)strtoull(optarg, NULL, 10);
+            if (g_config.max_msg < 4096 || g_config.max_msg > K_MAX_MSG_LIMIT) {
+                msgf("bad max message size: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'z':
+            if (strcmp(optarg, "avl") == 0) {
+                g_config.zset_index = Z_AVL;
+            } else if (strcmp(optarg, "btree") == 0) {
+                g_config.zset_index = Z_BTREE;
+            } else {
+                msgf("bad zset index: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'E': {
+            uint64_t n = 0;
+            if (!parse_uint(optarg, K_ZSET_LP_ENTRIES_MAX, &n)) {
+                msgf("bad zset listpack entries: %s\n", optarg);
+                return -1;
+            }
+            g_config.zset_lp_entries = (uint32_t)n;
+            break;
+        }
+        case 'V': {
+            uint64_t n = 0;
+            if (!parse_uint(optarg, 255, &n)) {
+                msgf("bad zset listpack value: %s\n", optarg);
+                return -1;
+            }
+            g_config.zset_lp_value = (size_t)n;
+            break;
+        }
+        case 'f':
+            if (strcmp(optarg, "loop") == 0) {
+                g_config.lazy_free = LAZY_LOOP;
+            } else if (strcmp(optarg, "pool") == 0) {
+                g_config.lazy_free = LAZY_POOL;
+            } else {
+                msgf("bad lazy free mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'F': {
+            uint64_t n = 0;
+            if (!parse_uint(optarg, SIZE_MAX, &n)) {
+                msgf("bad lazy free min: %s\n", optarg);
+                return -1;
+            }
+            g_config.lazy_free_min = (size_t)n;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
@@ -19,18 +19,54 @@
 /* system */
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+/* C++ */
+#include <new>      /* placement new */
 
 /* proj */
 #include <conn.h>
 #include <err_pack.h>
+#include <log.h>
 #include <utils.h>
 #include <defs.h>
 #include <response.h>
 #include <HashTable.h>
 #include <timer.h>
 #include <global.h>
+#include <shard.h>
+#include <config.h>
+#include <slab.h>
+
+/* create a `struct Conn` for an accepted socket, shared by the I/O backends */
+Conn *conn_new(int connfd) {
+    /* set the new connection fd to nonblocking mode */
+    fd_set_nb(connfd);
+    /* replies are written as soon as they are ready */
+    int val = 1;
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+    Conn *conn = new (slab_alloc(sizeof(Conn))) Conn();
+    conn->fd = connfd;
+    conn->id = ++g_data.next_conn_id;
+    conn->want_read = true;
+    conn->last_active_ms = get_monotonic_msec();
+    dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+
+    /* put it into the map */
+    if (g_data.fd2conn.size() <= (size_t)conn->fd) {
+        g_data.fd2conn.resize(conn->fd + 1);
+    }
+    assert(!g_data.fd2conn[conn->fd]);
+    g_data.fd2conn[conn->fd] = conn;
+    LOG_DEBUG("conn %llu, fd=%d, fd2conn.size(): %zu",
+        (unsigned long long)conn->id, connfd, g_data.fd2conn.size());
+    return conn;
+}
 
 /* application callback when the listening socket is ready */
 int32_t handle_accept(int fd) {
@@ -38,70 +74,102 @@ int32_t handle_accept(int fd) {
     struct sockaddr_in client_addr = {};
     socklen_t socklen = sizeof(client_addr);
     int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
+    if (connfd < 0 && errno == EAGAIN) {
+        return -1;  /* no more pending connections */
+    }
     if (connfd < 0) {
-        msg_errno("accept() error");
+        LOG_WARN("[errno:%d] accept() error", errno);
         return -1;
     }
 
     uint32_t ip = client_addr.sin_addr.s_addr;
-    stream_printf(stderr, "new client from %u.%u.%u.%u:%u\n",
+    LOG_DEBUG("new client from %u.%u.%u.%u:%u",
         ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, ip >> 24,
         ntohs(client_addr.sin_port)
     );
 
-    /* set the new connection fd to nonblocking mode */
-    fd_set_nb(connfd);
-
-    /* create a `struct Conn` */
-    Conn *conn = new Conn();
-    conn->fd = connfd;
-    conn->want_read = true;
-    conn->last_active_ms = get_monotonic_msec();
-    dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+    Conn *conn = conn_new(connfd);
 
-    /* put it into the map */
-    if (g_data.fd2conn.size() <= (size_t)conn->fd) {
-        g_data.fd2conn.resize(conn->fd + 1);
+    /* register the interest once, it's only updated when the intention changes */
+    conn_update_events(conn);
+    if (conn->want_close) {
+        conn_destroy(conn);
+        return -1;
     }
-    assert(!g_data.fd2conn[conn->fd]);
-    g_data.fd2conn[conn->fd] = conn;
-    printf("g_data.fd2conn.size(): %zu\n", g_data.fd2conn.size());
     return 0;
 }
 
+/* whether the requests wait for the replies in front of them */
+static bool requests_blocked(Conn *conn) {
+    if (conn->replies.size() >= K_MAX_REPLIES) {
+        return true;    /* too many replies from other shards are pending */
+    }
+    if (conn->stream) {
+        return true;    /* the streamed reply goes first */
+    }
+    /* a deferred command goes first, see shard_defer() */
+    return !conn->replies.empty() && conn->replies.back().barrier && conn->replies.back().pending;
+}
+
+/* whether `incoming` holds a whole request */
+static bool request_buffered(Conn *conn) {
+    uint32_t len = 0;
+    if (buf_size(conn->incoming) < 4) {
+        return false;
+    }
+    memcpy(&len, buf_data(conn->incoming), 4);
+    return 4 + (size_t)len <= buf_size(conn->incoming);
+}
+
 /* process 1 request if there is enough data */
 bool try_one_request(Conn *conn) {
+    if (requests_blocked(conn)) {
+        return false;
+    }
+
     /* try to parse the protocol: message header */
-    if (conn->incoming.size() < 4) {
+    if (buf_size(conn->incoming) < 4) {
         return false;   /* want read */
     }
 
     uint32_t len = 0;
-    memcpy(&len, conn->incoming.data(), 4);
-    if (len > K_MAX_MSG) {
-        msgf("too long, len=%u\n", len);
+    memcpy(&len, buf_data(conn->incoming), 4);
+    if (len > g_config.max_msg) {
+        LOG_WARN("too long, len=%u", len);
         conn->want_close = true;
         return false;   /* want close */
     }
 
     /* message body */
-    if (4 + len > conn->incoming.size()) {
+    if (4 + (size_t)len > buf_size(conn->incoming)) {
+        /*
+         * a large body is read in place, the room grows with the bytes that
+         * came in, so a header alone can't make a connection hold `max_msg`
+         */
+        size_t missing = 4 + (size_t)len - buf_size(conn->incoming);
+        size_t room = buf_size(conn->incoming) > K_BODY_CHUNK ? buf_size(conn->incoming) : K_BODY_CHUNK;
+        buf_reserve(conn->incoming, missing < room ? missing : room);
         return false;   /* want read */
     }
 
-    const uint8_t *request = &conn->incoming[4];
+    const uint8_t *request = buf_data(conn->incoming) + 4;
 
     /* got one request, do some application logic */
-    std::vector<std::string> cmd;
+    std::vector<std::string_view> &cmd = conn->args;
     if (parse_req(request, len, cmd) < 0) {
-        msg("bad request");
+        LOG_WARN("bad request");
         conn->want_close = true;
         return false;   /* want close */
     }
-    size_t header_pos = 0;
-    response_begin(conn->outgoing, &header_pos);
-    do_request(cmd, conn->outgoing);
-    response_end(conn->outgoing, header_pos);
+
+    /* the key is owned by another shard, replies from other shards are in front, or it may be deferred */
+    if (!shard_is_local(cmd) || !conn->replies.empty()) {
+        shard_queue(conn, cmd, request, len);
+        buf_consume(conn->incoming, 4 + len);
+        return true;
+    }
+
+    conn->stream = do_request_stream(cmd, conn->outgoing);
 
     /* application logic done! remove the request message. */
     buf_consume(conn->incoming, 4 + len);
@@ -109,15 +177,10 @@ bool try_one_request(Conn *conn) {
     return true; /* success */
 }
 
-/* application callback when the socket is writable */
-void handle_write(Conn *conn) {
-    assert(conn->outgoing.size() > 0);
-    ssize_t rv = write(conn->fd, &conn->outgoing[0], conn->outgoing.size());
-    if (rv < 0 && errno == EAGAIN) {
-        return; /* actually not ready */
-    }
+/* account for the result of a write, shared by the I/O backends */
+void handle_write_done(Conn *conn, ssize_t rv) {
     if (rv < 0) {
-        msg_errno("write() error");
+        LOG_WARN("[errno:%d] write() error", errno);
         conn->want_close = true;    /* error handling */
         return;
     }
@@ -126,59 +189,162 @@ void handle_write(Conn *conn) {
     buf_consume(conn->outgoing, (size_t)rv);
 
     /* update the readiness intention */
-    if (conn->outgoing.size() == 0) {   /* all data written */
+    if (buf_total(conn->outgoing) == 0) {  /* all data written */
         conn->want_read = true;
         conn->want_write = false;
+        /* requests may be left behind the replies from other shards */
+        handle_requests(conn);
     } /* else: want write */
 }
 
-/* application callback when the socket is readable */
-void handle_read(Conn *conn) {
-    /* read some data */
-    uint8_t buf[64 * 1024];
-    ssize_t rv = read(conn->fd, buf, sizeof(buf));
-    if (rv < 0 && errno == EAGAIN) {
-        return; /* actually not ready */
+/* process the buffered requests */
+void handle_requests(Conn *conn) {
+    /* the replies from other shards go first */
+    if (!conn->replies.empty()) {
+        shard_flush(conn);
+    }
+    /* the next chunk of a streamed reply, once the previous one is sent */
+    if (conn->stream && buf_total(conn->outgoing) == 0) {
+        if (!response_stream_next(conn->stream, conn->outgoing)) {
+            conn->stream->del(conn->stream);
+            conn->stream = NULL;
+        }
+    }
+
+    /* parse requests and generate responses */
+    while (try_one_request(conn)) {}
+    /* NOTE: Q Why calling this in a loop? See the explanation of "pipelining". */
+    buf_release(conn->incoming);
+    /* the replies queued behind a command that was not deferred after all */
+    if (!conn->replies.empty()) {
+        shard_flush(conn);
     }
 
+    /* update the readiness intention */
+    if (buf_total(conn->outgoing) > 0) {   /* has a response */
+        conn->want_read = false;
+        conn->want_write = true;
+    } else if (requests_blocked(conn) && request_buffered(conn)) {
+        /* no more reading until the replies in front come back, see shard_process_inbox() */
+        conn->want_read = false;
+    } else {
+        conn->want_read = true;
+    }
+}
+
+/* account for the result of a read, shared by the I/O backends */
+void handle_read_done(Conn *conn, ssize_t rv) {
     /* handle IO error */
     if (rv < 0) {
-        msg_errno("read() error");
+        LOG_WARN("[errno:%d] read() error", errno);
         conn->want_close = true;
         return; /* want close */
     }
 
     /* handle EOF */
     if (rv == 0) {
-        if (conn->incoming.size() == 0) {
-            msg("client closed");
+        if (buf_size(conn->incoming) == 0) {
+            LOG_DEBUG("client closed");
         } else {
-            msg("unexpected EOF");
+            LOG_INFO("unexpected EOF");
         }
         conn->want_close = true;
         return; /* want close */
     }
 
-    /* got some new data */
-    buf_append(conn->incoming, buf, (size_t)rv);
+    /* got some new data, it's in `incoming` already */
+    handle_requests(conn);
+}
 
-    /* parse requests and generate responses */
-    while (try_one_request(conn)) {}
-    /* NOTE: Q Why calling this in a loop? See the explanation of "pipelining". */
+/* application callback when the socket is writable */
+void handle_write(Conn *conn) {
+    assert(buf_total(conn->outgoing) > 0);
+    /* edge-triggered: write until the socket is full or nothing is left */
+    while (conn->want_write && !conn->want_close) {
+        ssize_t rv = 0;
+        if (conn->outgoing.refs.empty()) {
+            rv = write(conn->fd, buf_data(conn->outgoing), buf_size(conn->outgoing));
+        } else {
+            /* the inline bytes and the referenced values */
+            struct iovec iov[K_MAX_IOV];
+            size_t n = buf_iov(conn->outgoing, iov, K_MAX_IOV);
+            rv = writev(conn->fd, iov, (int)n);
+        }
+        if (rv < 0 && errno == EAGAIN) {
+            return; /* actually not ready */
+        }
+        handle_write_done(conn, rv);
+    }
+}
 
-    /* update the readiness intention */
-    if (conn->outgoing.size() > 0) {    /* has a response */
-        conn->want_read = false;
-        conn->want_write = true;
-        /* The socket is likely ready to write in a request-response protocol,
-           try to write it without waiting for the next iteration. */
-        return handle_write(conn);
-    }   /* else: want read */
+/* application callback when the socket is readable */
+void handle_read(Conn *conn) {
+    /* edge-triggered: read until EAGAIN or the application stops reading */
+    while (conn->want_read && !conn->want_close) {
+        /* read some data into the back of `incoming` */
+        Buffer &in = conn->incoming;
+        buf_reserve(in, K_READ_SIZE);
+        ssize_t rv = read(conn->fd, in.mem.data() + in.tail, in.mem.size() - in.tail);
+        if (rv < 0 && errno == EAGAIN) {
+            return; /* actually not ready */
+        }
+        if (rv > 0) {
+            buf_commit(in, (size_t)rv);
+        }
+        handle_read_done(conn, rv);
+
+        if (conn->want_write && !conn->want_close) {
+            /* The socket is likely ready to write in a request-response protocol,
+               try to write it without waiting for the next iteration. */
+            handle_write(conn);
+        }
+    }
+}
+
+/* sync the epoll interest with the application's intention */
+void conn_update_events(Conn *conn) {
+    uint32_t events = EPOLLET;
+    if (conn->want_read) {
+        events |= EPOLLIN;
+    }
+    if (conn->want_write) {
+        events |= EPOLLOUT;
+    }
+    if (events == conn->events) {
+        return; /* unchanged, no syscall */
+    }
+
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = conn->fd;
+    /* NOTE: EPOLL_CTL_MOD rechecks the readiness, so no edge is lost */
+    int op = conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(g_data.epfd, op, conn->fd, &ev) < 0) {
+        LOG_ERROR("[errno:%d] epoll_ctl() error", errno);
+        conn->want_close = true;
+        return;
+    }
+    conn->events = events;
 }
 
 void conn_destroy(Conn *conn) {
-    (void)close(conn->fd);
+    /* terminate the I/O still in flight on io_uring */
+    (void)shutdown(conn->fd, SHUT_RDWR);
+    (void)close(conn->fd);     /* also removes it from the epoll set */
     g_data.fd2conn[conn->fd] = NULL;
     dlist_detach(&conn->idle_node);
-    delete conn;
+    conn->fd = -1;
+    if (conn->stream) {
+        conn->stream->del(conn->stream);
+        conn->stream = NULL;
+    }
+    if (conn->inflight) {
+        return; /* freed by the io_uring loop when the operations complete */
+    }
+    conn_free(conn);
+}
+
+void conn_free(Conn *conn) {
+    conn->~Conn();
+    slab_free(conn, sizeof(Conn));
 }
@@ -0,0 +1,140 @@
+/**
+ * @file ./lib/server/ev_epoll.cpp
+ * @brief the edge-triggered epoll event loop
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-03
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <unistd.h>
+
+/* system */
+#include <sys/epoll.h>
+
+/* C++ */
+#include <vector>
+
+/* proj */
+#include <event_loop.h>
+#include <conn.h>
+#include <err_pack.h>
+#include <timer.h>
+#include <global.h>
+#include <defs.h>
+#include <shard.h>
+
+/* the connections got their replies from other shards, or from the thread pool */
+static void epoll_wake() {
+    uint64_t cnt = 0;
+    ssize_t rv = read(g_data.wake_fd, &cnt, sizeof(cnt));
+    (void)rv;
+
+    std::vector<Conn *> resumed;
+    shard_process_inbox(resumed);
+    for (Conn *conn : resumed) {
+        handle_requests(conn);
+        if (conn->want_write && !conn->want_close) {
+            handle_write(conn);
+        }
+        if (!conn->want_close) {
+            conn_update_events(conn);
+        }
+        if (conn->want_close) {
+            conn_destroy(conn);
+        }
+    }
+}
+
+void epoll_loop(int fd) {
+    g_data.epfd = epoll_create1(0);
+    if (g_data.epfd < 0) {
+        die("epoll_create1()");
+    }
+
+    /* the listening socket stays level-triggered */
+    struct epoll_event lev = {};
+    lev.events = EPOLLIN;
+    lev.data.fd = fd;
+    if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, fd, &lev) < 0) {
+        die("epoll_ctl()");
+    }
+
+    /* the wake up of the cross-shard messages */
+    if (g_data.wake_fd >= 0) {
+        struct epoll_event wev = {};
+        wev.events = EPOLLIN;
+        wev.data.fd = g_data.wake_fd;
+        if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, g_data.wake_fd, &wev) < 0) {
+            die("epoll_ctl()");
+        }
+    }
+
+    /* connections are registered by handle_accept(), only ready ones are visited */
+    std::vector<struct epoll_event> events(K_MAX_EVENTS);
+
+    while (!shards_stopping()) {
+        /* wait for readiness */
+        int32_t timeout_ms = next_timer_ms();
+        int rv = epoll_wait(g_data.epfd, events.data(), (int)events.size(), timeout_ms);
+        if (rv < 0 && errno == EINTR) {
+            continue;   /* not an error */
+        }
+        if (rv < 0) {
+            die("epoll_wait()");
+        }
+
+        for (int i = 0; i < rv; ++i) {
+            int ready_fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+
+            /* handle the listening socket */
+            if (ready_fd == fd) {
+                while (handle_accept(fd) == 0) {}
+                continue;
+            }
+
+            /* handle the messages from other shards */
+            if (ready_fd == g_data.wake_fd) {
+                epoll_wake();
+                continue;
+            }
+
+            /* handle connected sockets */
+            Conn *conn = g_data.fd2conn[ready_fd];
+            if (!conn) {
+                continue;   /* closed earlier in this batch */
+            }
+
+            /* update the idle timer by moving conn to the end of the list */
+            conn->last_active_ms = get_monotonic_msec();
+            dlist_detach(&conn->idle_node);
+            dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+
+            /* handle IO */
+            if ((ready & EPOLLIN) && conn->want_read) {
+                handle_read(conn);  /* application logic */
+            }
+            if ((ready & EPOLLOUT) && conn->want_write) {
+                handle_write(conn); /* application logic */
+            }
+
+            /* update the interest only if the intention changed */
+            if (!conn->want_close) {
+                conn_update_events(conn);
+            }
+
+            /* close the socket from socket error or application logic */
+            if ((ready & EPOLLERR) || conn->want_close) {
+                conn_destroy(conn);
+            }
+        } /* for each ready socket */
+
+        /* handle timers */
+        process_timers();
+        process_background(rv == 0);
+    } /* the event loop */
+
+    close(g_data.epfd);
+}
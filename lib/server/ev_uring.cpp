@@ -0,0 +1,389 @@
+/**
+ * @file ./lib/server/ev_uring.cpp
+ * @brief the io_uring event loop
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-03
+ * @copyright Copyright (c) 2025
+ *
+ * @details The rings are driven through the raw syscalls. The listening socket
+ * uses a multishot accept, connections receive into a provided buffer ring
+ * (no per-connection read buffer), and all the reads and writes queued while
+ * processing a batch of completions are submitted by a single io_uring_enter().
+ */
+
+/* stdlib */
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* system */
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* proj */
+#include <event_loop.h>
+#include <conn.h>
+#include <err_pack.h>
+#include <log.h>
+#include <timer.h>
+#include <global.h>
+#include <defs.h>
+#include <shard.h>
+
+/* operations, tagged in the low bits of the user_data (a `Conn *`) */
+enum {
+    OP_ACCEPT   = 1,
+    OP_RECV     = 2,
+    OP_SEND     = 4,
+    OP_WAKE     = 8,
+    OP_MASK     = 15,
+};
+
+/* the group id of the provided buffer ring */
+#define BUF_GROUP 0
+
+struct Uring {
+    int fd = -1;
+    /* submission queue */
+    unsigned *sq_head = NULL;
+    unsigned *sq_tail = NULL;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned *sq_array = NULL;
+    struct io_uring_sqe *sqes = NULL;
+    unsigned to_submit = 0;     /* queued since the last io_uring_enter() */
+    /* completion queue */
+    unsigned *cq_head = NULL;
+    unsigned *cq_tail = NULL;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe *cqes = NULL;
+    /* the provided buffer ring */
+    struct io_uring_buf_ring *br = NULL;
+    uint8_t *bufs = NULL;
+    uint16_t br_tail = 0;
+};
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                           unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned op, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/* give a receive buffer back to the kernel */
+static void br_recycle(Uring *ring, uint16_t bid) {
+    /* NOTE: `br->bufs` is misplaced by __DECLARE_FLEX_ARRAY in C++, the ring starts at `br` */
+    struct io_uring_buf *buf = (struct io_uring_buf *)ring->br + (ring->br_tail & (K_URING_BUFS - 1));
+    buf->addr = (uint64_t)(ring->bufs + bid * K_URING_BUF_SIZE);
+    buf->len = (uint32_t)K_URING_BUF_SIZE;
+    buf->bid = bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+static bool br_init(Uring *ring) {
+    size_t ring_sz = K_URING_BUFS * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    ring->br = (struct io_uring_buf_ring *)mem;
+
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)mem;
+    reg.ring_entries = K_URING_BUFS;
+    reg.bgid = BUF_GROUP;
+    if (sys_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;   /* needs Linux 5.19 */
+    }
+
+    ring->bufs = (uint8_t *)malloc(K_URING_BUFS * K_URING_BUF_SIZE);
+    if (!ring->bufs) {
+        return false;
+    }
+    for (unsigned i = 0; i < K_URING_BUFS; ++i) {
+        br_recycle(ring, (uint16_t)i);
+    }
+    return true;
+}
+
+static bool uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params p = {};
+    /* only this thread submits, and completions are reaped in io_uring_enter() */
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = sys_uring_setup(entries, &p);
+    if (ring->fd < 0 && errno == EINVAL) {
+        p = io_uring_params{};  /* older kernels */
+        ring->fd = sys_uring_setup(entries, &p);
+    }
+    if (ring->fd < 0) {
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        return false;   /* needs Linux 5.11 */
+    }
+
+    /* the SQ and CQ rings share one mapping */
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+    uint8_t *mem = (uint8_t *)mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    ring->sq_head = (unsigned *)(mem + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(mem + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(mem + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_array = (unsigned *)(mem + p.sq_off.array);
+    ring->cq_head = (unsigned *)(mem + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(mem + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(mem + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(mem + p.cq_off.cqes);
+
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    return br_init(ring);
+}
+
+/* submit the queued SQEs and wait for at least `min_complete` CQEs */
+static int32_t uring_enter(Uring *ring, unsigned min_complete, uint32_t timeout_ms) {
+    struct __kernel_timespec ts = {};
+    struct io_uring_getevents_arg arg = {};
+    if (timeout_ms != (uint32_t)-1) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000 * 1000;
+        arg.ts = (uint64_t)&ts;
+    }
+    int rv = sys_uring_enter(ring->fd, ring->to_submit, min_complete,
+                             IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                             &arg, sizeof(arg));
+    if (rv < 0) {
+        return (errno == ETIME || errno == EINTR || errno == EBUSY) ? 0 : -1;
+    }
+    ring->to_submit -= (unsigned)rv;
+    return 0;
+}
+
+/* queue an SQE, flush the SQ first if it's full */
+static void uring_push(Uring *ring, const struct io_uring_sqe &sqe) {
+    unsigned tail = *ring->sq_tail;
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_enter(ring, 0, 0) < 0) {
+            die("io_uring_enter()");
+        }
+    }
+    unsigned idx = tail & ring->sq_mask;
+    ring->sqes[idx] = sqe;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static void prep_accept(Uring *ring, int listen_fd) {
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = listen_fd;
+    sqe.ioprio = IORING_ACCEPT_MULTISHOT;   /* one SQE for all the connections */
+    sqe.user_data = OP_ACCEPT;
+    uring_push(ring, sqe);
+}
+
+static void prep_wake(Uring *ring) {
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = g_data.wake_fd;
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = OP_WAKE;
+    uring_push(ring, sqe);
+}
+
+static void prep_recv(Uring *ring, Conn *conn) {
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = conn->fd;
+    sqe.flags = IOSQE_BUFFER_SELECT;        /* the kernel picks a buffer */
+    sqe.buf_group = BUF_GROUP;
+    sqe.user_data = (uint64_t)conn | OP_RECV;
+    uring_push(ring, sqe);
+    conn->inflight |= OP_RECV;
+}
+
+static void prep_send(Uring *ring, Conn *conn) {
+    struct io_uring_sqe sqe = {};
+    sqe.fd = conn->fd;
+    if (conn->outgoing.refs.empty()) {
+        sqe.opcode = IORING_OP_SEND;
+        sqe.addr = (uint64_t)buf_data(conn->outgoing);
+        sqe.len = (uint32_t)buf_size(conn->outgoing);
+    } else {
+        /* the inline bytes and the referenced values, the iovecs live in Conn */
+        conn->send_msg = {};
+        conn->send_msg.msg_iov = conn->send_iov;
+        conn->send_msg.msg_iovlen = buf_iov(conn->outgoing, conn->send_iov, K_MAX_IOV);
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.addr = (uint64_t)&conn->send_msg;
+        sqe.len = 1;
+    }
+    sqe.msg_flags = MSG_NOSIGNAL;
+    sqe.user_data = (uint64_t)conn | OP_SEND;
+    uring_push(ring, sqe);
+    conn->inflight |= OP_SEND;
+}
+
+/* queue I/O from the application's intention */
+static void uring_sync(Uring *ring, Conn *conn) {
+    if (conn->want_close) {
+        conn_destroy(conn);
+        return;
+    }
+    /* NOTE: `outgoing` is not touched while a read is wanted, so the send buffer is stable */
+    if (conn->want_read && !(conn->inflight & OP_RECV)) {
+        prep_recv(ring, conn);
+    }
+    if (conn->want_write && !(conn->inflight & OP_SEND)) {
+        prep_send(ring, conn);
+    }
+}
+
+/* the connections got their replies from other shards, or from the thread pool */
+static void uring_wake(Uring *ring) {
+    uint64_t cnt = 0;
+    ssize_t rv = read(g_data.wake_fd, &cnt, sizeof(cnt));
+    (void)rv;
+
+    std::vector<Conn *> resumed;
+    shard_process_inbox(resumed);
+    for (Conn *conn : resumed) {
+        /* NOTE: `outgoing` is pinned by a send, it's flushed when the send completes */
+        if (!(conn->inflight & OP_SEND)) {
+            handle_requests(conn);
+        }
+        uring_sync(ring, conn);
+    }
+    prep_wake(ring);
+}
+
+static void uring_complete(Uring *ring, int listen_fd, const struct io_uring_cqe *cqe) {
+    uint32_t op = (uint32_t)(cqe->user_data & OP_MASK);
+    Conn *conn = (Conn *)(cqe->user_data & ~(uint64_t)OP_MASK);
+
+    if (op == OP_ACCEPT) {
+        if (cqe->res >= 0) {
+            LOG_DEBUG("new client, fd=%d", cqe->res);
+            uring_sync(ring, conn_new(cqe->res));
+        } else {
+            errno = -cqe->res;
+            LOG_WARN("[errno:%d] accept() error", errno);
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            prep_accept(ring, listen_fd);   /* the multishot was terminated */
+        }
+        return;
+    }
+    if (op == OP_WAKE) {
+        uring_wake(ring);
+        return;
+    }
+
+    /* the received data lives in a provided buffer */
+    const uint8_t *data = NULL;
+    uint16_t bid = 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        data = ring->bufs + bid * K_URING_BUF_SIZE;
+    }
+
+    conn->inflight &= ~op;
+    if (conn->fd < 0) {
+        /* destroyed while the operation was in flight */
+        if (data) {
+            br_recycle(ring, bid);
+        }
+        if (!conn->inflight) {
+            conn_free(conn);
+        }
+        return;
+    }
+
+    if (cqe->res != -ENOBUFS && cqe->res != -EAGAIN) {  /* else: no buffer, retry */
+        /* update the idle timer by moving conn to the end of the list */
+        conn->last_active_ms = get_monotonic_msec();
+        dlist_detach(&conn->idle_node);
+        dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+
+        errno = cqe->res < 0 ? -cqe->res : 0;
+        if (op == OP_RECV && cqe->res > 0 && (conn->inflight & OP_SEND)) {
+            /* a reply from another shard is being sent, parse it after the send */
+            buf_append(conn->incoming, data, (size_t)cqe->res);
+        } else if (op == OP_RECV) {
+            if (cqe->res > 0) {
+                buf_append(conn->incoming, data, (size_t)cqe->res);
+            }
+            handle_read_done(conn, cqe->res);           /* application logic */
+        } else {
+            handle_write_done(conn, cqe->res);          /* application logic */
+        }
+    }
+    if (data) {
+        br_recycle(ring, bid);  /* the data was copied into `incoming` */
+    }
+    uring_sync(ring, conn);
+}
+
+bool uring_loop(int listen_fd) {
+    Uring ring;
+    if (!uring_init(&ring, K_URING_ENTRIES)) {
+        LOG_WARN("[errno:%d] io_uring setup", errno);
+        if (ring.fd >= 0) {
+            close(ring.fd);
+        }
+        return false;
+    }
+    LOG_INFO("shard %u using io_uring", g_data.shard);
+
+    prep_accept(&ring, listen_fd);
+    if (g_data.wake_fd >= 0) {
+        prep_wake(&ring);
+    }
+
+    while (!shards_stopping()) {
+        /* submit the queued I/O and wait for completions */
+        if (uring_enter(&ring, 1, next_timer_ms()) < 0) {
+            die("io_uring_enter()");
+        }
+
+        /* handle the completions */
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        bool idle = head == tail;
+        for (; head != tail; ++head) {
+            uring_complete(&ring, listen_fd, &ring.cqes[head & ring.cq_mask]);
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        /* handle timers */
+        process_timers();
+        process_background(idle);
+    } /* the event loop */
+
+    close(ring.fd);
+    return true;
+}
@@ -9,4 +9,6 @@
 
 #include <global.h>
 
-GLOBAL_DATA g_data;
\ No newline at end of file
+thread_local GLOBAL_DATA g_data;
+
+TheadPool g_thread_pool;
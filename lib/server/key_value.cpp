@@ -9,10 +9,14 @@
 
 /* stdlib */
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* C++ */
 #include <vector>
 #include <string>
+#include <string_view>
 
 /* proj */
 /* proj::data structure */
@@ -21,6 +25,7 @@
 #include <heap.h>
 
 #include <conn.h>
+#include <config.h>
 #include <timer.h>
 #include <key_value.h>
 
@@ -28,66 +33,171 @@
 #include <utils.h>
 // #include <list.h>
 #include <global.h>
+#include <shard.h>
+#include <slab.h>
+#include <zstore.h>
+#include <lazyfree.h>
 
 
 struct LookupKey {
     struct HNode node;  /* hashtable node */
-    std::string key;
+    std::string_view key;   /* points into the request */
 };
 
 /* equality comparison for the top-level hashstable */
 bool entry_eq(HNode *node, HNode *key) {
     struct Entry *ent = container_of(node, struct Entry, node);
     struct LookupKey *keydata = container_of(key, struct LookupKey, node);
-    return ent->key == keydata->key;
+    return entry_key(ent) == keydata->key;
+}
+
+static size_t entry_size(size_t klen, uint8_t flags, size_t room) {
+    return sizeof(Entry) + ((flags & E_TTL) ? sizeof(size_t) : 0) + klen + room;
+}
+
+static char *entry_room(Entry *ent) {
+    return (char *)entry_key(ent).data() + ent->klen;
 }
 
-Entry *entry_new(ValueType type) {
-    Entry *ent = new Entry();
+/* a block with the key, and `room` bytes after it for an embedded value */
+static Entry *entry_alloc(std::string_view key, uint8_t flags, size_t room) {
+    Entry *ent = (Entry *)slab_alloc(entry_size(key.size(), flags, room));
+    ent->klen = (uint32_t)key.size();
+    ent->flags = flags;
+    ent->enc = ENC_RAW;
+    ent->room = (uint8_t)room;
+    memcpy((char *)entry_key(ent).data(), key.data(), key.size());
+    return ent;
+}
+
+static void entry_free(Entry *ent) {
+    slab_free(ent, entry_size(ent->klen, ent->flags, ent->room));
+}
+
+Entry *entry_new(const LookupKey &key, ValueType type, size_t room) {
+    Entry *ent = entry_alloc(key.key, 0, room);
+    ent->node.hcode = key.node.hcode;
     ent->type = type;
+    ent->str = NULL;
+    if (type == T_ZSET) {
+        ent->zset = new ZSet();
+        ent->zset->index = (uint8_t)g_config.zset_index;
+    }
     return ent;
 }
-void entry_del_sync(Entry *ent) {
-    if (ent->type == T_ZSET) {
-        zset_clear(&ent->zset);
+
+/* a zset out of the db, the last job holding it frees it, see zset_hold() */
+static void zset_drop(ZSet *zset) {
+    if (zset->holds > 0) {
+        zset->dropped = true;
+        return;
     }
-    delete ent;
+    lazy_free_zset(zset);
 }
 
-void entry_del_func(void *arg) {
-    entry_del_sync((Entry *)arg);
+/* a zset held by a job is written after it, the command is parked meanwhile */
+static bool zset_busy(ZSet *zset) {
+    if (zset->holds == 0) {
+        return false;
+    }
+    shard_park();
+    return true;
 }
 
 void entry_del(Entry *ent) {
     /* unlink it from any data structures */
     entry_set_ttl(ent, -1); /* remove from the heap data structure */
-    /* run the destructor in a thread pool for large data structures */
-    size_t set_size = (ent->type == T_ZSET) ? hm_size(&ent->zset.hmap) : 0;
-    const size_t k_large_container_size = 1000;
-    if (set_size > k_large_container_size) {
-        thread_pool_queue(&g_data.thread_pool, &entry_del_func, ent);
-    } else {
-        entry_del_sync(ent);    /* small; avoid context switches */
+    /* a large value is freed in steps, see lazyfree.h */
+    if (ent->type == T_ZSET) {
+        zset_drop(ent->zset);
+    } else if (ent->enc == ENC_RAW && ent->str) {
+        lazy_free_str(ent->str);
     }
+    entry_free(ent);
 }
 
-/* set or remove the TTL */
-void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
-    if (ttl_ms < 0 && ent->heap_idx != (size_t)-1) {
-        /* setting a negative TTL means removing the TTL */
-        heap_delete(g_data.heap, ent->heap_idx);
-        ent->heap_idx = -1;
+/*
+ * A copy in a larger block, it takes the place of `ent` in the db and in the
+ * heap. The `room` is at least the one of `ent`, it's copied.
+ */
+static Entry *entry_move(Entry *ent, uint8_t flags, size_t room) {
+    Entry *moved = entry_alloc(entry_key(ent), flags, room);
+    moved->node.hcode = ent->node.hcode;
+    moved->str = ent->str;  /* or any of the union */
+    static_assert(sizeof(ent->str) == sizeof(ent->zset), "the value is one word");
+    moved->type = ent->type;
+    moved->enc = ent->enc;
+    memcpy(entry_room(moved), entry_room(ent), ent->room);
+
+    size_t *heap_idx = entry_heap_idx(moved);
+    if (heap_idx) {
+        size_t *from = entry_heap_idx(ent);
+        *heap_idx = from ? *from : -1;
+        if (*heap_idx != (size_t)-1) {
+            g_data.heap[*heap_idx].ref = heap_idx;
+        }
+    }
+    hm_replace(&g_data.db, &ent->node, &moved->node);
+    entry_free(ent);
+    return moved;
+}
+
+/* set or remove the TTL, the entry is moved by its first TTL */
+Entry *entry_set_ttl(Entry *ent, int64_t ttl_ms) {
+    size_t *heap_idx = entry_heap_idx(ent);
+    if (ttl_ms < 0 && heap_idx && *heap_idx != (size_t)-1) {
+        /* setting a negative TTL means removing the TTL, the room stays */
+        heap_delete(g_data.heap, *heap_idx);
+        *heap_idx = -1;
     } else if (ttl_ms >= 0) {
+        if (!heap_idx) {
+            ent = entry_move(ent, ent->flags | E_TTL, ent->room);
+            heap_idx = entry_heap_idx(ent);
+        }
         /* add or update the heap data structure */
         uint64_t expire_at = get_monotonic_msec() + (uint64_t)ttl_ms;
-        heap_upsert(g_data.heap, ent->heap_idx, HeapItem{expire_at, &ent->heap_idx});
+        heap_upsert(g_data.heap, *heap_idx, HeapItem{expire_at, heap_idx});
+    }
+    return ent;
+}
+
+/* an int if it reads back the same, embedded if the entry stays small, or else raw */
+static uint8_t str_encoding(std::string_view val, size_t klen, uint8_t flags, int64_t *ival) {
+    char buf[24];
+    if (val.size() <= 20 && str2int(val, *ival)
+        && int2str(*ival, buf) == val.size() && memcmp(buf, val.data(), val.size()) == 0) {
+        return ENC_INT;
     }
+    return entry_size(klen, flags, 1 + val.size()) <= K_EMBED_MAX ? ENC_EMBED : ENC_RAW;
 }
 
-void do_get(std::vector<std::string> &cmd, Buffer &out) {
+/* replace the value of a T_STR entry, a longer embedded value moves it */
+static Entry *entry_set_str(Entry *ent, std::string_view val) {
+    int64_t ival = 0;
+    uint8_t enc = str_encoding(val, ent->klen, ent->flags, &ival);
+    if (ent->enc == ENC_RAW && ent->str) {
+        lazy_free_str(ent->str);    /* NOTE: the replies being sent keep the old value alive */
+    }
+    if (enc == ENC_EMBED && ent->room < 1 + val.size()) {
+        ent = entry_move(ent, ent->flags, 1 + val.size());
+    }
+    ent->enc = enc;
+    if (enc == ENC_INT) {
+        ent->ival = ival;
+    } else if (enc == ENC_EMBED) {
+        char *room = entry_room(ent);
+        room[0] = (char)val.size();
+        memcpy(room + 1, val.data(), val.size());
+    } else {
+        ent->str = rcstr_new(val.data(), val.size());
+    }
+    return ent;
+}
+
+void do_get(std::vector<std::string_view> &cmd, Buffer &out) {
     /* a dummy struct just for the lookup */
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
 
     /* hashtable lookup */
@@ -101,13 +211,24 @@ void do_get(std::vector<std::string> &cmd, Buffer &out) {
     if (ent->type != T_STR) {
         return out_err(out, ERR_BAD_TYP, "not a string value");
     }
-    return out_str(out, ent->str.data(), ent->str.size());
+    switch (ent->enc) {
+    case ENC_INT: {
+        char buf[24];
+        return out_str(out, buf, int2str(ent->ival, buf));
+    }
+    case ENC_EMBED: {
+        std::string_view val = entry_embed(ent);
+        return out_str(out, val.data(), val.size());
+    }
+    default:
+        return out_rcstr(out, ent->str);   /* a large value is not copied */
+    }
 }
 
-void do_set(std::vector<std::string> &cmd, Buffer &out) {
+void do_set(std::vector<std::string_view> &cmd, Buffer &out) {
     /* a dummy struct just for the lookup */
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
 
     /* hashtable lookup */
@@ -119,22 +240,71 @@ void do_set(std::vector<std::string> &cmd, Buffer &out) {
         if (ent->type != T_STR) {
             return out_err(out, ERR_BAD_TYP, "a non-string value exists");
         }
-        ent->str.swap(cmd[2]);
+        entry_set_str(ent, cmd[2]);
     } else {
-        /* not found, allocate & insert a new pair */
-        Entry *ent = entry_new(T_STR);
-        ent->key.swap(key.key);
-        ent->node.hcode = key.node.hcode;
-        ent->str.swap(cmd[2]);
+        /* not found, allocate & insert a new pair, the key is copied */
+        int64_t ival = 0;
+        bool embed = str_encoding(cmd[2], key.key.size(), 0, &ival) == ENC_EMBED;
+        Entry *ent = entry_new(key, T_STR, embed ? 1 + cmd[2].size() : 0);
         hm_insert(&g_data.db, &ent->node);
+        entry_set_str(ent, cmd[2]);
     }
     return out_nil(out);
 }
 
-void do_del(std::vector<std::string> &cmd, Buffer &out) {
+/* add `delta` or cmd[2] in place on an int value, subtract it if `neg` */
+static void incr_by(std::vector<std::string_view> &cmd, Buffer &out, bool neg) {
+    int64_t delta = 1;
+    if (cmd.size() == 3 && !str2int(cmd[2], delta)) {
+        return out_err(out, ERR_BAD_ARG, "expect int64");
+    }
+    if (neg) {
+        if (delta == INT64_MIN) {
+            return out_err(out, ERR_BAD_ARG, "increment or decrement would overflow");
+        }
+        delta = -delta;
+    }
+
+    LookupKey key;
+    key.key = cmd[1];
+    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
+
+    Entry *ent = NULL;
+    if (!node) {    /* a non-existent key starts from 0 */
+        ent = entry_new(key, T_STR, 0);
+        ent->enc = ENC_INT;
+        ent->ival = 0;
+        hm_insert(&g_data.db, &ent->node);
+    } else {
+        ent = container_of(node, Entry, node);
+        if (ent->type != T_STR || ent->enc != ENC_INT) {
+            /* an int value is always encoded as one */
+            return out_err(out, ERR_BAD_TYP, "value is not an integer");
+        }
+    }
+    int64_t val = 0;
+    if (__builtin_add_overflow(ent->ival, delta, &val)) {
+        return out_err(out, ERR_BAD_ARG, "increment or decrement would overflow");
+    }
+    ent->ival = val;
+    return out_int(out, val);
+}
+
+/* incr key | incrby key n */
+void do_incrby(std::vector<std::string_view> &cmd, Buffer &out) {
+    return incr_by(cmd, out, false);
+}
+
+/* decrby key n */
+void do_decrby(std::vector<std::string_view> &cmd, Buffer &out) {
+    return incr_by(cmd, out, true);
+}
+
+void do_del(std::vector<std::string_view> &cmd, Buffer &out) {
     /* a dummy struct just for the lookup */
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
 
     /* hashtable delete */
@@ -146,152 +316,766 @@ void do_del(std::vector<std::string> &cmd, Buffer &out) {
     return out_int(out, node ? 1 : 0);
 }
 
-bool cb_keys(HNode *node, void *arg) {
-    Buffer &out = *(Buffer *)arg;
-    const std::string &key = container_of(node, Entry, node)->key;
-    out_str(out, key.data(), key.size());
+/* keys: the slots of the db are visited in steps, the rehashing waits for it */
+struct KeysStream {
+    Stream st;
+    size_t pos = 0;
+};
+
+struct KeysArg {
+    Buffer *out;
+    size_t stop;    /* the size of `out` to stop at */
+    uint32_t n;
+};
+
+static bool cb_keys(HNode *node, void *arg) {
+    KeysArg *ka = (KeysArg *)arg;
+    std::string_view key = entry_key(container_of(node, Entry, node));
+    out_str(*ka->out, key.data(), key.size());
+    ka->n++;
+    return buf_size(*ka->out) < ka->stop;
+}
+
+static bool keys_next(Stream *st, Buffer &out, size_t budget, uint32_t *n) {
+    KeysStream *ks = container_of(st, KeysStream, st);
+    KeysArg ka = {&out, buf_size(out) + budget, 0};
+    ks->pos = hm_foreach_from(&g_data.db, ks->pos, &cb_keys, &ka);
+    *n += ka.n;
+    return ks->pos != (size_t)-1;
+}
+
+static void keys_del(Stream *st) {
+    hm_resume_rehashing(&g_data.db);
+    delete container_of(st, KeysStream, st);
+}
+
+Stream *open_keys(std::vector<std::string_view> &, Buffer &) {
+    KeysStream *ks = new KeysStream();
+    ks->st.next = &keys_next;
+    ks->st.del = &keys_del;
+    hm_pause_rehashing(&g_data.db);
+    return &ks->st;
+}
+
+/* the options of scan and zscan, and the nodes of a call */
+struct ScanArg {
+    std::string_view match;     /* empty: any */
+    int64_t count = K_SCAN_COUNT;
+    std::string_view (*name)(HNode *);
+    std::vector<HNode *> found;
+    size_t visited = 0;
+};
+
+/* [match pattern] [count n] from cmd[from] */
+static bool scan_parse(std::vector<std::string_view> &cmd, size_t from, ScanArg *sa, Buffer &out) {
+    for (size_t i = from; i < cmd.size(); i += 2) {
+        if (i + 1 >= cmd.size()) {
+            out_err(out, ERR_BAD_ARG, "expect match pattern | count n");
+            return false;
+        }
+        if (cmd[i] == "match") {
+            sa->match = cmd[i + 1] == "*" ? std::string_view() : cmd[i + 1];
+        } else if (cmd[i] == "count") {
+            if (!str2int(cmd[i + 1], sa->count) || sa->count <= 0) {
+                out_err(out, ERR_BAD_ARG, "expect positive int");
+                return false;
+            }
+        } else {
+            out_err(out, ERR_BAD_ARG, "expect match pattern | count n");
+            return false;
+        }
+    }
     return true;
 }
 
-void do_keys(std::vector<std::string> &, Buffer &out) {
-    out_arr(out, (uint32_t)hm_size(&g_data.db));
-    hm_foreach(&g_data.db, &cb_keys, (void *)&out);
+static void cb_scan(HNode *node, void *arg) {
+    ScanArg *sa = (ScanArg *)arg;
+    sa->visited++;
+    if (sa->match.empty() || glob_match(sa->match, sa->name(node))) {
+        sa->found.push_back(node);
+    }
 }
 
-/* zadd zset score name */
-void do_zadd(std::vector<std::string> &cmd, Buffer &out) {
-    double score = 0;
-    if (!str2dbl(cmd[2], score)) {
-        return out_err(out, ERR_BAD_ARG, "expect float");
+/*
+ * The work is bounded by `count`: the groups of slots visited, and the nodes,
+ * the matched ones may be fewer.
+ */
+static size_t scan_steps(HMap *hmap, size_t cursor, ScanArg *sa) {
+    for (int64_t steps = 0; steps < sa->count && (size_t)sa->count > sa->visited; steps++) {
+        cursor = hm_scan(hmap, cursor, &cb_scan, sa);
+        if (cursor == 0) {
+            break;
+        }
+    }
+    return cursor;
+}
+
+static std::string_view entry_name(HNode *node) {
+    return entry_key(container_of(node, Entry, node));
+}
+
+/* scan cursor [match pattern] [count n] */
+void do_scan(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t cursor = 0;
+    if (!str2int(cmd[1], cursor) || cursor < 0) {
+        return out_err(out, ERR_BAD_ARG, "expect cursor");
+    }
+    ScanArg sa;
+    sa.name = &entry_name;
+    if (!scan_parse(cmd, 2, &sa, out)) {
+        return;
+    }
+
+    /* the cursor of the shard, then the next shard once it's done */
+    uint64_t nshards = shards_count();
+    size_t next = scan_steps(&g_data.db, (uint64_t)cursor / nshards, &sa);
+    if (next) {
+        cursor = (int64_t)(next * nshards + g_data.shard);
+    } else {
+        cursor = g_data.shard + 1 < nshards ? g_data.shard + 1 : 0;
+    }
+
+    out_arr(out, 2);
+    out_int(out, cursor);
+    out_arr(out, (uint32_t)sa.found.size());
+    for (HNode *node : sa.found) {
+        std::string_view key = entry_key(container_of(node, Entry, node));
+        out_str(out, key.data(), key.size());
+    }
+}
+
+/* zadd zset score name [score name ...] */
+void do_zadd(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (cmd.size() % 2 != 0) {
+        return out_err(out, ERR_BAD_ARG, "syntax error");
+    }
+    /* all the scores are checked before any is added */
+    std::vector<ZPair> pairs((cmd.size() - 2) / 2);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        if (!str2dbl(cmd[2 + 2 * i], pairs[i].score)) {
+            return out_err(out, ERR_BAD_ARG, "expect float");
+        }
+        pairs[i].name = cmd[3 + 2 * i].data();
+        pairs[i].len = cmd[3 + 2 * i].size();
     }
 
     /* look up or create the zset */
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
     HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
 
     Entry *ent = NULL;
     if (!hnode) {   /* insert a new key */
-        ent = entry_new(T_ZSET);
-        ent->key.swap(key.key);
-        ent->node.hcode = key.node.hcode;
+        ent = entry_new(key, T_ZSET, 0);   /* the key is copied */
         hm_insert(&g_data.db, &ent->node);
     } else {        /* check the existing key */
         ent = container_of(hnode, Entry, node);
         if (ent->type != T_ZSET) {
             return out_err(out, ERR_BAD_TYP, "expect zset");
         }
+        if (zset_busy(ent->zset)) {
+            return;
+        }
     }
 
-    /* add or update the tuple */
-    const std::string &name = cmd[3];
-    bool added = zset_insert(&ent->zset, name.data(), name.size(), score);
+    /* add or update the tuples */
+    size_t added = zset_add(ent->zset, pairs.data(), pairs.size());
     return out_int(out, (int64_t)added);
 }
 
 const ZSet k_empty_zset;
 
-ZSet *expect_zset(std::string &s) {
+ZSet *expect_zset(std::string_view s) {
     LookupKey key;
-    key.key.swap(s);
+    key.key = s;
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
     HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
     if (!hnode) {   /* a non-existent key is treated as an empty zset */
         return (ZSet *)&k_empty_zset;
     }
     Entry *ent = container_of(hnode, Entry, node);
-    return ent->type == T_ZSET ? &ent->zset : NULL;
+    return ent->type == T_ZSET ? ent->zset : NULL;
 }
 
 /* zrem zset name */
-void do_zrem(std::vector<std::string> &cmd, Buffer &out) {
+void do_zrem(std::vector<std::string_view> &cmd, Buffer &out) {
     ZSet *zset = expect_zset(cmd[1]);
     if (!zset) {
         return out_err(out, ERR_BAD_TYP, "expect zset");
     }
-
-    const std::string &name = cmd[2];
-    ZNode *znode = zset_lookup(zset, name.data(), name.size());
-    if (znode) {
-        zset_delete(zset, znode);
+    if (zset_busy(zset)) {
+        return;
     }
-    return out_int(out, znode ? 1 : 0);
+
+    std::string_view name = cmd[2];
+    bool removed = zset_remove(zset, name.data(), name.size());
+    return out_int(out, removed ? 1 : 0);
 }
 
 /* zscore zset name */
-void do_zscore(std::vector<std::string> &cmd, Buffer &out) {
+void do_zscore(std::vector<std::string_view> &cmd, Buffer &out) {
+    ZSet *zset = expect_zset(cmd[1]);
+    if (!zset) {
+        return out_err(out, ERR_BAD_TYP, "expect zset");
+    }
+
+    std::string_view name = cmd[2];
+    double score = 0;
+    bool found = zset_score(zset, name.data(), name.size(), &score);
+    return found ? out_dbl(out, score) : out_nil(out);
+}
+
+static std::string_view znode_name(HNode *node) {
+    ZNode *znode = container_of(node, ZNode, hmap);
+    return std::string_view(znode->name, znode->len);
+}
+
+/* a packed zset is small, it's done in one go whatever the cursor */
+static void zscan_packed(ZSet *zset, ScanArg *sa, Buffer &out) {
+    out_arr(out, 2);
+    out_int(out, 0);
+    size_t idx = out_begin_arr(out);
+    uint32_t n = 0;
+    for (ZIter it = zset_begin(zset); it.valid; it = zset_next(zset, it)) {
+        if (sa->match.empty() || glob_match(sa->match, std::string_view(it.name, it.len))) {
+            out_str(out, it.name, it.len);
+            out_dbl(out, it.score);
+            n += 2;
+        }
+    }
+    out_end_arr(out, idx, n);
+}
+
+/* zscan zset cursor [match pattern] [count n] */
+void do_zscan(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t cursor = 0;
+    if (!str2int(cmd[2], cursor) || cursor < 0) {
+        return out_err(out, ERR_BAD_ARG, "expect cursor");
+    }
+    ScanArg sa;
+    sa.name = &znode_name;
+    if (!scan_parse(cmd, 3, &sa, out)) {
+        return;
+    }
     ZSet *zset = expect_zset(cmd[1]);
     if (!zset) {
         return out_err(out, ERR_BAD_TYP, "expect zset");
     }
 
-    const std::string &name = cmd[2];
-    ZNode *znode = zset_lookup(zset, name.data(), name.size());
-    return znode ? out_dbl(out, znode->score) : out_nil(out);
+    if (zset->packed) {
+        return zscan_packed(zset, &sa, out);
+    }
+    cursor = (int64_t)scan_steps(&zset->hmap, (size_t)cursor, &sa);
+    out_arr(out, 2);
+    out_int(out, cursor);
+    out_arr(out, (uint32_t)sa.found.size() * 2);
+    for (HNode *node : sa.found) {
+        ZNode *znode = container_of(node, ZNode, hmap);
+        out_str(out, znode->name, znode->len);
+        out_dbl(out, znode->score);
+    }
+}
+
+/*
+ * zquery: the zset may change between the steps, so a step seeks again from
+ * the (score, name) it stopped at instead of holding a node.
+ */
+struct ZQueryStream {
+    Stream st;
+    std::string key;
+    double score = 0;
+    std::string name;
+    int64_t offset = 0;     /* applied by the first step */
+    int64_t limit = 0;
+    int64_t n = 0;          /* the number of elements so far */
+};
+
+static bool zquery_next(Stream *st, Buffer &out, size_t budget, uint32_t *n) {
+    ZQueryStream *zq = container_of(st, ZQueryStream, st);
+    ZSet *zset = expect_zset(zq->key);
+    if (!zset) {
+        return false;   /* the key was replaced by another type */
+    }
+    ZIter it = zset_seekge(zset, zq->score, zq->name.data(), zq->name.size());
+    it = zset_offset(zset, it, zq->offset);
+    zq->offset = 0;
+
+    size_t stop = buf_size(out) + budget;
+    while (it.valid && zq->n < zq->limit) {
+        if (buf_size(out) >= stop) {
+            zq->score = it.score;
+            zq->name.assign(it.name, it.len);
+            return true;
+        }
+        out_str(out, it.name, it.len);
+        out_dbl(out, it.score);
+        it = zset_next(zset, it);
+        zq->n += 2;
+        *n += 2;
+    }
+    return false;
+}
+
+static void zquery_del(Stream *st) {
+    delete container_of(st, ZQueryStream, st);
 }
 
 /* zquery zset score name offset limit */
-void do_zquery(std::vector<std::string> &cmd, Buffer &out) {
+Stream *open_zquery(std::vector<std::string_view> &cmd, Buffer &out) {
     /* parse args */
     double score = 0;
     if (!str2dbl(cmd[2], score)) {
-        return out_err(out, ERR_BAD_ARG, "expect fp number");
+        out_err(out, ERR_BAD_ARG, "expect fp number");
+        return NULL;
     }
-    const std::string &name = cmd[3];
     int64_t offset = 0, limit = 0;
     if (!str2int(cmd[4], offset) || !str2int(cmd[5], limit)) {
-        return out_err(out, ERR_BAD_ARG, "expect int");
+        out_err(out, ERR_BAD_ARG, "expect int");
+        return NULL;
     }
 
-    /* get the zset */
+    /* check the zset */
+    if (!expect_zset(cmd[1])) {
+        out_err(out, ERR_BAD_TYP, "expect zset");
+        return NULL;
+    }
+    if (limit <= 0) {
+        out_arr(out, 0);
+        return NULL;
+    }
+
+    ZQueryStream *zq = new ZQueryStream();
+    zq->st.next = &zquery_next;
+    zq->st.del = &zquery_del;
+    zq->key.assign(cmd[1]);
+    zq->score = score;
+    zq->name.assign(cmd[3]);
+    zq->offset = offset;
+    zq->limit = limit;
+    return &zq->st;
+}
+
+static void zrank(std::vector<std::string_view> &cmd, Buffer &out, bool rev) {
     ZSet *zset = expect_zset(cmd[1]);
     if (!zset) {
         return out_err(out, ERR_BAD_TYP, "expect zset");
     }
 
-    /* seek to the key */
-    if (limit <= 0) {
-        return out_arr(out, 0);
+    std::string_view name = cmd[2];
+    int64_t rank = zset_rank(zset, name.data(), name.size());
+    if (rank < 0) {
+        return out_nil(out);
     }
-    ZNode *znode = zset_seekge(zset, score, name.data(), name.size());
-    znode = znode_offset(znode, offset);
+    return out_int(out, rev ? (int64_t)zset_size(zset) - 1 - rank : rank);
+}
 
-    /* output */
-    size_t ctx = out_begin_arr(out);
-    int64_t n = 0;
-    while (znode && n < limit) {
-        out_str(out, znode->name, znode->len);
-        out_dbl(out, znode->score);
-        znode = znode_offset(znode, +1);
-        n += 2;
+/* zrank zset name */
+void do_zrank(std::vector<std::string_view> &cmd, Buffer &out) {
+    return zrank(cmd, out, false);
+}
+
+/* zrevrank zset name */
+void do_zrevrank(std::vector<std::string_view> &cmd, Buffer &out) {
+    return zrank(cmd, out, true);
+}
+
+/*
+ * zrangebyscore and zrevrange: like zquery, a step seeks again from the
+ * (score, name) it stopped at, then walks with zset_next() or zset_prev().
+ */
+struct ZRangeStream {
+    Stream st;
+    std::string key;
+    bool rev = false;       /* descending */
+    double score = 0;       /* where the next step starts */
+    std::string name;
+    int64_t rank = -1;      /* or by rank, for the first step */
+    int64_t offset = 0;     /* applied by the first step */
+    int64_t left = 0;       /* the members still to send */
+    double max = 0;         /* the upper bound of an ascending range */
+    bool max_ex = false;
+};
+
+static bool zrange_in(ZRangeStream *zr, double score) {
+    return zr->rev || (zr->max_ex ? score < zr->max : score <= zr->max);
+}
+
+static bool zrange_next(Stream *st, Buffer &out, size_t budget, uint32_t *n) {
+    ZRangeStream *zr = container_of(st, ZRangeStream, st);
+    ZSet *zset = expect_zset(zr->key);
+    if (!zset) {
+        return false;   /* the key was replaced by another type */
+    }
+    ZIter it;
+    if (zr->rank >= 0) {
+        it = zset_select(zset, zr->rank);
+        zr->rank = -1;
+    } else if (zr->rev) {
+        it = zset_seekle(zset, zr->score, zr->name.data(), zr->name.size());
+    } else {
+        it = zset_seekge(zset, zr->score, zr->name.data(), zr->name.size());
+        it = zset_offset(zset, it, zr->offset);
+        zr->offset = 0;
+    }
+
+    size_t stop = buf_size(out) + budget;
+    while (it.valid && zr->left > 0 && zrange_in(zr, it.score)) {
+        if (buf_size(out) >= stop) {
+            zr->score = it.score;
+            zr->name.assign(it.name, it.len);
+            return true;
+        }
+        out_str(out, it.name, it.len);
+        out_dbl(out, it.score);
+        it = zr->rev ? zset_prev(zset, it) : zset_next(zset, it);
+        zr->left--;
+        *n += 2;
+    }
+    return false;
+}
+
+static void zrange_del(Stream *st) {
+    delete container_of(st, ZRangeStream, st);
+}
+
+static ZRangeStream *zrange_new(std::string_view key) {
+    ZRangeStream *zr = new ZRangeStream();
+    zr->st.next = &zrange_next;
+    zr->st.del = &zrange_del;
+    zr->key.assign(key);
+    return zr;
+}
+
+/* a score bound: [(]score, or -inf, +inf */
+static bool parse_bound(std::string_view s, double *score, bool *ex) {
+    *ex = !s.empty() && s[0] == '(';
+    return str2dbl(*ex ? s.substr(1) : s, *score);
+}
+
+/* zrangebyscore zset min max [limit offset count] */
+Stream *open_zrangebyscore(std::vector<std::string_view> &cmd, Buffer &out) {
+    double min = 0, max = 0;
+    bool min_ex = false, max_ex = false;
+    if (!parse_bound(cmd[2], &min, &min_ex) || !parse_bound(cmd[3], &max, &max_ex)) {
+        out_err(out, ERR_BAD_ARG, "expect fp number");
+        return NULL;
+    }
+    int64_t offset = 0, count = -1;
+    if (cmd.size() != 4 && (cmd.size() != 7 || cmd[4] != "limit")) {
+        out_err(out, ERR_BAD_ARG, "syntax error");
+        return NULL;
+    }
+    if (cmd.size() == 7 && (!str2int(cmd[5], offset) || !str2int(cmd[6], count))) {
+        out_err(out, ERR_BAD_ARG, "expect int");
+        return NULL;
+    }
+
+    if (!expect_zset(cmd[1])) {
+        out_err(out, ERR_BAD_TYP, "expect zset");
+        return NULL;
+    }
+    if (offset < 0 || count == 0 || (min_ex && min == INFINITY)) {
+        out_arr(out, 0);
+        return NULL;
+    }
+
+    ZRangeStream *zr = zrange_new(cmd[1]);
+    /* the least score > min is the next double */
+    zr->score = min_ex ? nextafter(min, INFINITY) : min;
+    zr->offset = offset;
+    zr->left = count < 0 ? INT64_MAX : count;
+    zr->max = max;
+    zr->max_ex = max_ex;
+    return &zr->st;
+}
+
+/* zrevrange zset start stop: by rank from the highest, negative from the lowest */
+Stream *open_zrevrange(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t start = 0, stop = 0;
+    if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+        out_err(out, ERR_BAD_ARG, "expect int");
+        return NULL;
+    }
+    ZSet *zset = expect_zset(cmd[1]);
+    if (!zset) {
+        out_err(out, ERR_BAD_TYP, "expect zset");
+        return NULL;
+    }
+
+    int64_t size = (int64_t)zset_size(zset);
+    start = start < 0 ? (start + size < 0 ? 0 : start + size) : start;
+    stop = stop < 0 ? stop + size : (stop >= size ? size - 1 : stop);
+    if (start > stop || start >= size) {
+        out_arr(out, 0);
+        return NULL;
+    }
+
+    ZRangeStream *zr = zrange_new(cmd[1]);
+    zr->rev = true;
+    zr->rank = size - 1 - start;
+    zr->left = stop - start + 1;
+    return &zr->st;
+}
+
+/*
+ * The members in [(]min [(]max: [lo, hi) by rank, the difference of the
+ * counts below the 2 bounds. The sum of their scores is taken from the
+ * trees in one descent by zset_sum(), both in O(log n) whatever the range.
+ */
+struct ZRange {
+    int64_t lo = 0, hi = 0;
+    double min = 0, max = 0;
+    bool min_ex = false, max_ex = false;
+};
+
+static ZSet *zrange_parse(std::vector<std::string_view> &cmd, size_t from, ZRange *zr, Buffer &out) {
+    if (!parse_bound(cmd[from], &zr->min, &zr->min_ex) || !parse_bound(cmd[from + 1], &zr->max, &zr->max_ex)) {
+        out_err(out, ERR_BAD_ARG, "expect fp number");
+        return NULL;
+    }
+    ZSet *zset = expect_zset(cmd[1]);
+    if (!zset) {
+        out_err(out, ERR_BAD_TYP, "expect zset");
+        return NULL;
+    }
+    zr->lo = zset_prefix(zset, zr->min, zr->min_ex);
+    zr->hi = zset_prefix(zset, zr->max, !zr->max_ex);
+    if (zr->hi <= zr->lo) {
+        zr->hi = zr->lo;    /* empty */
     }
-    out_end_arr(out, ctx, (uint32_t)n);
+    return zset;
+}
+
+/* zcount zset min max */
+void do_zcount(std::vector<std::string_view> &cmd, Buffer &out) {
+    ZRange zr;
+    if (zrange_parse(cmd, 2, &zr, out)) {
+        out_int(out, zr.hi - zr.lo);
+    }
+}
+
+/* zsum zset min max */
+void do_zsum(std::vector<std::string_view> &cmd, Buffer &out) {
+    ZRange zr;
+    ZSet *zset = zrange_parse(cmd, 2, &zr, out);
+    if (zset) {
+        out_dbl(out, zset_sum(zset, zr.min, zr.min_ex, zr.max, zr.max_ex));
+    }
+}
+
+/* zquantile zset q [min max]: the score at the nearest rank, of all or of a range */
+void do_zquantile(std::vector<std::string_view> &cmd, Buffer &out) {
+    double q = 0;
+    if (!str2dbl(cmd[2], q) || q < 0 || q > 1) {
+        return out_err(out, ERR_BAD_ARG, "expect a quantile in [0, 1]");
+    }
+    if (cmd.size() != 3 && cmd.size() != 5) {
+        return out_err(out, ERR_BAD_ARG, "syntax error");
+    }
+    ZRange zr;
+    ZSet *zset = NULL;
+    if (cmd.size() == 5) {
+        zset = zrange_parse(cmd, 3, &zr, out);
+        if (!zset) {
+            return;
+        }
+    } else {
+        zset = expect_zset(cmd[1]);
+        if (!zset) {
+            return out_err(out, ERR_BAD_TYP, "expect zset");
+        }
+        zr.hi = (int64_t)zset_size(zset);
+    }
+    int64_t n = zr.hi - zr.lo;
+    if (n == 0) {
+        return out_nil(out);
+    }
+    int64_t rank = (int64_t)ceil(q * (double)n) - 1;
+    rank = rank < 0 ? 0 : rank;
+    ZIter it = zset_select(zset, zr.lo + rank);
+    return out_dbl(out, it.score);
+}
+
+/* a zunionstore or a zinterstore, and its destination */
+struct ZStoreJob {
+    ZStore zs;
+    std::string key;
+    std::vector<ZSet *> inputs;     /* held until the job is done */
+    std::vector<double> weights;
+    SlabArena *arena = NULL;        /* the nodes of the result, built on the pool */
+};
+
+/*
+ * A zset read in place by a job on the pool. Until the job is finished, its
+ * nodes stay in their slots, a write is parked, see zset_busy(), and a delete
+ * is put off, see zset_drop().
+ */
+static void zset_hold(ZSet *zset) {
+    if (zset != &k_empty_zset) {
+        zset->holds++;
+        hm_pause_rehashing(&zset->hmap);
+        shard_hold(1);
+    }
+}
+
+static void zset_release(ZSet *zset) {
+    if (zset == &k_empty_zset) {
+        return;
+    }
+    zset->holds--;
+    hm_resume_rehashing(&zset->hmap);
+    shard_hold(-1);
+    if (zset->holds == 0 && zset->dropped) {
+        lazy_free_zset(zset);
+    }
+}
+
+/* the worker owns no node of the result, the shard adopts them, see slab.h */
+static void zstore_job_run(void *arg) {
+    ZStoreJob *job = (ZStoreJob *)arg;
+    for (size_t k = 0; k < job->inputs.size(); k++) {
+        zstore_add(&job->zs, job->inputs[k], job->weights[k]);
+    }
+    job->arena = slab_arena_new();
+    slab_arena_use(job->arena);
+    zstore_run(&job->zs, &g_thread_pool);
+    slab_arena_use(NULL);
+}
+
+/* the result takes the place of the destination at once, an empty one deletes it */
+static void zstore_job_finish(void *arg, Buffer &out) {
+    ZStoreJob *job = (ZStoreJob *)arg;
+    ZSet *zset = job->zs.dst;
+    if (job->arena) {
+        slab_adopt(job->arena);
+    }
+    for (ZSet *input : job->inputs) {
+        zset_release(input);
+    }
+    LookupKey key;
+    key.key = job->key;
+    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+    HNode *node = hm_delete(&g_data.db, &key.node, &entry_eq);
+    if (node) {
+        entry_del(container_of(node, Entry, node));
+    }
+
+    size_t n = zset_size(zset);
+    if (n > 0) {
+        Entry *ent = entry_new(key, T_ZSET, 0);
+        delete ent->zset;
+        ent->zset = zset;
+        hm_insert(&g_data.db, &ent->node);
+    } else {
+        zset_clear(zset);
+        delete zset;
+    }
+    delete job;
+    return out_int(out, (int64_t)n);
+}
+
+/*
+ * zunionstore|zinterstore dst numkeys key... [weights w...] [aggregate sum|min|max]
+ * The larger inputs are read and aggregated on the thread pool, see zstore.h,
+ * they're held as they are until the result is in.
+ */
+static void zstore(std::vector<std::string_view> &cmd, Buffer &out, bool inter) {
+    int64_t nkeys = 0;
+    if (!str2int(cmd[2], nkeys) || nkeys < 1 || (size_t)nkeys > cmd.size() - 3) {
+        return out_err(out, ERR_BAD_ARG, "expect the number of keys");
+    }
+    size_t end = 3 + (size_t)nkeys;
+    std::vector<double> weights((size_t)nkeys, 1.0);
+    uint8_t agg = Z_AGG_SUM;
+    for (size_t i = end; i < cmd.size();) {
+        if (cmd[i] == "weights" && i + weights.size() < cmd.size()) {
+            for (size_t k = 0; k < weights.size(); k++) {
+                if (!str2dbl(cmd[i + 1 + k], weights[k])) {
+                    return out_err(out, ERR_BAD_ARG, "expect float");
+                }
+            }
+            i += 1 + weights.size();
+        } else if (cmd[i] == "aggregate" && i + 1 < cmd.size()) {
+            if (cmd[i + 1] == "sum") {
+                agg = Z_AGG_SUM;
+            } else if (cmd[i + 1] == "min") {
+                agg = Z_AGG_MIN;
+            } else if (cmd[i + 1] == "max") {
+                agg = Z_AGG_MAX;
+            } else {
+                return out_err(out, ERR_BAD_ARG, "syntax error");
+            }
+            i += 2;
+        } else {
+            return out_err(out, ERR_BAD_ARG, "syntax error");
+        }
+    }
+
+    std::vector<ZSet *> inputs;
+    for (size_t i = 3; i < end; i++) {
+        ZSet *zset = expect_zset(cmd[i]);
+        if (!zset) {
+            return out_err(out, ERR_BAD_TYP, "expect zset");
+        }
+        inputs.push_back(zset);
+    }
+
+    ZStoreJob *job = new ZStoreJob();
+    job->zs.inter = inter;
+    job->zs.agg = agg;
+    job->key = cmd[1];
+    size_t nitems = 0;
+    for (ZSet *zset : inputs) {
+        nitems += zset_size(zset);
+    }
+    if (nitems < K_ZSTORE_ASYNC_MIN) {
+        /* small, not worth a round trip */
+        for (size_t k = 0; k < inputs.size(); k++) {
+            zstore_add(&job->zs, inputs[k], weights[k]);
+        }
+        zstore_run(&job->zs, NULL);
+        return zstore_job_finish(job, out);
+    }
+    for (ZSet *zset : inputs) {
+        zset_hold(zset);
+    }
+    job->inputs.swap(inputs);
+    job->weights.swap(weights);
+    shard_defer(&zstore_job_run, &zstore_job_finish, job);
+}
+
+void do_zunionstore(std::vector<std::string_view> &cmd, Buffer &out) {
+    return zstore(cmd, out, false);
+}
+
+void do_zinterstore(std::vector<std::string_view> &cmd, Buffer &out) {
+    return zstore(cmd, out, true);
 }
 
 /* PEXPIRE key ttl_ms */
-void do_expire(std::vector<std::string> &cmd, Buffer &out) {
+void do_expire(std::vector<std::string_view> &cmd, Buffer &out) {
     int64_t ttl_ms = 0;
     if (!str2int(cmd[2], ttl_ms)) {
         return out_err(out, ERR_BAD_ARG, "expect int64");
     }
 
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
 
     HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
     if (node) {
         Entry *ent = container_of(node, Entry, node);
-        entry_set_ttl(ent, ttl_ms);
+        entry_set_ttl(ent, ttl_ms);   /* NOTE: it may move */
     }
     return out_int(out, node ? 1: 0);
 }
 
 /* PTTL key */
-void do_ttl(std::vector<std::string> &cmd, Buffer &out) {
+void do_ttl(std::vector<std::string_view> &cmd, Buffer &out) {
     LookupKey key;
-    key.key.swap(cmd[1]);
+    key.key = cmd[1];
     key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
 
     HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
@@ -299,12 +1083,12 @@ void do_ttl(std::vector<std::string> &cmd, Buffer &out) {
         return out_int(out, -2);    /* not found */
     }
 
-    Entry *ent = container_of(node, Entry, node);
-    if (ent->heap_idx == (size_t)-1) {
+    size_t *heap_idx = entry_heap_idx(container_of(node, Entry, node));
+    if (!heap_idx || *heap_idx == (size_t)-1) {
         return out_int(out, -1);    /* no TTL */
     }
 
-    uint64_t expire_at = g_data.heap[ent->heap_idx].val;
+    uint64_t expire_at = g_data.heap[*heap_idx].val;
     uint64_t now_ms = get_monotonic_msec();
     return out_int(out, expire_at > now_ms ? (expire_at - now_ms) : 0);
 }
@@ -0,0 +1,159 @@
+/**
+ * @file ./lib/server/lazyfree.cpp
+ * @brief the large values are freed in bounded steps, see lazyfree.h
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-23
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <stdlib.h>
+#include <time.h>
+
+/* C++ */
+#include <deque>
+
+/* proj */
+#include <lazyfree.h>
+#include <config.h>
+#include <global.h>
+#include <timer.h>
+
+enum : uint8_t {
+    LF_ZSET = 0,
+    LF_STR  = 1,
+    LF_MEM  = 2,
+};
+
+struct LazyItem {
+    uint8_t kind = LF_ZSET;
+    void *ptr = NULL;
+    size_t size = 0;            /* LF_MEM: the bytes of the block */
+    size_t pos = 0;             /* LF_ZSET: see zset_dispose_some() */
+    LazyStats *stats = NULL;    /* of the shard that queued it */
+};
+
+/* the LAZY_LOOP values of this shard, the oldest first */
+static thread_local std::deque<LazyItem *> t_queue;
+static thread_local LazyStats t_stats;
+/* the window of lazy_free_rate() */
+static thread_local uint64_t t_rate_ms = 0;
+static thread_local uint64_t t_rate_bytes = 0;
+static thread_local uint64_t t_rate = 0;
+
+static uint64_t now_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* returns false when the value is freed, the item is deleted then */
+static bool lazy_step(LazyItem *item) {
+    size_t bytes = 0;
+    bool more = false;
+    switch (item->kind) {
+    case LF_ZSET:
+        more = zset_dispose_some((ZSet *)item->ptr, &item->pos, K_LAZY_FREE_STEP, &bytes);
+        break;
+    case LF_STR:
+        bytes = sizeof(RcStr) + ((RcStr *)item->ptr)->len;
+        rcstr_unref((RcStr *)item->ptr);    /* NOTE: a reply may have taken a reference since */
+        break;
+    case LF_MEM:
+        bytes = item->size;
+        free(item->ptr);
+        break;
+    }
+    LazyStats *stats = item->stats;
+    stats->bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (!more) {
+        stats->items.fetch_add(1, std::memory_order_relaxed);
+        stats->queued.fetch_sub(1, std::memory_order_relaxed);
+        delete item;
+    }
+    return more;
+}
+
+/* LAZY_POOL: a step, then the next one goes to the back of the pool queue */
+static void lazy_job(void *arg) {
+    LazyItem *item = (LazyItem *)arg;
+    if (lazy_step(item)) {
+        thread_pool_queue(&g_thread_pool, &lazy_job, item);
+    }
+}
+
+static void lazy_queue(uint8_t kind, void *ptr, size_t size) {
+    LazyItem *item = new LazyItem();
+    item->kind = kind;
+    item->ptr = ptr;
+    item->size = size;
+    item->stats = &t_stats;
+    t_stats.queued.fetch_add(1, std::memory_order_relaxed);
+    if (g_config.lazy_free == LAZY_POOL) {
+        thread_pool_queue(&g_thread_pool, &lazy_job, item);
+    } else {
+        t_queue.push_back(item);
+    }
+}
+
+void lazy_free_zset(ZSet *zset) {
+    size_t bytes = 0, nodes = 0;
+    zset_cost(zset, &bytes, &nodes);
+    if (lazy_free_cost(bytes, nodes) < g_config.lazy_free_min) {
+        zset_clear(zset);
+        delete zset;
+        return;
+    }
+    hm_rehash_unlist(&zset->hmap);  /* the list of this thread */
+    lazy_queue(LF_ZSET, zset, 0);
+}
+
+void lazy_free_str(RcStr *str) {
+    size_t bytes = sizeof(RcStr) + str->len;
+    if (lazy_free_cost(bytes, 1) < g_config.lazy_free_min
+        || str->refs.load(std::memory_order_relaxed) > 1) {
+        return rcstr_unref(str);    /* small, or not the last reference */
+    }
+    lazy_queue(LF_STR, str, bytes);
+}
+
+void lazy_free_mem(void *ptr, size_t size) {
+    if (!ptr || lazy_free_cost(size, 1) < g_config.lazy_free_min) {
+        return free(ptr);
+    }
+    lazy_queue(LF_MEM, ptr, size);
+}
+
+bool lazy_free_background(uint64_t budget_us) {
+    if (t_queue.empty()) {
+        return false;
+    }
+    uint64_t start = now_usec();
+    do {
+        if (!lazy_step(t_queue.front())) {
+            t_queue.pop_front();
+        }
+    } while (!t_queue.empty() && now_usec() - start < budget_us);
+    return !t_queue.empty();
+}
+
+bool lazy_free_pending() {
+    return !t_queue.empty();
+}
+
+const LazyStats &lazy_free_stats() {
+    return t_stats;
+}
+
+uint64_t lazy_free_rate() {
+    uint64_t now = get_monotonic_msec();
+    uint64_t bytes = t_stats.bytes.load(std::memory_order_relaxed);
+    if (now - t_rate_ms >= 1000) {
+        /* the average since the last window, it's longer if the loop slept */
+        t_rate = t_rate_ms ? (bytes - t_rate_bytes) * 1000 / (now - t_rate_ms) : 0;
+        t_rate_ms = now;
+        t_rate_bytes = bytes;
+    }
+    return t_rate;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file ./lib/server/listpack.cpp
+ * @brief the compact form of a small zset, see listpack.h
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-18
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* proj */
+#include <listpack.h>
+
+/* (score, name) of the member at `pos` < the key */
+static bool lp_less(const ZListpack *lp, uint32_t pos, double score, const char *name, size_t len) {
+    double s = lp_score(lp, pos);
+    if (s != score) {
+        return s < score;
+    }
+    size_t mlen = lp_len(lp, pos);
+    int rv = memcmp(lp_name(lp, pos), name, mlen < len ? mlen : len);
+    return rv != 0 ? rv < 0 : mlen < len;
+}
+
+uint32_t lp_find(const ZListpack *lp, const char *name, size_t len) {
+    uint32_t pos = 0;
+    for (; pos < lp->used; pos = lp_next(lp, pos)) {
+        if (lp_len(lp, pos) == len && memcmp(lp_name(lp, pos), name, len) == 0) {
+            break;
+        }
+    }
+    return pos;
+}
+
+uint32_t lp_seekge(const ZListpack *lp, double score, const char *name, size_t len) {
+    uint32_t pos = 0;
+    while (pos < lp->used && lp_less(lp, pos, score, name, len)) {
+        pos = lp_next(lp, pos);
+    }
+    return pos;
+}
+
+ZListpack *lp_insert(ZListpack *lp, double score, const char *name, size_t len) {
+    assert(len <= 255);
+    uint32_t size = K_LP_OVERHEAD + (uint32_t)len;
+    uint32_t used = lp ? lp->used : 0;
+    if (!lp || used + size > lp->cap) {
+        /* grow by half, so a set filled one by one is copied O(log n) times */
+        uint32_t cap = used + size + used / 2;
+        ZListpack *grown = (ZListpack *)realloc(lp, sizeof(ZListpack) + cap);
+        assert(grown);
+        if (!lp) {
+            grown->n = 0;
+            grown->used = 0;
+        }
+        grown->cap = cap;
+        lp = grown;
+    }
+
+    uint32_t pos = lp_seekge(lp, score, name, len);
+    char *p = lp->data + pos;
+    memmove(p + size, p, lp->used - pos);
+    memcpy(p, &score, sizeof(score));
+    p[8] = (char)(uint8_t)len;
+    memcpy(p + 9, name, len);
+    p[9 + len] = (char)(uint8_t)len;
+    lp->used += size;
+    lp->n++;
+    return lp;
+}
+
+void lp_delete(ZListpack *lp, uint32_t pos) {
+    uint32_t next = lp_next(lp, pos);
+    memmove(lp->data + pos, lp->data + next, lp->used - next);
+    lp->used -= next - pos;
+    lp->n--;
+}
+
+void lp_free(ZListpack *lp) {
+    free(lp);
+}
@@ -0,0 +1,196 @@
+/**
+ * @file ./lib/server/log.cpp
+ * @brief leveled logging through a lock-free ring and a background writer
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-09
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* system */
+#include <pthread.h>
+
+/* C++ */
+#include <atomic>
+
+/* proj */
+#include <log.h>
+#include <err_pack.h>
+#include <defs.h>
+
+std::atomic<int> g_log_level{LL_INFO};
+
+/*
+ * A bounded MPMC queue (D. Vyukov). `seq` of a slot tells its state:
+ * seq == pos: free for the producer of `pos`,
+ * seq == pos + 1: filled, ready for the consumer of `pos`.
+ */
+struct LogSlot {
+    std::atomic<size_t> seq;
+    uint32_t len;
+    char text[K_LOG_LINE];
+};
+
+static LogSlot g_ring[K_LOG_RING];
+alignas(64) static std::atomic<size_t> g_head{0};   /* the next to consume */
+alignas(64) static std::atomic<size_t> g_tail{0};   /* the next to produce */
+static std::atomic<uint64_t> g_dropped{0};
+static std::atomic<bool> g_started{false};
+
+static const char *k_level_names[] = {"debug", "info", "warn", "error"};
+
+/* "hh:mm:ss.mmm [L] " */
+static size_t log_prefix(char *buf, size_t cap, LogLevel level) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct tm tm = {};
+    localtime_r(&ts.tv_sec, &tm);
+    int n = snprintf(buf, cap, "%02d:%02d:%02d.%03ld [%c] ",
+        tm.tm_hour, tm.tm_min, tm.tm_sec, ts.tv_nsec / 1000000,
+        "DIWE"[level]);
+    return n > 0 ? (size_t)n : 0;
+}
+
+/* format the line into `buf`, it's terminated by a newline and may be truncated */
+static uint32_t log_format(char *buf, LogLevel level, const char *fmt, va_list args) {
+    size_t n = log_prefix(buf, K_LOG_LINE, level);
+    int rv = vsnprintf(buf + n, K_LOG_LINE - n, fmt, args);
+    n += rv > 0 ? (size_t)rv : 0;
+    if (n > K_LOG_LINE - 1) {
+        n = K_LOG_LINE - 1;     /* truncated */
+    }
+    buf[n++] = '\n';
+    return (uint32_t)n;
+}
+
+void log_write(LogLevel level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    if (!g_started.load(std::memory_order_acquire)) {
+        /* no writer yet, e.g. the startup or the benchmarks */
+        char buf[K_LOG_LINE];
+        uint32_t len = log_format(buf, level, fmt, args);
+        va_end(args);
+        fwrite(buf, 1, len, stderr);
+        return;
+    }
+
+    /* claim a slot */
+    size_t pos = g_tail.load(std::memory_order_relaxed);
+    LogSlot *slot = NULL;
+    while (true) {
+        slot = &g_ring[pos % K_LOG_RING];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq == pos) {
+            if (g_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }   /* else: `pos` was reloaded */
+        } else if (seq < pos) {
+            /* full, never block the event loop */
+            va_end(args);
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = g_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->len = log_format(slot->text, level, fmt, args);
+    va_end(args);
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+/* move the ready lines into `out`, returns the number of bytes */
+static size_t log_drain(char *out, size_t cap) {
+    size_t n = 0;
+    size_t pos = g_head.load(std::memory_order_relaxed);
+    while (n + K_LOG_LINE <= cap) {
+        LogSlot *slot = &g_ring[pos % K_LOG_RING];
+        if (slot->seq.load(std::memory_order_acquire) != pos + 1) {
+            break;  /* empty, or the producer is still writing */
+        }
+        memcpy(out + n, slot->text, slot->len);
+        n += slot->len;
+        /* free the slot for the next round */
+        slot->seq.store(pos + K_LOG_RING, std::memory_order_release);
+        ++pos;
+    }
+    g_head.store(pos, std::memory_order_relaxed);   /* the single consumer */
+    return n;
+}
+
+static void *log_writer(void *) {
+    static char batch[K_LOG_BATCH];
+    uint64_t reported = 0;
+    while (true) {
+        size_t n = log_drain(batch, sizeof(batch));
+        uint64_t dropped = g_dropped.load(std::memory_order_relaxed);
+        if (dropped != reported && n + K_LOG_LINE <= sizeof(batch)) {
+            n += (size_t)snprintf(batch + n, K_LOG_LINE,
+                "[log] %llu lines dropped\n", (unsigned long long)(dropped - reported));
+            reported = dropped;
+        }
+        if (n == 0) {
+            usleep(K_LOG_IDLE_US);  /* nothing to write */
+            continue;
+        }
+        for (size_t off = 0; off < n; ) {
+            ssize_t rv = write(STDERR_FILENO, batch + off, n - off);
+            if (rv <= 0) {
+                break;  /* nowhere to report it */
+            }
+            off += (size_t)rv;
+        }
+    }
+    return NULL;
+}
+
+void log_init(LogLevel level) {
+    g_log_level.store(level, std::memory_order_relaxed);
+    for (size_t i = 0; i < K_LOG_RING; ++i) {
+        g_ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    fflush(stderr);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, &log_writer, NULL)) {
+        die("pthread_create()");
+    }
+    pthread_detach(tid);
+    g_started.store(true, std::memory_order_release);
+}
+
+void log_flush() {
+    if (!g_started.load(std::memory_order_acquire)) {
+        return;
+    }
+    size_t tail = g_tail.load(std::memory_order_acquire);
+    while (g_head.load(std::memory_order_relaxed) < tail) {
+        usleep(K_LOG_IDLE_US);
+    }
+}
+
+int32_t log_level_parse(const char *name, size_t len) {
+    for (int32_t i = LL_DEBUG; i <= LL_ERROR; ++i) {
+        if (strlen(k_level_names[i]) == len && memcmp(k_level_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *log_level_name(LogLevel level) {
+    return k_level_names[level];
+}
+
+uint64_t log_dropped() {
+    return g_dropped.load(std::memory_order_relaxed);
+}
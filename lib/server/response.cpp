@@ -19,15 +19,19 @@
 /* C++ */
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <iostream>
 
 /* proj */
 #include <utils.h>
 #include <response.h>
 #include <buffer.h>
 #include <defs.h>
-#include <key_value.h>
+#include <command.h>
+#include <log.h>
+#include <config.h>
+#include <stream.h>
+#include <shard.h>
 
 /*
  * +------+-----+------+-----+------+-----+-----+------+
@@ -35,7 +39,7 @@
  * +------+-----+------+-----+------+-----+-----+------+
  */
 int32_t
-parse_req(const uint8_t *data, size_t size, std::vector<std::string> &out) {
+parse_req(const uint8_t *data, size_t size, std::vector<std::string_view> &out) {
     const uint8_t *end = data + size;
     uint32_t nstr = 0;
     if (!read_u32(data, end, nstr)) {
@@ -45,12 +49,13 @@ parse_req(const uint8_t *data, size_t size, std::vector<std::string> &out) {
         return -1;  /* safety limit */
     }
 
+    out.clear();    /* keeps the capacity */
     while (out.size() < nstr) {
         uint32_t len = 0;
         if (!read_u32(data, end, len)) {
             return -1;
         }
-        out.push_back(std::string());
+        out.push_back(std::string_view());
         if (!read_str(data, end, len, out.back())) {
             return -1;
         }
@@ -63,52 +68,113 @@ parse_req(const uint8_t *data, size_t size, std::vector<std::string> &out) {
     return 0;
 }
 
-void do_request(std::vector<std::string> &cmd, Buffer &out) {
-    for (auto &s : cmd) {
-        std::cout << s << " ";
+void do_request(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (log_enabled(LL_DEBUG)) {
+        std::string line;
+        for (std::string_view s : cmd) {
+            line.append(s);
+            line.push_back(' ');
+        }
+        LOG_DEBUG("request: %.*s", (int)line.size(), line.data());
     }
-    if (cmd.size() == 2 && cmd[0] == "get") {
-        return do_get(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "set") {
-        return do_set(cmd, out);
-    } else if (cmd.size() == 2 && cmd[0] == "del") {
-        return do_del(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "pexpire") {
-        return do_expire(cmd, out);
-    } else if (cmd.size() == 2 && cmd[0] == "pttl") {
-        return do_ttl(cmd, out);
-    } else if (cmd.size() == 1 && cmd[0] == "keys") {
-        return do_keys(cmd, out);
-    } else if (cmd.size() == 4 && cmd[0] == "zadd") {
-        return do_zadd(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "zrem") {
-        return do_zrem(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "zscore") {
-        return do_zscore(cmd, out);
-    } else if (cmd.size() == 6 && cmd[0] == "zquery") {
-        return do_zquery(cmd, out);
-    } else {
+    const CmdDesc *desc = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+    if (!desc) {
         return out_err(out, ERR_UNKNOWN, "unknown command.");
     }
+    if (!cmd_arity_ok(desc, cmd.size())) {
+        return out_err(out, ERR_BAD_ARG, "wrong number of arguments.");
+    }
+    if (!shard_keys_together(desc, cmd)) {
+        return out_err(out, ERR_BAD_ARG, "keys in different shards, use a {tag}");
+    }
+    if (desc->open) {
+        Stream *st = desc->open(cmd, out);
+        return st ? stream_drain(st, out) : (void)0;
+    }
+    return desc->handler(cmd, out);
+}
+
+void stream_drain(Stream *st, Buffer &out) {
+    size_t ctx = out_begin_arr(out);
+    uint32_t n = 0;
+    while (st->next(st, out, K_STREAM_CHUNK, &n)) {}
+    st->del(st);
+    out_end_arr(out, ctx, n);
+}
+
+Stream *do_request_stream(std::vector<std::string_view> &cmd, Buffer &out) {
+    const CmdDesc *desc = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+    if (!desc || !desc->open || !cmd_arity_ok(desc, cmd.size())) {
+        size_t header_pos = 0;
+        response_begin(out, &header_pos);
+        do_request(cmd, out);
+        response_end(out, header_pos);
+        return NULL;
+    }
+
+    /* reserve the frame length and the first chunk length */
+    size_t header = buf_size(out);
+    buf_append_u32(out, 0);
+    buf_append_u32(out, 0);
+    Stream *st = desc->open(cmd, out);
+    uint32_t n = 0;
+    size_t ctx = 0;
+    if (st) {
+        ctx = out_begin_arr(out);
+        if (st->next(st, out, K_STREAM_CHUNK, &n)) {
+            /* more to come: a streamed frame of an array of unknown length */
+            out_end_arr(out, ctx, K_STREAM_LEN);
+            uint32_t len = K_STREAM_LEN;
+            uint32_t chunk = (uint32_t)(buf_size(out) - header - 8);
+            memcpy(buf_data(out) + header, &len, 4);
+            memcpy(buf_data(out) + header + 4, &chunk, 4);
+            return st;
+        }
+        st->del(st);
+        out_end_arr(out, ctx, n);
+    }
+
+    /* done in one go: an ordinary frame, drop the chunk length */
+    uint8_t *payload = buf_data(out) + header + 8;
+    memmove(payload - 4, payload, buf_size(out) - header - 8);
+    buf_truncate(out, buf_size(out) - 4);
+    response_end(out, header);
+    return NULL;
+}
+
+bool response_stream_next(Stream *st, Buffer &out) {
+    size_t header = buf_size(out);
+    buf_append_u32(out, 0);
+    uint32_t n = 0;
+    bool more = st->next(st, out, K_STREAM_CHUNK, &n);
+    if (!more) {
+        buf_append_u8(out, TAG_END);
+    }
+    uint32_t chunk = (uint32_t)(buf_size(out) - header - 4);
+    memcpy(buf_data(out) + header, &chunk, 4);
+    if (!more) {
+        buf_append_u32(out, 0);     /* the end of the frame */
+    }
+    return more;
 }
 
 void response_begin(Buffer &out, size_t *header) {
-    *header = out.size();       /* messege header position */
+    *header = buf_size(out);    /* messege header position */
     buf_append_u32(out, 0);     /* reserve space */
 }
 
 size_t response_size(Buffer &out, size_t header) {
-    return out.size() - header - 4;
+    return buf_total_from(out, header + 4);
 }
 
 void response_end(Buffer &out, size_t header) {
     size_t msg_size = response_size(out, header);
-    if (msg_size > K_MAX_MSG) {
-        out.resize(header + 4);
+    if (msg_size > g_config.max_msg) {
+        buf_truncate(out, header + 4);
         out_err(out, ERR_TOO_BIG, "response is too big.");
         msg_size = response_size(out, header);
     }
     /* message header */
     uint32_t len = (uint32_t) msg_size;
-    memcpy(&out[header], &len, 4);
+    memcpy(buf_data(out) + header, &len, 4);
 }
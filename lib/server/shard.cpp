@@ -0,0 +1,518 @@
+/**
+ * @file ./lib/server/shard.cpp
+ * @brief the shared-nothing multi-core mode: one event loop and keyspace shard per thread
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-05
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+/* system */
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/ip.h>
+
+/* C++ */
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <utility>
+
+/* proj */
+#include <shard.h>
+#include <config.h>
+#include <event_loop.h>
+#include <response.h>
+#include <command.h>
+#include <err_pack.h>
+#include <log.h>
+#include <utils.h>
+#include <defs.h>
+#include <HashTable.h>
+#include <global.h>
+#include <lazyfree.h>
+
+static Shard *g_shards = NULL;
+static uint32_t g_nshards = 1;
+
+void shards_init(uint32_t n) {
+    assert(n > 0);
+    g_nshards = n;
+    g_shards = new Shard[n];
+    for (uint32_t i = 0; i < n; ++i) {
+        int rv = pthread_mutex_init(&g_shards[i].mu, NULL);
+        assert(rv == 0);
+        (void)rv;
+        /* the deferred commands come back through it, with one shard too */
+        g_shards[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (g_shards[i].wake_fd < 0) {
+            die("eventfd()");
+        }
+    }
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+
+    /* this is needed for most server applications */
+    int val = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    /* every shard listens on the same port, the kernel balances the connections */
+    if (g_nshards > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))) {
+        die("SO_REUSEPORT");
+    }
+
+    /* bind */
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port); /* Correct network byte order */
+    addr.sin_addr.s_addr = INADDR_ANY; /* Correct address */
+    int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+        die("bind()");
+    }
+
+    /* set the listen fd to nonblocking mode */
+    fd_set_nb(fd);
+
+    /* listen */
+    rv = listen(fd, SOMAXCONN);
+    if (rv) {
+        die("listen()");
+    }
+    return fd;
+}
+
+void shard_serve(uint32_t id) {
+    g_data.shard = id;
+    g_data.wake_fd = g_shards[id].wake_fd;
+    dlist_init(&g_data.idle_list);
+    hm_set_dispose(&lazy_free_mem);
+
+    int fd = listen_on(g_config.port);
+    LOG_INFO("shard %u listening on port %d", id, g_config.port);
+
+    /* the event loop */
+    bool served = false;
+    if (g_config.io == IO_URING) {
+        served = uring_loop(fd);
+        if (!served) {
+            LOG_WARN("io_uring is not available, falling back to epoll");
+        }
+    }
+    if (!served) {
+        epoll_loop(fd);
+    }
+    close(fd);
+    LOG_INFO("shard %u stopped", id);
+}
+
+static void *shard_thread(void *arg) {
+    shard_serve((uint32_t)(uintptr_t)arg);
+    return NULL;
+}
+
+/* the threads of the shards 1..n-1 */
+static std::vector<pthread_t> g_shard_tids;
+
+void shards_start() {
+    for (uint32_t i = 1; i < g_nshards; ++i) {
+        pthread_t tid;
+        int rv = pthread_create(&tid, NULL, &shard_thread, (void *)(uintptr_t)i);
+        if (rv) {
+            die("pthread_create()");
+        }
+        g_shard_tids.push_back(tid);
+    }
+}
+
+void shards_join() {
+    for (pthread_t tid : g_shard_tids) {
+        int rv = pthread_join(tid, NULL);
+        assert(rv == 0);
+        (void)rv;
+    }
+    g_shard_tids.clear();
+}
+
+/* set by shards_stop(), the loops check it once per iteration */
+static std::atomic<bool> g_stop{false};
+
+void shards_stop() {
+    g_stop.store(true, std::memory_order_relaxed);
+    /* NOTE: only async-signal-safe calls, it's called by the signal handler */
+    for (uint32_t i = 0; i < g_nshards; ++i) {
+        uint64_t one = 1;
+        ssize_t rv = write(g_shards[i].wake_fd, &one, sizeof(one));
+        (void)rv;   /* EAGAIN: the counter is already non-zero */
+    }
+}
+
+bool shards_stopping() {
+    return g_stop.load(std::memory_order_relaxed);
+}
+
+/*
+ * the owner of a key. Only the part in the first {...} is hashed if it's not
+ * empty, so the keys of a multi-key command can be put on one shard.
+ */
+static uint32_t shard_of(std::string_view key) {
+    size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close > open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+    uint64_t h = str_hash((uint8_t *)key.data(), key.size());
+    /* the middle bits, the hashtables of a shard index by the low bits, tag by the top ones */
+    return (uint32_t)((h >> 24) % g_nshards);
+}
+
+uint32_t shards_count() {
+    return g_nshards;
+}
+
+/* the shard that runs a command of one key, or of a cursor */
+static uint32_t shard_owner(const CmdDesc *desc, const std::vector<std::string_view> &cmd) {
+    if (desc->flags & CMD_CURSOR) {
+        /* a bad cursor is replied to by any shard */
+        int64_t cursor = 0;
+        if (!str2int(cmd[1], cursor) || cursor < 0) {
+            return g_data.shard;
+        }
+        return (uint32_t)((uint64_t)cursor % g_nshards);
+    }
+    /* the others are on the same shard, see shard_keys_together() */
+    return shard_of(cmd[desc->first_key]);
+}
+
+bool shard_keys_together(const CmdDesc *desc, const std::vector<std::string_view> &cmd) {
+    if (g_nshards == 1 || desc->first_key == 0) {
+        return true;
+    }
+    size_t last = desc->last_key < 0 ? cmd.size() + desc->last_key : (size_t)desc->last_key;
+    if (last == (size_t)desc->first_key && !(desc->flags & CMD_NUMKEYS)) {
+        return true;    /* one key */
+    }
+    uint32_t owner = shard_of(cmd[desc->first_key]);
+    for (size_t i = desc->first_key + desc->key_step; i <= last; i += desc->key_step) {
+        if (shard_of(cmd[i]) != owner) {
+            return false;
+        }
+    }
+    if (!(desc->flags & CMD_NUMKEYS)) {
+        return true;
+    }
+    int64_t n = 0;
+    if (last + 1 >= cmd.size() || !str2int(cmd[last + 1], n) || n < 1 || (size_t)n > cmd.size() - last - 2) {
+        return true;    /* a bad number is replied to by the command */
+    }
+    for (size_t i = last + 2; i < last + 2 + (size_t)n; i++) {
+        if (shard_of(cmd[i]) != owner) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* whether the command is executed by the current shard */
+static bool shard_executes(const CmdDesc *desc, const std::vector<std::string_view> &cmd) {
+    if (g_nshards == 1 || !desc || !cmd_arity_ok(desc, cmd.size())) {
+        return true;    /* an error is replied to locally */
+    }
+    if (desc->flags & CMD_ALL) {
+        return false;
+    }
+    if (desc->first_key == 0 && !(desc->flags & CMD_CURSOR)) {
+        return true;
+    }
+    if (!shard_keys_together(desc, cmd)) {
+        return true;    /* an error is replied to locally */
+    }
+    return shard_owner(desc, cmd) == g_data.shard;
+}
+
+/* the keys held by the deferred commands of this shard, see shard_hold() */
+static thread_local uint32_t t_holds = 0;
+
+bool shard_is_local(const std::vector<std::string_view> &cmd) {
+    const CmdDesc *desc = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+    if (desc && (desc->flags & CMD_ASYNC) && cmd_arity_ok(desc, cmd.size())) {
+        return false;   /* it takes a reply slot, it may be deferred */
+    }
+    if (desc && (desc->flags & CMD_WRITE) && t_holds > 0) {
+        return false;   /* it takes a reply slot, it may be parked */
+    }
+    return shard_executes(desc, cmd);
+}
+
+static void shard_send(uint32_t to, ShardMsg *msg) {
+    Shard *sh = &g_shards[to];
+    pthread_mutex_lock(&sh->mu);
+    bool was_empty = sh->inbox.empty();
+    sh->inbox.push_back(msg);
+    pthread_mutex_unlock(&sh->mu);
+
+    /* NOTE: the receiver resets the eventfd before taking the inbox, no wake up is lost */
+    if (was_empty) {
+        uint64_t one = 1;
+        ssize_t rv = write(sh->wake_fd, &one, sizeof(one));
+        (void)rv;   /* EAGAIN: the counter is already non-zero */
+    }
+}
+
+/* the job of the command being executed, see shard_defer() */
+static thread_local ShardJob t_job;
+
+void shard_defer(void (*run)(void *), void (*finish)(void *, Buffer &), void *arg) {
+    assert(!t_job.run);
+    t_job = ShardJob{run, finish, arg};
+}
+
+/* on the thread pool, then back to the shard that deferred it */
+static void job_run(void *arg) {
+    ShardMsg *msg = (ShardMsg *)arg;
+    msg->job.run(msg->job.arg);
+    shard_send(msg->at, msg);
+}
+
+/* start the job deferred by the command just executed, its reply goes to `msg` */
+static bool job_start(ShardMsg *msg) {
+    if (!t_job.run) {
+        return false;
+    }
+    msg->at = g_data.shard;
+    msg->job = t_job;
+    t_job = ShardJob{};
+    thread_pool_queue(&g_thread_pool, &job_run, msg);
+    return true;
+}
+
+void shard_hold(int delta) {
+    t_holds += delta;
+}
+
+/* the requests parked by shard_park(), in the order they came */
+static thread_local std::vector<ShardMsg *> t_parked;
+/* set by the command being executed, see shard_park() */
+static thread_local bool t_park = false;
+
+void shard_park() {
+    t_park = true;
+}
+
+/* park the request of the command just executed, if it asked for it */
+static bool park_start(ShardMsg *msg) {
+    if (!t_park) {
+        return false;
+    }
+    t_park = false;
+    t_parked.push_back(msg);
+    return true;
+}
+
+/* whether a request of the same connection is parked, the ones behind it wait too */
+static bool conn_parked(const ShardMsg *msg) {
+    for (const ShardMsg *p : t_parked) {
+        if (p->from == msg->from && p->conn_id == msg->conn_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* execute a request into a reply frame */
+static void execute(std::vector<std::string_view> &cmd, Buffer &out) {
+    size_t header_pos = 0;
+    response_begin(out, &header_pos);
+    do_request(cmd, out);
+    response_end(out, header_pos);
+}
+
+void shard_queue(Conn *conn, std::vector<std::string_view> &cmd,
+                 const uint8_t *req, size_t len) {
+    uint32_t self = g_data.shard;
+    const CmdDesc *desc = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+    bool local = shard_executes(desc, cmd);
+    bool fanout = !local && (desc->flags & CMD_ALL);
+
+    conn->replies.emplace_back();
+    Reply &reply = conn->replies.back();
+    reply.seq = conn->next_seq++;
+    reply.barrier = desc && (desc->flags & CMD_ASYNC);
+    reply.parts.resize(fanout ? g_nshards : 1);
+    reply.pending = fanout ? g_nshards - 1 : (local ? 0 : 1);
+
+    for (uint32_t i = 0; !local && i < g_nshards; ++i) {
+        if (fanout ? i == self : i != shard_owner(desc, cmd)) {
+            continue;
+        }
+        ShardMsg *msg = new ShardMsg();
+        msg->from = self;
+        msg->fd = conn->fd;
+        msg->conn_id = conn->id;
+        msg->seq = reply.seq;
+        msg->part = fanout ? i : 0;
+        buf_append(msg->data, req, len);
+        shard_send(i, msg);
+    }
+    if (local || fanout) {
+        execute(cmd, reply.parts[local ? 0 : self]);
+    }
+    if (local && (t_job.run || t_park)) {
+        /* the reply comes back through the inbox, or once it's executed again */
+        ShardMsg *msg = new ShardMsg();
+        msg->from = self;
+        msg->fd = conn->fd;
+        msg->conn_id = conn->id;
+        msg->seq = reply.seq;
+        if (t_park) {
+            buf_append(msg->data, req, len);
+        }
+        if (!park_start(msg)) {
+            job_start(msg);
+        }
+        reply.pending = 1;
+        reply.barrier = true;   /* the requests behind it wait */
+    }
+}
+
+/* combine the array replies of a fan-out, a reply that is not an array wins */
+static void merge_arrays(Buffer &out, std::vector<Buffer> &parts) {
+    uint32_t n = 0;
+    for (Buffer &part : parts) {
+        /* [len:4][TAG_ARR][n:4][elements...] */
+        const uint8_t *p = buf_data(part);
+        if (buf_size(part) < 4 + 1 + 4 || p[4] != TAG_ARR) {
+            buf_move(out, part);
+            return;
+        }
+        uint32_t count = 0;
+        memcpy(&count, p + 5, 4);
+        n += count;
+    }
+
+    size_t header_pos = 0;
+    response_begin(out, &header_pos);
+    out_arr(out, n);
+    for (Buffer &part : parts) {
+        buf_consume(part, 9);
+        buf_move(out, part);
+    }
+    response_end(out, header_pos);
+}
+
+void shard_flush(Conn *conn) {
+    while (!conn->replies.empty() && conn->replies.front().pending == 0) {
+        Reply &reply = conn->replies.front();
+        if (reply.parts.size() == 1) {
+            buf_move(conn->outgoing, reply.parts[0]);
+        } else {
+            merge_arrays(conn->outgoing, reply.parts);
+        }
+        conn->replies.pop_front();
+    }
+}
+
+/*
+ * execute a request for the keys of this shard, false if it's deferred or
+ * parked. It's parked behind a parked request of its connection.
+ */
+static bool run_request(ShardMsg *msg, std::vector<std::string_view> &cmd) {
+    if (conn_parked(msg)) {
+        t_parked.push_back(msg);
+        return false;
+    }
+    Buffer reply;
+    if (parse_req(buf_data(msg->data), buf_size(msg->data), cmd) < 0) {
+        cmd.clear();    /* not reachable, the origin has parsed it */
+    }
+    execute(cmd, reply);
+    if (park_start(msg) || job_start(msg)) {
+        return false;   /* it's sent back when it's executed again, or the job is finished */
+    }
+    std::swap(msg->data, reply);
+    msg->done = true;
+    return true;
+}
+
+/* a reply for a connection of this shard, which may be gone */
+static void deliver(ShardMsg *msg, std::vector<Conn *> &resumed) {
+    Conn *conn = (size_t)msg->fd < g_data.fd2conn.size() ? g_data.fd2conn[msg->fd] : NULL;
+    if (conn && conn->id == msg->conn_id && !conn->replies.empty()) {
+        /* NOTE: the slots are consecutive */
+        Reply &reply = conn->replies[msg->seq - conn->replies.front().seq];
+        std::swap(reply.parts[msg->part], msg->data);
+        /* when the reply in front completes, or a barrier, the requests behind it go on */
+        if (--reply.pending == 0
+            && (reply.seq == conn->replies.front().seq || reply.barrier)) {
+            resumed.push_back(conn);
+        }
+    }
+    delete msg;
+}
+
+void shard_process_inbox(std::vector<Conn *> &resumed) {
+    std::vector<ShardMsg *> msgs;
+    Shard *sh = &g_shards[g_data.shard];
+    pthread_mutex_lock(&sh->mu);
+    msgs.swap(sh->inbox);
+    pthread_mutex_unlock(&sh->mu);
+
+    std::vector<std::string_view> cmd;  /* reused, points into `msg->data` */
+    bool finished = false;              /* a deferred command, its keys are free */
+    for (ShardMsg *msg : msgs) {
+        if (msg->job.finish) {
+            /* a deferred command is done, its reply is written by this shard */
+            Buffer reply;
+            size_t header_pos = 0;
+            response_begin(reply, &header_pos);
+            msg->job.finish(msg->job.arg, reply);
+            response_end(reply, header_pos);
+            std::swap(msg->data, reply);
+            msg->job = ShardJob{};
+            msg->done = true;
+            finished = true;
+            if (msg->from != g_data.shard) {
+                shard_send(msg->from, msg);
+                continue;
+            }
+        } else if (!msg->done) {
+            /* a request for the keys of this shard */
+            if (run_request(msg, cmd)) {
+                shard_send(msg->from, msg);
+            }
+            continue;
+        }
+        deliver(msg, resumed);
+    }
+    if (finished && !t_parked.empty()) {
+        /* the keys it held are free, the parked requests are executed again */
+        std::vector<ShardMsg *> parked;
+        parked.swap(t_parked);
+        for (ShardMsg *msg : parked) {
+            if (!run_request(msg, cmd)) {
+                continue;
+            }
+            if (msg->from != g_data.shard) {
+                shard_send(msg->from, msg);
+            } else {
+                deliver(msg, resumed);
+            }
+        }
+    }
+    /* report each connection once */
+    std::sort(resumed.begin(), resumed.end());
+    resumed.erase(std::unique(resumed.begin(), resumed.end()), resumed.end());
+}
@@ -0,0 +1,278 @@
+/**
+ * @file ./lib/server/slab.cpp
+ * @brief size-class slab allocators, see slab.h
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-16
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <assert.h>
+#include <stdlib.h>
+
+/* C++ */
+#include <atomic>
+
+/* proj */
+#include <slab.h>
+#include <list.h>
+#include <defs.h>
+
+/* 16 bytes apart up to 256, then 64 bytes apart up to K_SLAB_MAX */
+#define K_SLAB_CLASSES (16 + (K_SLAB_MAX - 256) / 64)
+
+static_assert(K_SLAB_MAX > 256 && K_SLAB_MAX % 64 == 0, "see slab_idx()");
+
+struct SlabClass;
+
+/* the header of a page, the objects follow it */
+struct SlabPage {
+    DList node;         /* in SlabClass::avail while it has room */
+    DList link;         /* in SlabClass::all */
+    SlabClass *cls;     /* the owner */
+    void *free;         /* the freed objects, linked through their first word */
+    char *bump;         /* the objects never handed out start here */
+    uint32_t used;
+    uint32_t cap;
+};
+
+struct SlabClass {
+    uint32_t size = 0;
+    uint32_t idx = 0;
+    DList avail;                            /* the pages with room */
+    DList all;                              /* every page */
+    uint64_t pages = 0;
+    uint64_t used = 0;
+    std::atomic<void *> remote{NULL};       /* freed by the other threads */
+};
+
+static const size_t k_page_hdr = (sizeof(SlabPage) + 15) & ~(size_t)15;
+
+struct SlabArena {
+    SlabClass classes[K_SLAB_CLASSES];
+};
+
+/*
+ * the classes of the calling thread, made by its first slab_alloc(). The pages
+ * point to them, so they're on the heap: they outlive the thread if it exits
+ * with objects out, see slab_thread_exit().
+ */
+static thread_local SlabArena *t_own = NULL;
+/* where slab_alloc() takes from instead of t_own, see slab_arena_use() */
+static thread_local SlabArena *t_arena = NULL;
+
+static inline size_t slab_idx(size_t size) {
+    return size <= 256 ? (size + 15) / 16 - (size != 0) : 16 + (size - 257) / 64;
+}
+
+static inline uint32_t slab_size(size_t idx) {
+    return (uint32_t)(idx < 16 ? (idx + 1) * 16 : 256 + (idx - 15) * 64);
+}
+
+static inline SlabPage *page_of(void *ptr) {
+    return (SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(K_SLAB_PAGE - 1));
+}
+
+/* the classes slab_alloc() takes from, the objects of other ones are remote */
+static inline SlabClass *alloc_classes() {
+    SlabArena *arena = t_arena ? t_arena : t_own;
+    return arena ? arena->classes : NULL;
+}
+
+static SlabClass *own_classes() {
+    if (!t_own) {
+        t_own = new SlabArena();
+    }
+    return t_own->classes;
+}
+
+static SlabClass *class_get(SlabClass *classes, size_t idx) {
+    SlabClass *cls = &classes[idx];
+    if (!cls->size) {
+        cls->size = slab_size(idx);
+        cls->idx = (uint32_t)idx;
+        dlist_init(&cls->avail);
+        dlist_init(&cls->all);
+    }
+    return cls;
+}
+
+static SlabPage *page_new(SlabClass *cls) {
+    SlabPage *page = (SlabPage *)aligned_alloc(K_SLAB_PAGE, K_SLAB_PAGE);
+    assert(page);
+    page->cls = cls;
+    page->free = NULL;
+    page->bump = (char *)page + k_page_hdr;
+    page->used = 0;
+    page->cap = (uint32_t)((K_SLAB_PAGE - k_page_hdr) / cls->size);
+    dlist_insert_before(&cls->avail, &page->node);
+    dlist_insert_before(&cls->all, &page->link);
+    cls->pages++;
+    return page;
+}
+
+static void free_local(SlabClass *cls, void *ptr) {
+    SlabPage *page = page_of(ptr);
+    *(void **)ptr = page->free;
+    page->free = ptr;
+    if (page->used == page->cap) {
+        dlist_insert_before(&cls->avail, &page->node);  /* it has room again */
+    }
+    page->used--;
+    cls->used--;
+    if (page->used == 0 && cls->pages > 1) {
+        dlist_detach(&page->node);
+        dlist_detach(&page->link);
+        free(page);
+        cls->pages--;
+    }
+}
+
+static void reclaim_class(SlabClass *cls) {
+    void *ptr = cls->remote.exchange(NULL, std::memory_order_acquire);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        free_local(cls, ptr);
+        ptr = next;
+    }
+}
+
+void *slab_alloc(size_t size) {
+    if (size > K_SLAB_MAX) {
+        return malloc(size);
+    }
+    SlabClass *cls = class_get(t_arena ? t_arena->classes : own_classes(), slab_idx(size));
+    if (cls->remote.load(std::memory_order_relaxed)) {
+        reclaim_class(cls);
+    }
+    SlabPage *page = dlist_empty(&cls->avail) ? page_new(cls)
+                                              : container_of(cls->avail.next, SlabPage, node);
+    void *ptr = page->free;
+    if (ptr) {
+        page->free = *(void **)ptr;
+    } else {
+        ptr = page->bump;
+        page->bump += cls->size;
+    }
+    page->used++;
+    cls->used++;
+    if (page->used == page->cap) {
+        dlist_detach(&page->node);  /* full */
+    }
+    return ptr;
+}
+
+void slab_free(void *ptr, size_t size) {
+    if (size > K_SLAB_MAX) {
+        return free(ptr);
+    }
+    SlabClass *cls = page_of(ptr)->cls;
+    assert(cls->size == slab_size(slab_idx(size)));
+    SlabClass *local = alloc_classes();
+    if (local && cls == &local[cls->idx]) {
+        return free_local(cls, ptr);
+    }
+    /* another thread's: a push to its list, only the owner takes them all */
+    void *head = cls->remote.load(std::memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!cls->remote.compare_exchange_weak(head, ptr, std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+void slab_reclaim() {
+    if (!t_own) {
+        return;
+    }
+    for (SlabClass &cls : t_own->classes) {
+        if (cls.remote.load(std::memory_order_relaxed)) {
+            reclaim_class(&cls);
+        }
+    }
+}
+
+size_t slab_stats(SlabStats *out, size_t max) {
+    slab_reclaim();
+    size_t n = 0;
+    for (size_t i = 0; t_own && i < K_SLAB_CLASSES && n < max; i++) {
+        SlabClass *cls = &t_own->classes[i];
+        if (cls->pages == 0) {
+            continue;
+        }
+        out[n].size = cls->size;
+        out[n].pages = cls->pages;
+        out[n].used = cls->used;
+        out[n].cap = cls->pages * ((K_SLAB_PAGE - k_page_hdr) / cls->size);
+        n++;
+    }
+    return n;
+}
+
+SlabArena *slab_arena_new() {
+    return new SlabArena();
+}
+
+void slab_arena_use(SlabArena *arena) {
+    t_arena = arena;
+}
+
+void slab_adopt(SlabArena *arena) {
+    assert(t_arena != arena);
+    for (size_t i = 0; i < K_SLAB_CLASSES; i++) {
+        SlabClass *from = &arena->classes[i];
+        if (from->pages == 0) {
+            continue;
+        }
+        reclaim_class(from);
+        SlabClass *to = class_get(own_classes(), i);
+        while (!dlist_empty(&from->all)) {
+            SlabPage *page = container_of(from->all.next, SlabPage, link);
+            dlist_detach(&page->link);
+            if (page->used == 0) {
+                dlist_detach(&page->node);
+                free(page);
+                continue;
+            }
+            page->cls = to;
+            dlist_insert_before(&to->all, &page->link);
+            if (page->used < page->cap) {
+                dlist_detach(&page->node);
+                dlist_insert_before(&to->avail, &page->node);
+            }
+            to->pages++;
+        }
+        to->used += from->used;
+    }
+    delete arena;
+}
+
+void slab_thread_exit() {
+    assert(!t_arena);
+    if (!t_own) {
+        return;
+    }
+    bool orphaned = false;
+    for (SlabClass &cls : t_own->classes) {
+        if (cls.pages == 0) {
+            continue;
+        }
+        reclaim_class(&cls);
+        if (cls.used > 0) {
+            orphaned = true;    /* freed later by other threads, to its remote list */
+            continue;
+        }
+        /* nothing is out, nothing can be pushed to it any more */
+        while (!dlist_empty(&cls.all)) {
+            SlabPage *page = container_of(cls.all.next, SlabPage, link);
+            dlist_detach(&page->link);
+            dlist_detach(&page->node);
+            free(page);
+        }
+        cls.pages = 0;
+    }
+    if (!orphaned) {
+        delete t_own;
+    }
+    t_own = NULL;
+}
@@ -1,24 +1,254 @@
 #include <assert.h>
+#include <sched.h>
+#include <atomic>
 #include "thread_pool.h"
+#include "slab.h"
 
 
+// A slot of a deque. A thief may read a slot the owner is reusing, its CAS
+// on `top` fails then and the value is dropped, so the fields are atomic.
+struct PoolSlot {
+    std::atomic<void (*)(void *)> f{NULL};
+    std::atomic<void *> arg{NULL};
+    std::atomic<WorkGroup *> group{NULL};
+};
+
+struct PoolArray {
+    int64_t mask = 0;   // the capacity - 1, a power of 2
+    PoolSlot *slots = NULL;
+};
+
+// the worker of the calling thread, if it is one
+static thread_local PoolWorker *t_worker = NULL;
+// the inbox a thread out of the pool queues to, so 2 shards rarely share one
+static thread_local size_t t_lane = SIZE_MAX;
+static std::atomic<size_t> s_lanes{0};
+
+static PoolArray *array_new(size_t cap) {
+    PoolArray *a = new PoolArray();
+    a->mask = (int64_t)cap - 1;
+    a->slots = new PoolSlot[cap];
+    return a;
+}
+
+static void array_free(PoolArray *a) {
+    delete[] a->slots;
+    delete a;
+}
+
+static void slot_put(PoolArray *a, int64_t i, const PoolTask &t) {
+    PoolSlot &s = a->slots[i & a->mask];
+    s.f.store(t.work.f, std::memory_order_relaxed);
+    s.arg.store(t.work.arg, std::memory_order_relaxed);
+    s.group.store(t.group, std::memory_order_relaxed);
+}
+
+static PoolTask slot_get(PoolArray *a, int64_t i) {
+    PoolSlot &s = a->slots[i & a->mask];
+    PoolTask t;
+    t.work.f = s.f.load(std::memory_order_relaxed);
+    t.work.arg = s.arg.load(std::memory_order_relaxed);
+    t.group = s.group.load(std::memory_order_relaxed);
+    return t;
+}
+
+// The Chase-Lev deque, with the orderings of "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Le et al., 2013).
+
+// by the owner only
+static void deque_push(PoolWorker *w, const PoolTask &t) {
+    int64_t b = w->bottom.load(std::memory_order_relaxed);
+    int64_t top = w->top.load(std::memory_order_acquire);
+    PoolArray *a = w->array.load(std::memory_order_relaxed);
+    if (b - top > a->mask) {
+        // full: a copy twice as large, the old one is freed by thread_pool_stop()
+        PoolArray *bigger = array_new(2 * (size_t)(a->mask + 1));
+        for (int64_t i = top; i < b; i++) {
+            slot_put(bigger, i, slot_get(a, i));
+        }
+        w->retired.push_back(a);
+        w->array.store(bigger, std::memory_order_release);
+        a = bigger;
+    }
+    slot_put(a, b, t);
+    w->bottom.store(b + 1, std::memory_order_release);
+}
+
+// by the owner only, the last pushed first
+static bool deque_take(PoolWorker *w, PoolTask *t) {
+    int64_t b = w->bottom.load(std::memory_order_relaxed) - 1;
+    PoolArray *a = w->array.load(std::memory_order_relaxed);
+    w->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = w->top.load(std::memory_order_relaxed);
+    if (top > b) {
+        w->bottom.store(b + 1, std::memory_order_relaxed);
+        return false;   // empty
+    }
+    *t = slot_get(a, b);
+    if (top < b) {
+        return true;
+    }
+    // the last one, the thieves may race for it
+    bool won = w->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+    w->bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+}
+
+enum {
+    STEAL_EMPTY = 0,
+    STEAL_OK    = 1,
+    STEAL_RETRY = 2,    // lost a race, there may be more
+};
+
+// by any thread, the first pushed first
+static int deque_steal(PoolWorker *w, PoolTask *t) {
+    int64_t top = w->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = w->bottom.load(std::memory_order_acquire);
+    if (top >= b) {
+        return STEAL_EMPTY;
+    }
+    PoolArray *a = w->array.load(std::memory_order_acquire);
+    *t = slot_get(a, top);
+    if (!w->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        return STEAL_RETRY;
+    }
+    return STEAL_OK;
+}
+
+// wake up to n sleeping workers, after the work is queued
+static void pool_notify(TheadPool *tp, size_t n) {
+    // pairs with the fence of a worker going to sleep: it finds the work, or it's counted here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t sleepers = tp->sleepers.load(std::memory_order_relaxed);
+    if (sleepers == 0) {
+        return;
+    }
+    pthread_mutex_lock(&tp->mu);
+    tp->epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (n >= sleepers) {
+        pthread_cond_broadcast(&tp->wake);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            pthread_cond_signal(&tp->wake);
+        }
+    }
+    pthread_mutex_unlock(&tp->mu);
+}
+
+// move the inbox of `from` to the deque of `w`, but the first work goes to `t`
+static bool inbox_drain(PoolWorker *w, PoolWorker *from, PoolTask *t) {
+    if (from->inbox_size.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    std::vector<PoolTask> &tasks = w->drained;
+    tasks.clear();
+    pthread_mutex_lock(&from->inbox_mu);
+    tasks.swap(from->inbox);
+    from->inbox_size.store(0, std::memory_order_relaxed);
+    pthread_mutex_unlock(&from->inbox_mu);
+    if (tasks.empty()) {
+        return false;
+    }
+    // the owner takes the rest in order, the thieves from the end
+    for (size_t i = tasks.size(); i-- > 1;) {
+        deque_push(w, tasks[i]);
+    }
+    if (tasks.size() > 1) {
+        pool_notify(w->tp, tasks.size() - 1);
+    }
+    *t = tasks[0];
+    return true;
+}
+
+static bool find_work(PoolWorker *w, PoolTask *t) {
+    TheadPool *tp = w->tp;
+    size_t n = tp->workers.size();
+    // the own deque first, but the inbox is not left behind for long
+    if (++w->ticks % K_POOL_INBOX_EVERY == 0 && inbox_drain(w, w, t)) {
+        return true;
+    }
+    if (deque_take(w, t)) {
+        return true;
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (inbox_drain(w, tp->workers[(w->id + k) % n], t)) {
+            return true;
+        }
+    }
+    for (size_t k = 1; k < n; k++) {
+        PoolWorker *victim = tp->workers[(w->id + k) % n];
+        int rv;
+        while ((rv = deque_steal(victim, t)) == STEAL_RETRY) {
+        }
+        if (rv == STEAL_OK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void group_finish(WorkGroup *group) {
+    if (group->done) {
+        return group->done(group->done_arg);  // it may free the group
+    }
+    pthread_mutex_lock(&group->mu);
+    group->finished = true;
+    pthread_cond_signal(&group->all_done);
+    pthread_mutex_unlock(&group->mu);
+}
+
+static void task_run(const PoolTask &t) {
+    t.work.f(t.work.arg);
+    if (t.group && t.group->left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        group_finish(t.group);
+    }
+}
+
 static void *worker(void *arg) {
-    TheadPool *tp = (TheadPool *)arg;
+    PoolWorker *w = (PoolWorker *)arg;
+    TheadPool *tp = w->tp;
+    t_worker = w;
+    PoolTask t;
     while (true) {
-        pthread_mutex_lock(&tp->mu);
-        // wait for the condition: a non-empty queue
-        while (tp->queue.empty()) {
-            pthread_cond_wait(&tp->not_empty, &tp->mu);
+        // look for a while before sleeping, a burst of work often follows
+        bool found = false;
+        for (int i = 0; i < K_POOL_SPIN && !found; i++) {
+            found = find_work(w, &t);
+            if (!found) {
+                sched_yield();
+            }
+        }
+        if (found) {
+            task_run(t);
+            continue;
         }
 
-        // got the job
-        Work w = tp->queue.front();
-        tp->queue.pop_front();
+        uint64_t epoch = tp->epoch.load(std::memory_order_acquire);
+        tp->sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (find_work(w, &t)) {
+            tp->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            task_run(t);
+            continue;
+        }
+        if (tp->stopping.load(std::memory_order_acquire)) {
+            tp->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            break;  // all done
+        }
+        pthread_mutex_lock(&tp->mu);
+        while (tp->epoch.load(std::memory_order_relaxed) == epoch
+               && !tp->stopping.load(std::memory_order_relaxed)) {
+            pthread_cond_wait(&tp->wake, &tp->mu);
+        }
         pthread_mutex_unlock(&tp->mu);
-
-        // do the work
-        w.f(w.arg);
+        tp->sleepers.fetch_sub(1, std::memory_order_relaxed);
     }
+    t_worker = NULL;
+    slab_thread_exit();     // the classes of this thread, if any
     return NULL;
 }
 
@@ -27,19 +257,184 @@ void thread_pool_init(TheadPool *tp, size_t num_threads) {
 
     int rv = pthread_mutex_init(&tp->mu, NULL);
     assert(rv == 0);
-    rv = pthread_cond_init(&tp->not_empty, NULL);
+    rv = pthread_cond_init(&tp->wake, NULL);
     assert(rv == 0);
+    tp->stopping.store(false);
 
-    tp->threads.resize(num_threads);
+    tp->workers.resize(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        int rv = pthread_create(&tp->threads[i], NULL, &worker, tp);
+        PoolWorker *w = new PoolWorker();
+        w->tp = tp;
+        w->id = i;
+        w->array.store(array_new(K_POOL_DEQUE));
+        rv = pthread_mutex_init(&w->inbox_mu, NULL);
+        assert(rv == 0);
+        tp->workers[i] = w;
+    }
+    // every worker exists before any one looks for work
+    for (PoolWorker *w : tp->workers) {
+        rv = pthread_create(&w->tid, NULL, &worker, w);
         assert(rv == 0);
     }
 }
 
+void thread_pool_submit(TheadPool *tp, const Work *works, size_t n, WorkGroup *group) {
+    if (group) {
+        group->left.store(n, std::memory_order_relaxed);
+        if (n == 0) {
+            return group_finish(group);
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+    PoolWorker *w = t_worker;
+    if (w && w->tp == tp) {
+        // from a worker: to its own deque, the idle ones steal from it
+        for (size_t i = 0; i < n; i++) {
+            deque_push(w, PoolTask{works[i], group});
+        }
+    } else {
+        assert(!tp->stopping.load(std::memory_order_relaxed));
+        if (t_lane == SIZE_MAX) {
+            t_lane = s_lanes.fetch_add(1, std::memory_order_relaxed);
+        }
+        PoolWorker *to = tp->workers[t_lane % tp->workers.size()];
+        pthread_mutex_lock(&to->inbox_mu);
+        for (size_t i = 0; i < n; i++) {
+            to->inbox.push_back(PoolTask{works[i], group});
+        }
+        to->inbox_size.store(to->inbox.size(), std::memory_order_relaxed);
+        pthread_mutex_unlock(&to->inbox_mu);
+    }
+    pool_notify(tp, n);
+}
+
 void thread_pool_queue(TheadPool *tp, void (*f)(void *), void *arg) {
+    Work w = {f, arg};
+    thread_pool_submit(tp, &w, 1, NULL);
+}
+
+void thread_pool_stop(TheadPool *tp) {
+    tp->stopping.store(true, std::memory_order_release);
     pthread_mutex_lock(&tp->mu);
-    tp->queue.push_back(Work{f, arg});
-    pthread_cond_signal(&tp->not_empty);
+    tp->epoch.fetch_add(1, std::memory_order_seq_cst);
+    pthread_cond_broadcast(&tp->wake);
     pthread_mutex_unlock(&tp->mu);
+
+    // a worker leaves once it finds no work, the works it queues it runs itself
+    for (PoolWorker *w : tp->workers) {
+        int rv = pthread_join(w->tid, NULL);
+        assert(rv == 0);
+    }
+    for (PoolWorker *w : tp->workers) {
+        assert(w->inbox.empty());
+        assert(w->top.load() == w->bottom.load());
+        array_free(w->array.load());
+        for (PoolArray *a : w->retired) {
+            array_free(a);
+        }
+        pthread_mutex_destroy(&w->inbox_mu);
+        delete w;
+    }
+    tp->workers.clear();
+    pthread_mutex_destroy(&tp->mu);
+    pthread_cond_destroy(&tp->wake);
+}
+
+void work_group_init(WorkGroup *group, void (*done)(void *), void *arg) {
+    group->left.store(0, std::memory_order_relaxed);
+    group->done = done;
+    group->done_arg = arg;
+    group->finished = false;
+    if (!done) {
+        pthread_mutex_init(&group->mu, NULL);
+        pthread_cond_init(&group->all_done, NULL);
+    }
+}
+
+void work_group_wait(TheadPool *tp, WorkGroup *group) {
+    assert(!group->done);
+    PoolWorker *w = t_worker;
+    if (w && w->tp == tp) {
+        // the works of the group may be behind this one, in any deque
+        PoolTask t;
+        while (group->left.load(std::memory_order_acquire) > 0 && find_work(w, &t)) {
+            task_run(t);
+        }
+    }
+    // the finisher signals under the lock, and doesn't touch the group after it
+    pthread_mutex_lock(&group->mu);
+    while (!group->finished) {
+        pthread_cond_wait(&group->all_done, &group->mu);
+    }
+    pthread_mutex_unlock(&group->mu);
+    pthread_mutex_destroy(&group->mu);
+    pthread_cond_destroy(&group->all_done);
+}
+
+// the shared state of a thread_pool_for(), freed by the last one out
+struct ForJob {
+    void (*f)(void *, size_t) = NULL;
+    void *arg = NULL;
+    size_t n = 0;
+    std::atomic<size_t> next{0};    // the next item to take
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> refs{0};
+    pthread_mutex_t mu;
+    pthread_cond_t all_done;
+};
+
+static void for_unref(ForJob *job) {
+    if (job->refs.fetch_sub(1) == 1) {
+        pthread_mutex_destroy(&job->mu);
+        pthread_cond_destroy(&job->all_done);
+        delete job;
+    }
+}
+
+static void for_take(ForJob *job) {
+    size_t cnt = 0;
+    for (size_t i = job->next.fetch_add(1); i < job->n; i = job->next.fetch_add(1)) {
+        job->f(job->arg, i);
+        cnt++;
+    }
+    if (cnt && job->done.fetch_add(cnt) + cnt == job->n) {
+        pthread_mutex_lock(&job->mu);
+        pthread_cond_signal(&job->all_done);
+        pthread_mutex_unlock(&job->mu);
+    }
+}
+
+static void for_helper(void *arg) {
+    ForJob *job = (ForJob *)arg;
+    for_take(job);
+    for_unref(job);
+}
+
+void thread_pool_for(TheadPool *tp, size_t n, void (*f)(void *, size_t), void *arg) {
+    if (n == 0) {
+        return;
+    }
+    ForJob *job = new ForJob();
+    job->f = f;
+    job->arg = arg;
+    job->n = n;
+    pthread_mutex_init(&job->mu, NULL);
+    pthread_cond_init(&job->all_done, NULL);
+
+    // the helpers that come late find nothing left, and only drop their ref
+    size_t helpers = n - 1 < tp->workers.size() ? n - 1 : tp->workers.size();
+    job->refs = helpers + 1;
+    std::vector<Work> works(helpers, Work{&for_helper, job});
+    thread_pool_submit(tp, works.data(), helpers, NULL);
+    for_take(job);
+
+    // wait for the items taken by the helpers
+    pthread_mutex_lock(&job->mu);
+    while (job->done.load() < n) {
+        pthread_cond_wait(&job->all_done, &job->mu);
+    }
+    pthread_mutex_unlock(&job->mu);
+    for_unref(job);
 }
@@ -17,6 +17,9 @@
 #include <global.h>
 #include <heap.h>
 #include <key_value.h>
+#include <lazyfree.h>
+#include <log.h>
+#include <slab.h>
 
 uint64_t get_monotonic_msec() {
     struct timespec tv = {0, 0};
@@ -36,6 +39,10 @@ uint32_t next_timer_ms() {
     if (!g_data.heap.empty() && g_data.heap[0].val < next_ms) {
         next_ms = g_data.heap[0].val;
     }
+    /* background work, poll without waiting */
+    if (hm_rehash_pending() || lazy_free_pending()) {
+        return 0;
+    }
     /* timeout value */
     if (next_ms == (uint64_t)-1) {
         return -1;  /* no timers, no timeouts */
@@ -57,7 +64,7 @@ void process_timers() {
             break;  /* not expired */
         }
 
-        fprintf(stderr, "removing idle connection: %d\n", conn->fd);
+        LOG_DEBUG("removing idle connection: %d", conn->fd);
         conn_destroy(conn);
     }
 
@@ -65,10 +72,10 @@ void process_timers() {
     size_t nworks = 0;
     const std::vector<HeapItem> &heap = g_data.heap;
     while (!heap.empty() && heap[0].val < now_ms) {
-        Entry *ent = container_of(heap[0].ref, Entry, heap_idx);
+        Entry *ent = container_of(heap[0].ref, Entry, data);  /* see entry_heap_idx() */
         HNode *node = hm_delete(&g_data.db, &ent->node, &hnode_same);
         assert(node == &ent->node);
-        fprintf(stderr, "key expired: %s\n", ent->key.c_str());
+        LOG_DEBUG("key expired: %.*s", (int)ent->klen, entry_key(ent).data());
         /* delete the key */
         entry_del(ent);
         if (nworks++ >= K_MAX_WORKS) {
@@ -77,3 +84,12 @@ void process_timers() {
         }
     }
 }
+
+void process_background(bool idle) {
+    /* move the migrating hashtables on: the db and the large zsets */
+    hm_rehash_background(idle ? K_REHASH_IDLE_US : K_REHASH_BUSY_US);
+    /* the deleted values, see lazyfree.h */
+    lazy_free_background(idle ? K_LAZY_FREE_IDLE_US : K_LAZY_FREE_BUSY_US);
+    /* the objects freed by the thread pool */
+    slab_reclaim();
+}
@@ -7,17 +7,21 @@
  * @copyright Copyright (c) 2025
  */
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
+/* C++ */
+#include <algorithm>
+#include <vector>
 /* proj */
 #include <zset.h>
+#include <slab.h>
+#include <config.h>
 #include <defs.h>
 
 ZNode *znode_new(const char *name, size_t len, double score) {
-    ZNode *node = (ZNode *)malloc(sizeof(ZNode) + len);
-    assert(node);   /* not a good idea in real projects */
+    ZNode *node = (ZNode *)slab_alloc(sizeof(ZNode) + len);
     avl_init(&node->tree);
-    node->hmap.next = NULL;
     node->hmap.hcode = str_hash((uint8_t *)name, len);
     node->score = score;
     node->len = len;
@@ -25,8 +29,9 @@ ZNode *znode_new(const char *name, size_t len, double score) {
     return node;
 }
 
+/* maybe on a thread of the pool, see slab_free() */
 void znode_del(ZNode *node) {
-    free(node);
+    slab_free(node, sizeof(ZNode) + node->len);
 }
 
 size_t min(size_t lhs, size_t rhs) {
@@ -52,7 +57,8 @@ bool zless(AVLNode *lhs, AVLNode *rhs) {
 }
 
 /* insert into the AVL tree */
-void tree_insert(ZSet *zset, ZNode *node) {
+void avl_insert(ZSet *zset, ZNode *node) {
+    node->tree.val = node->tree.sum = node->score;
     AVLNode *parent = NULL;         /* insert under this node */
     AVLNode **from = &zset->root;   /* the incoming pointer to the next node */
     while (*from) {                 /* tree search */
@@ -64,21 +70,97 @@ void tree_insert(ZSet *zset, ZNode *node) {
     zset->root = avl_fix(&node->tree);
 }
 
+/* insert into the (score, name) index */
+void tree_insert(ZSet *zset, ZNode *node) {
+    if (zset->index == Z_BTREE) {
+        bt_insert(&zset->btree, node);
+    } else {
+        avl_insert(zset, node);
+    }
+}
+
+/* detach from the (score, name) index */
+void tree_delete(ZSet *zset, ZNode *node) {
+    if (zset->index == Z_BTREE) {
+        bt_delete(&zset->btree, node);
+    } else {
+        zset->root = avl_del(&node->tree);
+        avl_init(&node->tree);
+    }
+}
+
 /* update the score of an existing node */
 void zset_update(ZSet *zset, ZNode *node, double score) {
     if (node->score == score) {
         return;
     }
-    /* detach the tree node */
-    zset->root = avl_del(&node->tree);
-    avl_init(&node->tree);
+    /* detach the tree node, by the old score */
+    tree_delete(zset, node);
     /* reinsert the tree node */
     node->score = score;
     tree_insert(zset, node);
 }
 
+/* index the nodes sorted by (score, name), in O(n), the index is empty */
+static void tree_build(ZSet *zset, std::vector<ZNode *> &nodes) {
+    if (zset->index == Z_BTREE) {
+        return bt_build(&zset->btree, nodes.data(), nodes.size());
+    }
+    std::vector<AVLNode *> tnodes(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        tnodes[i] = &nodes[i]->tree;
+        tnodes[i]->val = nodes[i]->score;
+    }
+    zset->root = avl_build(tnodes.data(), tnodes.size());
+}
+
+/* move the packed members to the indexes, they are in order already */
+static void zset_unpack(ZSet *zset) {
+    ZListpack *lp = zset->lp;
+    std::vector<ZNode *> nodes;
+    if (lp) {
+        nodes.reserve(lp->n + 1);
+        hm_reserve(&zset->hmap, lp->n + 1);
+    }
+    for (uint32_t pos = 0; lp && pos < lp->used; pos = lp_next(lp, pos)) {
+        ZNode *node = znode_new(lp_name(lp, pos), lp_len(lp, pos), lp_score(lp, pos));
+        hm_insert(&zset->hmap, &node->hmap);
+        nodes.push_back(node);
+    }
+    tree_build(zset, nodes);
+    lp_free(lp);
+    zset->lp = NULL;
+    zset->packed = false;
+}
+
+/* add or update a packed member, false if it doesn't fit any more */
+static bool lp_upsert(ZSet *zset, const char *name, size_t len, double score, bool *added) {
+    ZListpack *lp = zset->lp;
+    uint32_t pos = lp ? lp_find(lp, name, len) : 0;
+    *added = !lp || pos == lp->used;
+    if (len > g_config.zset_lp_value
+        || (*added && (lp ? lp->n : 0) >= g_config.zset_lp_entries)) {
+        return false;
+    }
+    if (!*added) {
+        if (lp_score(lp, pos) == score) {
+            return true;
+        }
+        lp_delete(lp, pos);     /* and back at its new place */
+    }
+    zset->lp = lp_insert(lp, score, name, len);
+    return true;
+}
+
 /* add a new (score, name) tuple, or update the score of the existing tuple */
 bool zset_insert(ZSet *zset, const char *name, size_t len, double score) {
+    if (zset->packed) {
+        bool added = false;
+        if (lp_upsert(zset, name, len, score, &added)) {
+            return added;
+        }
+        zset_unpack(zset);
+    }
     ZNode *node = zset_lookup(zset, name, len);
     if (node) {
         zset_update(zset, node, score);
@@ -91,6 +173,83 @@ bool zset_insert(ZSet *zset, const char *name, size_t len, double score) {
     }
 }
 
+static bool znode_less(const ZNode *a, const ZNode *b) {
+    if (a->score != b->score) {
+        return a->score < b->score;
+    }
+    int rv = memcmp(a->name, b->name, min(a->len, b->len));
+    return rv != 0 ? rv < 0 : a->len < b->len;
+}
+
+static bool cb_collect(HNode *node, void *arg) {
+    ((std::vector<ZNode *> *)arg)->push_back(container_of(node, ZNode, hmap));
+    return true;
+}
+
+/*
+ * Add or update many members, a later pair of the same name wins. Into a
+ * smaller zset, the scores are set in place and the whole index is built
+ * again from the sorted members, instead of rebalancing for each one.
+ */
+size_t zset_add(ZSet *zset, const ZPair *pairs, size_t n) {
+    if (zset->packed && zset_size(zset) + n > g_config.zset_lp_entries) {
+        zset_unpack(zset);
+    }
+    if (!zset->packed) {
+        hm_reserve(&zset->hmap, zset_size(zset) + n);
+    }
+    size_t added = 0;
+    if (zset->packed || n < K_ZSET_BULK_MIN || zset_size(zset) > n) {
+        for (size_t i = 0; i < n; i++) {
+            added += zset_insert(zset, pairs[i].name, pairs[i].len, pairs[i].score);
+        }
+        return added;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        ZNode *node = zset_lookup(zset, pairs[i].name, pairs[i].len);
+        if (node) {
+            node->score = pairs[i].score;   /* out of order until it's rebuilt */
+        } else {
+            node = znode_new(pairs[i].name, pairs[i].len, pairs[i].score);
+            hm_insert(&zset->hmap, &node->hmap);
+            added++;
+        }
+    }
+    std::vector<ZNode *> nodes;
+    nodes.reserve(zset_size(zset));
+    hm_foreach(&zset->hmap, &cb_collect, &nodes);
+    std::sort(nodes.begin(), nodes.end(), &znode_less);
+    if (zset->index == Z_BTREE) {
+        bt_clear(&zset->btree, NULL);   /* the nodes only */
+    }
+    tree_build(zset, nodes);
+    return added;
+}
+
+void zset_build(ZSet *zset, const ZPair *pairs, size_t n) {
+    assert(zset_size(zset) == 0);
+    bool fits = n <= g_config.zset_lp_entries;
+    for (size_t i = 0; fits && i < n; i++) {
+        fits = pairs[i].len <= g_config.zset_lp_value;
+    }
+    if (fits) {
+        for (size_t i = 0; i < n; i++) {
+            zset->lp = lp_insert(zset->lp, pairs[i].score, pairs[i].name, pairs[i].len);
+        }
+        return;
+    }
+
+    zset->packed = false;
+    hm_reserve(&zset->hmap, n);     /* NOTE: no rehashing, it may be built on any thread */
+    std::vector<ZNode *> nodes(n);
+    for (size_t i = 0; i < n; i++) {
+        nodes[i] = znode_new(pairs[i].name, pairs[i].len, pairs[i].score);
+        hm_insert(&zset->hmap, &nodes[i]->hmap);
+    }
+    tree_build(zset, nodes);
+}
+
 /* a helper structure for the hashtable lookup */
 struct HKey {
     HNode node;
@@ -109,7 +268,7 @@ bool hcmp(HNode *node, HNode *key) {
 
 /* lookup by name */
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
-    if (!zset->root) {
+    if (hm_size(&zset->hmap) == 0) {
         return NULL;
     }
 
@@ -121,6 +280,154 @@ ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
     return found ? container_of(found, ZNode, hmap) : NULL;
 }
 
+bool zset_score(ZSet *zset, const char *name, size_t len, double *score) {
+    if (zset->packed) {
+        uint32_t pos = zset->lp ? lp_find(zset->lp, name, len) : 0;
+        if (!zset->lp || pos == zset->lp->used) {
+            return false;
+        }
+        *score = lp_score(zset->lp, pos);
+        return true;
+    }
+    ZNode *node = zset_lookup(zset, name, len);
+    if (node) {
+        *score = node->score;
+    }
+    return node != NULL;
+}
+
+bool zset_remove(ZSet *zset, const char *name, size_t len) {
+    if (zset->packed) {
+        uint32_t pos = zset->lp ? lp_find(zset->lp, name, len) : 0;
+        if (!zset->lp || pos == zset->lp->used) {
+            return false;
+        }
+        lp_delete(zset->lp, pos);
+        return true;
+    }
+    ZNode *node = zset_lookup(zset, name, len);
+    if (node) {
+        zset_delete(zset, node);
+    }
+    return node != NULL;
+}
+
+size_t zset_size(ZSet *zset) {
+    if (zset->packed) {
+        return zset->lp ? zset->lp->n : 0;
+    }
+    return hm_size(&zset->hmap);
+}
+
+/* the 0-based rank of a member, -1 if it's not one */
+int64_t zset_rank(ZSet *zset, const char *name, size_t len) {
+    if (zset->packed) {
+        ZListpack *lp = zset->lp;
+        int64_t rank = 0;
+        for (uint32_t pos = 0; lp && pos < lp->used; pos = lp_next(lp, pos), rank++) {
+            if (lp_len(lp, pos) == len && memcmp(lp_name(lp, pos), name, len) == 0) {
+                return rank;
+            }
+        }
+        return -1;
+    }
+    ZNode *node = zset_lookup(zset, name, len);
+    if (!node) {
+        return -1;
+    }
+    return zset->index == Z_BTREE ? bt_rank(&zset->btree, node) : avl_rank(&node->tree);
+}
+
+/* the number of the members with a score < `score`, or <= with `incl` */
+int64_t zset_prefix(ZSet *zset, double score, bool incl) {
+    if (incl && score == INFINITY) {
+        return (int64_t)zset_size(zset);
+    }
+    if (incl) {
+        score = nextafter(score, INFINITY);
+    }
+    int64_t n = 0;
+    if (zset->packed) {
+        ZListpack *lp = zset->lp;
+        for (uint32_t pos = 0; lp && pos < lp->used && lp_score(lp, pos) < score;
+             pos = lp_next(lp, pos)) {
+            n++;
+        }
+    } else if (zset->index == Z_BTREE) {
+        n = bt_prefix(&zset->btree, score);
+    } else {
+        for (AVLNode *node = zset->root; node; ) {
+            if (container_of(node, ZNode, tree)->score < score) {
+                n += avl_cnt(node->left) + 1;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+    }
+    return n;
+}
+
+static bool score_above(double s, double min, bool ex) {
+    return ex ? s > min : s >= min;
+}
+
+static bool score_below(double s, double max, bool ex) {
+    return ex ? s < max : s <= max;
+}
+
+double zset_sum(ZSet *zset, double min, bool min_ex, double max, bool max_ex) {
+    double sum = 0;
+    if (zset->packed) {
+        ZListpack *lp = zset->lp;
+        for (uint32_t pos = 0; lp && pos < lp->used; pos = lp_next(lp, pos)) {
+            double s = lp_score(lp, pos);
+            if (!score_below(s, max, max_ex)) {
+                break;
+            }
+            sum += score_above(s, min, min_ex) ? s : 0;
+        }
+        return sum;
+    }
+    if (zset->index == Z_BTREE) {
+        return bt_sum(&zset->btree, min, min_ex, max, max_ex);
+    }
+    /* down to the highest node in the range, then along the 2 bounds under it */
+    AVLNode *top = zset->root;
+    while (top) {
+        double s = container_of(top, ZNode, tree)->score;
+        if (!score_above(s, min, min_ex)) {
+            top = top->right;
+        } else if (!score_below(s, max, max_ex)) {
+            top = top->left;
+        } else {
+            break;
+        }
+    }
+    if (!top) {
+        return 0;
+    }
+    sum = top->val;
+    /* the left subtree is below `max`, a node above `min` comes with its right subtree */
+    for (AVLNode *node = top->left; node; ) {
+        if (score_above(container_of(node, ZNode, tree)->score, min, min_ex)) {
+            sum += node->val + avl_sum(node->right);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    for (AVLNode *node = top->right; node; ) {
+        if (score_below(container_of(node, ZNode, tree)->score, max, max_ex)) {
+            sum += node->val + avl_sum(node->left);
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return sum;
+}
+
 /* delete a node */
 void zset_delete(ZSet *zset, ZNode *node) {
     /* remove from the hashtable */
@@ -131,13 +438,71 @@ void zset_delete(ZSet *zset, ZNode *node) {
     HNode *found = hm_delete(&zset->hmap, &key.node, &hcmp);
     assert(found);
     /* remove from the tree */
-    zset->root = avl_del(&node->tree);
+    tree_delete(zset, node);
     /* deallocate the node */
     znode_del(node);
 }
 
+/* fill in the member at the position */
+static ZIter zit_load(ZSet *zset, ZIter it) {
+    if (zset->packed) {
+        ZListpack *lp = zset->lp;
+        it.valid = lp && it.pos < lp->used;
+        if (it.valid) {
+            it.score = lp_score(lp, it.pos);
+            it.name = lp_name(lp, it.pos);
+            it.len = lp_len(lp, it.pos);
+        }
+        return it;
+    }
+    if (zset->index == Z_BTREE) {
+        it.node = bpos_item(it.bpos);
+    }
+    it.valid = it.node != NULL;
+    if (it.valid) {
+        it.score = it.node->score;
+        it.name = it.node->name;
+        it.len = it.node->len;
+    }
+    return it;
+}
+
+/* the member of a 0-based rank, the end if out of range */
+ZIter zset_select(ZSet *zset, int64_t rank) {
+    ZIter it;
+    if (rank < 0 || rank >= (int64_t)zset_size(zset)) {
+        it.pos = zset->lp ? zset->lp->used : 0;
+        return it;      /* not valid */
+    }
+    if (zset->packed) {
+        for (; rank > 0; rank--) {
+            it.pos = lp_next(zset->lp, it.pos);
+        }
+    } else if (zset->index == Z_BTREE) {
+        it.bpos = bt_select(&zset->btree, rank);
+    } else {
+        AVLNode *root = zset->root;
+        it.node = container_of(avl_offset(root, rank - avl_cnt(root->left)), ZNode, tree);
+    }
+    return zit_load(zset, it);
+}
+
+/* the least (score, name) tuple */
+ZIter zset_begin(ZSet *zset) {
+    return zset_select(zset, 0);
+}
+
 /* find the first (score, name) tuple that is >= key */
-ZNode *zset_seekge(ZSet *zset, double score, const char *name, size_t len) {
+ZIter zset_seekge(ZSet *zset, double score, const char *name, size_t len) {
+    ZIter it;
+    if (zset->packed) {
+        it.pos = zset->lp ? lp_seekge(zset->lp, score, name, len) : 0;
+        return zit_load(zset, it);
+    }
+    if (zset->index == Z_BTREE) {
+        it.bpos = bt_seekge(&zset->btree, score, name, len);
+        return zit_load(zset, it);
+    }
     AVLNode *found = NULL;
     for (AVLNode *node = zset->root; node; ) {
         if (zless(node, score, name, len)) {
@@ -147,27 +512,135 @@ ZNode *zset_seekge(ZSet *zset, double score, const char *name, size_t len) {
             node = node->left;
         }
     }
-    return found ? container_of(found, ZNode, tree) : NULL;
+    it.node = found ? container_of(found, ZNode, tree) : NULL;
+    return zit_load(zset, it);
+}
+
+/* the last (score, name) tuple that is <= key */
+ZIter zset_seekle(ZSet *zset, double score, const char *name, size_t len) {
+    ZIter it = zset_seekge(zset, score, name, len);
+    if (it.valid && it.score == score && it.len == len && memcmp(it.name, name, len) == 0) {
+        return it;
+    }
+    return it.valid ? zset_prev(zset, it) : zset_select(zset, (int64_t)zset_size(zset) - 1);
+}
+
+ZIter zset_next(ZSet *zset, ZIter it) {
+    if (!it.valid) {
+        return it;
+    }
+    if (zset->packed) {
+        it.pos = lp_next(zset->lp, it.pos);
+    } else if (zset->index == Z_BTREE) {
+        it.bpos = bt_offset(&zset->btree, it.bpos, +1);
+    } else {
+        AVLNode *tnode = avl_next(&it.node->tree);
+        it.node = tnode ? container_of(tnode, ZNode, tree) : NULL;
+    }
+    return zit_load(zset, it);
+}
+
+ZIter zset_prev(ZSet *zset, ZIter it) {
+    if (!it.valid) {
+        return it;
+    }
+    if (zset->packed) {
+        it.pos = it.pos > 0 ? lp_prev(zset->lp, it.pos) : zset->lp->used;
+    } else if (zset->index == Z_BTREE) {
+        it.bpos = bt_offset(&zset->btree, it.bpos, -1);
+    } else {
+        AVLNode *tnode = avl_prev(&it.node->tree);
+        it.node = tnode ? container_of(tnode, ZNode, tree) : NULL;
+    }
+    return zit_load(zset, it);
 }
 
 /* offset into the succeeding or preceding node */
-ZNode *znode_offset(ZNode *node, int64_t offset) {
-    AVLNode *tnode = node ? avl_offset(&node->tree, offset) : NULL;
-    return tnode ? container_of(tnode, ZNode, tree) : NULL;
+ZIter zset_offset(ZSet *zset, ZIter it, int64_t offset) {
+    if (!it.valid) {
+        return it;
+    }
+    if (zset->packed) {
+        ZListpack *lp = zset->lp;
+        for (; offset > 0 && it.pos < lp->used; offset--) {
+            it.pos = lp_next(lp, it.pos);
+        }
+        for (; offset < 0 && it.pos > 0; offset++) {
+            it.pos = lp_prev(lp, it.pos);
+        }
+        if (offset < 0) {
+            it.pos = lp->used;  /* before the first one */
+        }
+    } else if (zset->index == Z_BTREE) {
+        it.bpos = bt_offset(&zset->btree, it.bpos, offset);
+    } else {
+        AVLNode *tnode = avl_offset(&it.node->tree, offset);
+        it.node = tnode ? container_of(tnode, ZNode, tree) : NULL;
+    }
+    return zit_load(zset, it);
 }
 
-void tree_dispose(AVLNode *node) {
+void avl_dispose(AVLNode *node) {
     if (!node) {
         return;
     }
-    tree_dispose(node->left);
-    tree_dispose(node->right);
+    avl_dispose(node->left);
+    avl_dispose(node->right);
     znode_del(container_of(node, ZNode, tree));
 }
 
+/* the hash tables of a zset, and its packed form */
+static size_t zset_table_bytes(ZSet *zset) {
+    size_t slots = hm_slots(&zset->hmap) + hm_older_slots(&zset->hmap);
+    return slots * (1 + sizeof(HNode *)) + (zset->lp ? sizeof(ZListpack) + zset->lp->cap : 0);
+}
+
+void zset_cost(ZSet *zset, size_t *bytes, size_t *nodes) {
+    size_t n = hm_size(&zset->hmap);
+    /* a B+tree leaf per K_BTREE_FAN / 2 members at least */
+    size_t tnodes = zset->index == Z_BTREE ? n / (K_BTREE_FAN / 2) + 1 : 0;
+    *nodes = n + tnodes;
+    *bytes = zset_table_bytes(zset) + n * (sizeof(ZNode) + 8) + tnodes * sizeof(BLeaf);
+}
+
+struct DisposeArg {
+    size_t budget;
+    size_t bytes = 0;
+};
+
+static bool cb_dispose(HNode *node, void *arg) {
+    DisposeArg *da = (DisposeArg *)arg;
+    ZNode *znode = container_of(node, ZNode, hmap);
+    da->bytes += sizeof(ZNode) + znode->len;
+    znode_del(znode);
+    return --da->budget > 0;
+}
+
+bool zset_dispose_some(ZSet *zset, size_t *pos, size_t budget, size_t *bytes) {
+    /* the nodes, by the slots of the hash table, which are still read */
+    if (*pos != (size_t)-1) {
+        DisposeArg da = {budget};
+        *pos = hm_foreach_from(&zset->hmap, *pos, &cb_dispose, &da);
+        *bytes += da.bytes;
+        return true;
+    }
+    if (zset->btree.root) {
+        *bytes += bt_clear_some(&zset->btree, budget);
+        return true;
+    }
+    *bytes += zset_table_bytes(zset);
+    lp_free(zset->lp);
+    hm_clear(&zset->hmap);
+    delete zset;
+    return false;
+}
+
 /* destroy the zset */
 void zset_clear(ZSet *zset) {
+    lp_free(zset->lp);
+    zset->lp = NULL;
     hm_clear(&zset->hmap);
-    tree_dispose(zset->root);
+    avl_dispose(zset->root);
     zset->root = NULL;
+    bt_clear(&zset->btree, &znode_del);
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+/**
+ * @file ./lib/server/zstore.cpp
+ * @brief zunionstore and zinterstore, see zstore.h
+ * @author Fendy (xingfen.star@gmail.com)
+ * @version 1.0
+ * @date 2025-04-22
+ * @copyright Copyright (c) 2025
+ */
+
+/* stdlib */
+#include <math.h>
+#include <string.h>
+
+/* C++ */
+#include <algorithm>
+
+/* proj */
+#include <zstore.h>
+#include <config.h>
+#include <HashTable.h>
+
+static void zstore_item(ZStore *zs, uint64_t hcode, double score, const char *name, size_t len) {
+    /* the high bits pick the partition, the low ones the slot in it */
+    ZStorePart *part = &zs->parts[(hcode >> 40) % K_ZSTORE_PARTS];
+    part->items.push_back(ZStoreItem{hcode, score, (uint32_t)part->names.size(), (uint32_t)len});
+    part->names.append(name, len);
+    zs->nitems++;
+}
+
+/* the nodes are visited in batches, each one prefetched a batch ahead of its use */
+struct AddArg {
+    ZStore *zs;
+    double weight;
+    size_t n = 0;
+    ZNode *batch[K_ZSTORE_BATCH];
+};
+
+/* 0 * inf is 0 */
+static double zstore_weigh(double score, double weight) {
+    double s = score * weight;
+    return isnan(s) ? 0 : s;
+}
+
+static void add_batch(AddArg *aa) {
+    for (size_t i = 0; i < aa->n; i++) {
+        ZNode *znode = aa->batch[i];
+        zstore_item(aa->zs, znode->hmap.hcode, zstore_weigh(znode->score, aa->weight),
+                    znode->name, znode->len);
+    }
+    aa->n = 0;
+}
+
+static bool cb_add(HNode *node, void *arg) {
+    AddArg *aa = (AddArg *)arg;
+    ZNode *znode = container_of(node, ZNode, hmap);
+    __builtin_prefetch(&znode->score);
+    aa->batch[aa->n++] = znode;
+    if (aa->n == K_ZSTORE_BATCH) {
+        add_batch(aa);
+    }
+    return true;
+}
+
+void zstore_add(ZStore *zs, ZSet *zset, double weight) {
+    zs->ninputs++;
+    if (zs->inter && zset_size(zset) == 0) {
+        /* nothing is in every input */
+        for (ZStorePart &part : zs->parts) {
+            part = ZStorePart();
+        }
+        zs->nitems = 0;
+        zs->empty = true;
+    }
+    if (zs->empty) {
+        return;
+    }
+
+    if (!zset->packed) {
+        /* the hash codes are kept in the nodes */
+        AddArg aa;
+        aa.zs = zs;
+        aa.weight = weight;
+        hm_foreach(&zset->hmap, &cb_add, &aa);
+        return add_batch(&aa);
+    }
+    ZListpack *lp = zset->lp;
+    for (uint32_t pos = 0; lp && pos < lp->used; pos = lp_next(lp, pos)) {
+        const char *name = lp_name(lp, pos);
+        size_t len = lp_len(lp, pos);
+        zstore_item(zs, str_hash((uint8_t *)name, len), zstore_weigh(lp_score(lp, pos), weight), name, len);
+    }
+}
+
+static double zstore_combine(uint8_t agg, double a, double b) {
+    switch (agg) {
+    case Z_AGG_MIN: return a < b ? a : b;
+    case Z_AGG_MAX: return a > b ? a : b;
+    default: {
+        double s = a + b;
+        return isnan(s) ? 0 : s;    /* inf + -inf */
+    }
+    }
+}
+
+static bool zpair_less(const ZPair &a, const ZPair &b) {
+    if (a.score != b.score) {
+        return a.score < b.score;
+    }
+    int rv = memcmp(a.name, b.name, a.len < b.len ? a.len : b.len);
+    return rv != 0 ? rv < 0 : a.len < b.len;
+}
+
+/* aggregate the members of the same name in a partition, then sort them */
+static void part_aggregate(ZStore *zs, ZStorePart *part) {
+    std::vector<ZStoreItem> &items = part->items;
+    const char *names = part->names.data();
+
+    /* open addressing, the slots hold indexes into `aggs` */
+    size_t cap = 16;
+    while (cap < items.size() * 2) {
+        cap *= 2;
+    }
+    std::vector<uint32_t> slots(cap, UINT32_MAX);
+    std::vector<ZStoreItem> aggs;
+    std::vector<uint32_t> cnts;     /* the inputs each one is in */
+    aggs.reserve(items.size());
+    cnts.reserve(items.size());
+    for (const ZStoreItem &item : items) {
+        for (size_t pos = item.hcode & (cap - 1);; pos = (pos + 1) & (cap - 1)) {
+            uint32_t k = slots[pos];
+            if (k == UINT32_MAX) {
+                slots[pos] = (uint32_t)aggs.size();
+                aggs.push_back(item);
+                cnts.push_back(1);
+                break;
+            }
+            ZStoreItem &a = aggs[k];
+            if (a.hcode == item.hcode && a.len == item.len
+                && memcmp(names + a.off, names + item.off, item.len) == 0) {
+                a.score = zstore_combine(zs->agg, a.score, item.score);
+                cnts[k]++;
+                break;
+            }
+        }
+    }
+    items = std::vector<ZStoreItem>();
+
+    part->out.reserve(aggs.size());
+    for (size_t k = 0; k < aggs.size(); k++) {
+        if (!zs->inter || cnts[k] == zs->ninputs) {
+            part->out.push_back(ZPair{aggs[k].score, names + aggs[k].off, aggs[k].len});
+        }
+    }
+    std::sort(part->out.begin(), part->out.end(), &zpair_less);
+}
+
+static void cb_part(void *arg, size_t i) {
+    ZStore *zs = (ZStore *)arg;
+    part_aggregate(zs, &zs->parts[i]);
+}
+
+/* on the pool and the calling thread, or on the calling thread only */
+static void zstore_for(TheadPool *tp, size_t n, void (*f)(void *, size_t), void *arg) {
+    if (tp) {
+        return thread_pool_for(tp, n, f, arg);
+    }
+    for (size_t i = 0; i < n; i++) {
+        f(arg, i);
+    }
+}
+
+struct MergeArg {
+    ZStore *zs;
+    size_t step;
+};
+
+/* merge the pair i of sorted runs, `step` apart, into the first one */
+static void cb_merge(void *arg, size_t i) {
+    MergeArg *ma = (MergeArg *)arg;
+    std::vector<ZPair> &a = ma->zs->parts[2 * i * ma->step].out;
+    std::vector<ZPair> &b = ma->zs->parts[(2 * i + 1) * ma->step].out;
+    std::vector<ZPair> merged(a.size() + b.size());
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), merged.begin(), &zpair_less);
+    a.swap(merged);
+    b = std::vector<ZPair>();
+}
+
+void zstore_run(ZStore *zs, TheadPool *tp) {
+    zstore_for(tp, K_ZSTORE_PARTS, &cb_part, zs);
+    /* the sorted partitions are merged by pairs, the pairs of a round in parallel */
+    static_assert((K_ZSTORE_PARTS & (K_ZSTORE_PARTS - 1)) == 0, "a power of 2");
+    for (size_t step = 1; step < K_ZSTORE_PARTS; step *= 2) {
+        MergeArg ma = {zs, step};
+        zstore_for(tp, K_ZSTORE_PARTS / (2 * step), &cb_merge, &ma);
+    }
+
+    std::vector<ZPair> &pairs = zs->parts[0].out;
+    zs->dst = new ZSet();
+    zs->dst->index = (uint8_t)g_config.zset_index;
+    zset_build(zs->dst, pairs.data(), pairs.size());
+    /* the copies are freed here, not on the thread that takes the result */
+    for (ZStorePart &part : zs->parts) {
+        part = ZStorePart();
+    }
+}
@@ -10,6 +10,7 @@
 #ifdef __linux__
 
 #include <string.h>
+#include <math.h>
 
 #endif /* __linux  */
 
@@ -45,23 +46,117 @@ read_u32(const uint8_t *&cur, const uint8_t *end, uint32_t &out) {
 }
 
 bool
-read_str(const uint8_t *&cur, const uint8_t *end, size_t n, std::string &out) {
+read_str(const uint8_t *&cur, const uint8_t *end, size_t n, std::string_view &out) {
     if (cur + n > end) {
         return false;
     }
-    out.assign(cur, cur + n);
+    out = std::string_view((const char *)cur, n);   /* no copy */
     cur += n;
     return true;
 }
 
-bool str2dbl(const std::string &s, double &out) {
+/* the strto*() functions need a terminated string, it's copied to the stack */
+static const size_t k_num_buf = 64;
+
+bool str2dbl(std::string_view s, double &out) {
+    if (s.size() >= k_num_buf) {
+        std::string str(s);     /* rare: a long number */
+        char *endp = NULL;
+        out = strtod(str.c_str(), &endp);
+        return endp == str.c_str() + str.size() && !isnan(out);
+    }
+    char buf[k_num_buf];
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
     char *endp = NULL;
-    out = strtod(s.c_str(), &endp);
-    return endp == s.c_str() + s.size() && !isnan(out);
+    out = strtod(buf, &endp);
+    return endp == buf + s.size() && !isnan(out);
 }
 
-bool str2int(const std::string &s, int64_t &out) {
+bool str2int(std::string_view s, int64_t &out) {
+    if (s.size() >= k_num_buf) {
+        return false;   /* too many digits for an int64 */
+    }
+    char buf[k_num_buf];
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
     char *endp = NULL;
-    out = strtoll(s.c_str(), &endp, 10);
-    return endp == s.c_str() + s.size();
+    out = strtoll(buf, &endp, 10);
+    return endp == buf + s.size();
+}
+
+size_t int2str(int64_t val, char *buf) {
+    char tmp[20];
+    uint64_t u = val < 0 ? 0 - (uint64_t)val : (uint64_t)val;
+    size_t n = 0;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    size_t len = 0;
+    if (val < 0) {
+        buf[len++] = '-';
+    }
+    while (n) {
+        buf[len++] = tmp[--n];
+    }
+    return len;
+}
+
+/* one token of a glob pattern at `*p` against `ch`, `*p` moves past it */
+static bool glob_one(std::string_view pat, size_t *p, uint8_t ch) {
+    uint8_t c = (uint8_t)pat[(*p)++];
+    if (c == '?') {
+        return true;
+    }
+    if (c == '\\' && *p < pat.size()) {
+        return (uint8_t)pat[(*p)++] == ch;
+    }
+    if (c != '[') {
+        return c == ch;
+    }
+    /* a set: [abc], [a-z], [^a], a `]` first is a member */
+    bool neg = *p < pat.size() && pat[*p] == '^';
+    *p += neg;
+    bool hit = false;
+    for (size_t start = *p; *p < pat.size() && (pat[*p] != ']' || *p == start); ) {
+        uint8_t lo = (uint8_t)pat[(*p)++];
+        if (lo == '\\' && *p < pat.size()) {
+            lo = (uint8_t)pat[(*p)++];
+        }
+        uint8_t hi = lo;
+        if (*p + 1 < pat.size() && pat[*p] == '-' && pat[*p + 1] != ']') {
+            hi = (uint8_t)pat[*p + 1];
+            *p += 2;
+        }
+        hit = hit || (lo <= ch && ch <= hi) || (hi <= ch && ch <= lo);
+    }
+    *p += *p < pat.size();  /* the `]` */
+    return hit != neg;
+}
+
+bool glob_match(std::string_view pat, std::string_view str) {
+    size_t p = 0, s = 0;
+    size_t star = (size_t)-1, mark = 0;     /* the last `*`, and the input it took so far */
+    while (s < str.size()) {
+        if (p < pat.size() && pat[p] == '*') {
+            star = p++;
+            mark = s;
+            continue;
+        }
+        size_t next = p;
+        if (p < pat.size() && glob_one(pat, &next, (uint8_t)str[s])) {
+            p = next;
+            s++;
+        } else if (star != (size_t)-1) {
+            p = star + 1;   /* the `*` takes one more byte */
+            s = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pat.size() && pat[p] == '*') {
+        p++;
+    }
+    return p == pat.size();
 }
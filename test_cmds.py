@@ -30,6 +30,91 @@ $ ./build/bin/client_greenis zquery zset 1.1 "" 1 10
 $ ./build/bin/client_greenis zquery zset 1.1 "" 2 10
 (arr) len=0
 (arr) end
+$ ./build/bin/client_greenis zrank zset n2
+(int) 1
+$ ./build/bin/client_greenis zrevrank zset n2
+(int) 0
+$ ./build/bin/client_greenis zrank zset n3
+(nil)
+$ ./build/bin/client_greenis zrangebyscore zset (1.1 +inf
+(arr) len=2
+(str) n2
+(dbl) 2
+(arr) end
+$ ./build/bin/client_greenis zrangebyscore zset -inf 2 limit 1 1
+(arr) len=2
+(str) n2
+(dbl) 2
+(arr) end
+$ ./build/bin/client_greenis zrangebyscore zset 1 2 lim 1 1
+(err) 4 syntax error
+$ ./build/bin/client_greenis zrevrange zset 0 -1
+(arr) len=4
+(str) n2
+(dbl) 2
+(str) n1
+(dbl) 1.1
+(arr) end
+$ ./build/bin/client_greenis zcount zset 1 (2
+(int) 1
+$ ./build/bin/client_greenis zsum zset -inf +inf
+(dbl) 3.1
+$ ./build/bin/client_greenis zadd zsumbig -1e17 a 1 b 2 c
+(int) 3
+$ ./build/bin/client_greenis zsum zsumbig 0 10
+(dbl) 3
+$ ./build/bin/client_greenis zadd zsuminf -inf a 1 b 2 c
+(int) 3
+$ ./build/bin/client_greenis zsum zsuminf 0 10
+(dbl) 3
+$ ./build/bin/client_greenis zsum zsuminf -inf (2
+(dbl) -inf
+$ ./build/bin/client_greenis zquantile zset 0.5
+(dbl) 1.1
+$ ./build/bin/client_greenis zquantile zset 1 (1.1 2
+(dbl) 2
+$ ./build/bin/client_greenis zquantile zset 2
+(err) 4 expect a quantile in [0, 1]
+$ ./build/bin/client_greenis zadd zbulk 3 c 1 a 2 b 4 a
+(int) 3
+$ ./build/bin/client_greenis zrangebyscore zbulk -inf +inf
+(arr) len=6
+(str) b
+(dbl) 2
+(str) c
+(dbl) 3
+(str) a
+(dbl) 4
+(arr) end
+$ ./build/bin/client_greenis zadd zbulk 1 a 2
+(err) 4 syntax error
+$ ./build/bin/client_greenis zunionstore zu 2 zset zbulk weights 1 10
+(int) 5
+$ ./build/bin/client_greenis zrangebyscore zu -inf +inf
+(arr) len=10
+(str) n1
+(dbl) 1.1
+(str) n2
+(dbl) 2
+(str) b
+(dbl) 20
+(str) c
+(dbl) 30
+(str) a
+(dbl) 40
+(arr) end
+$ ./build/bin/client_greenis zunionstore zu 2 zbulk zbulk aggregate max
+(int) 3
+$ ./build/bin/client_greenis zscore zu a
+(dbl) 4
+$ ./build/bin/client_greenis zinterstore zu 2 zset zbulk
+(int) 0
+$ ./build/bin/client_greenis zscore zu a
+(nil)
+$ ./build/bin/client_greenis zunionstore zu 1 zbulk aggregate avg
+(err) 4 syntax error
+$ ./build/bin/client_greenis zunionstore zu 3 zbulk
+(err) 4 expect the number of keys
 $ ./build/bin/client_greenis zrem zset adsf
 (int) 0
 $ ./build/bin/client_greenis zrem zset n1
@@ -39,6 +124,56 @@ $ ./build/bin/client_greenis zquery zset 1 "" 0 10
 (str) n2
 (dbl) 2
 (arr) end
+$ ./build/bin/client_greenis zscan zset 0
+(arr) len=2
+(int) 0
+(arr) len=2
+(str) n2
+(dbl) 2
+(arr) end
+(arr) end
+$ ./build/bin/client_greenis zscan zset 0 match "n[0-9]" count 10
+(arr) len=2
+(int) 0
+(arr) len=2
+(str) n2
+(dbl) 2
+(arr) end
+(arr) end
+$ ./build/bin/client_greenis zscan zset 0 match x*
+(arr) len=2
+(int) 0
+(arr) len=0
+(arr) end
+(arr) end
+$ ./build/bin/client_greenis scan x
+(err) 4 expect cursor
+$ ./build/bin/client_greenis zscore zset
+(err) 4 wrong number of arguments.
+$ ./build/bin/client_greenis zscores zset n2
+(err) 1 unknown command.
+$ ./build/bin/client_greenis set cnt 10
+(nil)
+$ ./build/bin/client_greenis incr cnt
+(int) 11
+$ ./build/bin/client_greenis incrby cnt 5
+(int) 16
+$ ./build/bin/client_greenis decrby cnt 20
+(int) -4
+$ ./build/bin/client_greenis get cnt
+(str) -4
+$ ./build/bin/client_greenis incr zset
+(err) 3 value is not an integer
+$ ./build/bin/client_greenis set cnt 010
+(nil)
+$ ./build/bin/client_greenis incr cnt
+(err) 3 value is not an integer
+$ ./build/bin/client_greenis loglevel warn
+(str) warn
+$ ./build/bin/client_greenis loglevel
+(str) warn
+$ ./build/bin/client_greenis loglevel info
+(str) info
 '''
 
 